@@ -0,0 +1,143 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of async_client matching replies in order of calls: oneway calls
+// complete once written and do not take the reply of a later call.
+
+#include "check.hpp"
+#include <thrift/transport/tcp/async_client.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tt = apache::thrift::transport::tcp;
+namespace ba = boost::asio;
+
+std::string make_message(std::string const& payload, protocol::TMessageType type = protocol::T_CALL)
+{
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  protocol::TBinaryProtocol proto(buffer);
+  proto.writeMessageBegin("echo", type, 0);
+  proto.writeBinary(payload);
+  proto.writeMessageEnd();
+  return buffer->getBufferAsString();
+}
+
+std::string read_payload(std::string const& message)
+{
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  buffer->write(reinterpret_cast<const uint8_t*>(message.data()), static_cast<uint32_t>(message.size()));
+  protocol::TBinaryProtocol proto(buffer);
+  std::string name, payload;
+  protocol::TMessageType type;
+  int32_t seqid = 0;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(payload);
+  return payload;
+}
+
+void opened(boost::shared_ptr<boost::promise<void> > const& promise, boost::system::error_code const&)
+{
+  promise->set_value();
+}
+
+// Echoes frames of one connection in order, oneway ones get no reply like
+// from generated processors.
+void echo_server(ba::ip::tcp::acceptor& acceptor)
+{
+  ba::ip::tcp::socket socket(acceptor.get_io_service());
+  acceptor.accept(socket);
+
+  boost::system::error_code ec;
+  for (;;)
+  {
+    uint32_t length = 0U;
+    ba::read(socket, ba::buffer(&length, sizeof(length)), ec);
+    if (ec)
+      return;
+    std::string frame(ntohl(length), '\0');
+    ba::read(socket, ba::buffer(&frame[0], frame.size()), ec);
+    if (ec)
+      return;
+
+    uint8_t type = 0U;
+    tt::detail::binary_seqid_offset(frame.data(), frame.size(), type);
+    if (type != protocol::T_ONEWAY)
+      ba::write(socket, ba::buffer(std::string(reinterpret_cast<char*>(&length), sizeof(length)) + frame), ec);
+  }
+}
+
+void check_in_order()
+{
+  ba::io_service io_service;
+  ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0U));
+  boost::thread serving(boost::bind(echo_server, boost::ref(acceptor)));
+
+  tt::async_client_ptr client = tt::async_client::create("127.0.0.1", acceptor.local_endpoint().port());
+  THRIFT_CHECK(client->get_reply_matching() == tt::async_client::in_order);
+  try
+  {
+    boost::shared_ptr<boost::promise<void> > promise = boost::make_shared<boost::promise<void> >();
+    client->async_open(boost::bind(&opened, promise, _1));
+    promise->get_future().wait();
+
+    // calls are pipelined, a oneway one in between
+    tt::async_client::reply_future first = client->call(make_message("first"));
+    tt::async_client::reply_future oneway = client->call(make_message("one", protocol::T_ONEWAY));
+    tt::async_client::reply_future second = client->call(make_message("second"));
+
+    THRIFT_CHECK(read_payload(first.get()) == "first");
+    THRIFT_CHECK(oneway.get().empty());
+    THRIFT_CHECK(read_payload(second.get()) == "second");
+
+    // oneway call as the last one
+    THRIFT_CHECK(client->call(make_message("two", protocol::T_ONEWAY)).get().empty());
+    THRIFT_CHECK(read_payload(client->call(make_message("third")).get()) == "third");
+    THRIFT_CHECK(client->outstanding() == 0U);
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    ++benchmark::check_failures();
+  }
+
+  client->close();
+  serving.join();
+}
+
+} // namespace
+
+int main()
+{
+  // io_service of the clients
+  tt::io_service_access_ptr access = tt::get_io_service();
+  ba::io_service& io_service = *access;
+  ba::io_service::work work(io_service);
+  boost::thread running(boost::bind(&ba::io_service::run, &io_service));
+
+  check_in_order();
+
+  io_service.stop();
+  running.join();
+  return apache::thrift::benchmark::check_result();
+}
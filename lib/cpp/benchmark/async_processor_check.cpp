@@ -0,0 +1,223 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Checks of servers given a TAsyncProcessor: a call completed inline is
+// replied, a call held by the processor does not keep the I/O thread from
+// serving other connections and is replied once completed from another
+// thread, and a call completed with false closes its connection.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/async/TAsyncProcessor.h>
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/transport/tcp/transport.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+
+typedef tt::transport<boost::asio::ip::tcp::socket> transport_type;
+typedef boost::shared_ptr<transport_type> transport_ptr;
+
+const std::size_t held_size = 1000U;
+const std::size_t failed_size = 2000U;
+
+// Echoes payloads, calls carrying held_size bytes are completed by release()
+// and those carrying failed_size bytes fail.
+class deferred_echo : public async::TAsyncProcessor
+{
+public:
+  deferred_echo() : held_count(0)
+  {}
+
+  virtual void process
+  (
+    std::tr1::function<void(bool success)> completion,
+    boost::shared_ptr<protocol::TProtocol> in,
+    boost::shared_ptr<protocol::TProtocol> out
+  ) OVERRIDE
+  {
+    call c;
+    c.completion = completion;
+    c.out = out;
+    protocol::TMessageType type;
+    in->readMessageBegin(c.name, type, c.seqid);
+    in->readBinary(c.payload);
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+
+    if (c.payload.size() == failed_size)
+      completion(false);
+    else if (c.payload.size() == held_size)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      held.push_back(c);
+      ++held_count;
+    }
+    else
+      complete(c);
+  }
+
+  int held_calls()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    return held_count;
+  }
+
+  // Completes held calls from another thread.
+  void release()
+  {
+    std::vector<call> calls;
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      calls.swap(held);
+    }
+    boost::thread completing(boost::bind(&deferred_echo::complete_all, calls));
+    completing.join();
+  }
+
+private:
+  struct call
+  {
+    std::tr1::function<void(bool success)> completion;
+    boost::shared_ptr<protocol::TProtocol> out;
+    std::string name, payload;
+    int32_t seqid;
+  };
+
+  static void complete(call const& c)
+  {
+    c.out->writeMessageBegin(c.name, protocol::T_REPLY, c.seqid);
+    c.out->writeBinary(c.payload);
+    c.out->writeMessageEnd();
+    c.out->getTransport()->writeEnd();
+    c.out->getTransport()->flush();
+    c.completion(true);
+  }
+
+  static void complete_all(std::vector<call> const& calls)
+  {
+    std::for_each(calls.begin(), calls.end(), &deferred_echo::complete);
+  }
+
+  boost::mutex mutex;
+  std::vector<call> held;
+  int held_count;
+};
+
+void send_request(transport::TTransport& transport, std::size_t payload_size)
+{
+  const std::string request = benchmark::make_request(payload_size);
+  transport.write(reinterpret_cast<const uint8_t*>(request.data()), static_cast<uint32_t>(request.size()));
+}
+
+// Whether the echoed payload of a request comes back.
+bool read_reply(transport_ptr const& transport, std::size_t payload_size)
+{
+  uint32_t length = 0U;
+  transport->readAll(reinterpret_cast<uint8_t*>(&length), sizeof(length));
+
+  protocol::TBinaryProtocol proto(transport);
+  std::string name, payload;
+  protocol::TMessageType type;
+  int32_t seqid = 0;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(payload);
+  proto.readMessageEnd();
+  return type == protocol::T_REPLY && payload == std::string(payload_size, 'x');
+}
+
+// Whether the server closes the connection instead of replying.
+bool closed(transport_ptr const& transport)
+{
+  try
+  {
+    uint8_t header[4];
+    return transport->read(header, sizeof(header)) == 0U;
+  }
+  catch (transport::TTransportException const&)
+  {
+    return true;
+  }
+}
+
+void check_async_processor()
+{
+  boost::shared_ptr<deferred_echo> processor = boost::make_shared<deferred_echo>();
+  // one I/O thread, so a held call holding it would stall the other client
+  boost::shared_ptr<tcp::server> server = benchmark::make_server<tcp::server>(processor);
+  benchmark::check_server<tcp::server> serving(server);
+
+  transport_ptr waiting = boost::make_shared<transport_type>("127.0.0.1", serving.port());
+  transport_ptr other = boost::make_shared<transport_type>("127.0.0.1", serving.port());
+  waiting->open();
+  other->open();
+  waiting->setRecvTimeout(10000);
+  other->setRecvTimeout(10000);
+
+  // completed inline
+  send_request(*other, 100U);
+  THRIFT_CHECK(read_reply(other, 100U));
+
+  // held call does not block the other connection
+  send_request(*waiting, held_size);
+  for (int i = 0; i < 500 && !processor->held_calls(); ++i)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  THRIFT_CHECK(processor->held_calls() == 1);
+  for (int i = 0; i < 10; ++i)
+  {
+    send_request(*other, 100U);
+    THRIFT_CHECK(read_reply(other, 100U));
+  }
+
+  // replied once completed on another thread, the connection goes on
+  processor->release();
+  THRIFT_CHECK(read_reply(waiting, held_size));
+  send_request(*waiting, 100U);
+  THRIFT_CHECK(read_reply(waiting, 100U));
+
+  // failed call closes its connection only
+  send_request(*waiting, failed_size);
+  THRIFT_CHECK(closed(waiting));
+  send_request(*other, 100U);
+  THRIFT_CHECK(read_reply(other, 100U));
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_async_processor();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
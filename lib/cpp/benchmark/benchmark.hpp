@@ -0,0 +1,236 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_BENCHMARK_BENCHMARK_HPP_
+#define _THRIFT_BENCHMARK_BENCHMARK_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/TProcessor.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace apache { namespace thrift { namespace benchmark {
+
+//  options   -----------------------------------------------//
+// Parses command line arguments given as --name=value. Every option may
+// hold a comma separated list of values, benchmarks run the cartesian
+// product of all lists.
+class options
+{
+public:
+  options(int argc, char* argv[])
+  {
+    for (int i = 1; i < argc; ++i)
+    {
+      std::string arg(argv[i]);
+      if (arg.compare(0, 2, "--") != 0)
+        continue;
+      std::string::size_type eq = arg.find('=');
+      if (eq == std::string::npos)
+        values[arg.substr(2)] = "1";
+      else
+        values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+  }
+
+  bool has(std::string const& name) const
+  {
+    return values.find(name) != values.end();
+  }
+
+  template <class T>
+  T get(std::string const& name, T const& def) const
+  {
+    std::map<std::string, std::string>::const_iterator it = values.find(name);
+    if (it == values.end())
+      return def;
+    return boost::lexical_cast<T>(it->second);
+  }
+
+  template <class T>
+  std::vector<T> get_list(std::string const& name, std::string const& def) const
+  {
+    std::map<std::string, std::string>::const_iterator it = values.find(name);
+    std::istringstream in(it == values.end() ? def : it->second);
+    std::vector<T> result;
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+      if (!item.empty())
+        result.push_back(boost::lexical_cast<T>(item));
+    }
+    return result;
+  }
+
+private:
+  std::map<std::string, std::string> values;
+};
+
+//  echo_processor   -----------------------------------------------//
+// Replies to every call with the binary payload it has received. Only
+// message framing is exercised, so what is measured is the server and
+// not the generated code.
+class echo_processor : public apache::thrift::TProcessor
+{
+public:
+  virtual bool process
+  (
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+    void* /*connectionContext*/
+  ) OVERRIDE
+  {
+    std::string name, payload;
+    apache::thrift::protocol::TMessageType type;
+    int32_t seqid = 0;
+
+    in->readMessageBegin(name, type, seqid);
+    in->readBinary(payload);
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+
+    out->writeMessageBegin(name, apache::thrift::protocol::T_REPLY, seqid);
+    out->writeBinary(payload);
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+};
+
+// Serializes a framed "echo" call carrying payload_size bytes.
+inline std::string make_request(std::size_t payload_size, int32_t seqid = 0)
+{
+  using namespace apache::thrift;
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  boost::shared_ptr<transport::TFramedTransport> framed = boost::make_shared<transport::TFramedTransport>(buffer);
+  protocol::TBinaryProtocolT<transport::TFramedTransport> proto(framed);
+
+  proto.writeMessageBegin("echo", protocol::T_CALL, seqid);
+  proto.writeBinary(std::string(payload_size, 'x'));
+  proto.writeMessageEnd();
+  framed->writeEnd();
+  framed->flush();
+
+  return buffer->getBufferAsString();
+}
+
+//  latency_stats   -----------------------------------------------//
+// Collects latency samples in nanoseconds.
+class latency_stats
+{
+public:
+  void reserve(std::size_t n)
+  {
+    samples.reserve(n);
+  }
+
+  void add(boost::uint64_t ns)
+  {
+    samples.push_back(ns);
+  }
+
+  void merge(latency_stats const& other)
+  {
+    samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+  }
+
+  std::size_t count() const
+  {
+    return samples.size();
+  }
+
+  // Returns the p-th percentile (0 < p < 1) in nanoseconds.
+  boost::uint64_t percentile(double p)
+  {
+    if (samples.empty())
+      return 0U;
+    std::vector<boost::uint64_t>::iterator nth = samples.begin() +
+      static_cast<std::ptrdiff_t>(p * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), nth, samples.end());
+    return *nth;
+  }
+
+private:
+  std::vector<boost::uint64_t> samples;
+};
+
+//  report   -----------------------------------------------//
+// Writes one flat JSON object per line, fields are kept in insertion order.
+class report
+{
+public:
+  template <class T>
+  report& operator()(std::string const& key, T const& value)
+  {
+    separator();
+    out << '"' << key << "\":" << value;
+    return *this;
+  }
+
+  report& operator()(std::string const& key, std::string const& value)
+  {
+    separator();
+    out << '"' << key << "\":\"" << value << '"';
+    return *this;
+  }
+
+  report& operator()(std::string const& key, const char* value)
+  {
+    return (*this)(key, std::string(value));
+  }
+
+  report& operator()(std::string const& key, bool value)
+  {
+    separator();
+    out << '"' << key << "\":" << (value ? "true" : "false");
+    return *this;
+  }
+
+  void print(std::ostream& os = std::cout) const
+  {
+    os << '{' << out.str() << '}' << std::endl;
+  }
+
+private:
+  void separator()
+  {
+    if (!out.str().empty())
+      out << ',';
+  }
+
+  std::ostringstream out;
+};
+
+} // namespace benchmark
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_BENCHMARK_BENCHMARK_HPP_
@@ -0,0 +1,136 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_BENCHMARK_CHECK_HPP_
+#define _THRIFT_BENCHMARK_CHECK_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <iostream>
+#include <string>
+
+namespace apache { namespace thrift { namespace benchmark {
+
+//  checks   -----------------------------------------------//
+// Behaviour checks are plain programs registered with add_test(). Every
+// failed THRIFT_CHECK is reported on stderr and check_result() makes the
+// program fail.
+inline unsigned& check_failures()
+{
+  static unsigned failures = 0U;
+  return failures;
+}
+
+inline void check(bool passed, const char* expression, const char* file, int line)
+{
+  if (passed)
+    return;
+  ++check_failures();
+  std::cerr << file << "(" << line << "): check failed: " << expression << std::endl;
+}
+
+// Exit code of the program.
+inline int check_result()
+{
+  if (!check_failures())
+    return 0;
+  std::cerr << check_failures() << " check(s) failed" << std::endl;
+  return 1;
+}
+
+//  make_server, check_server   -----------------------------------------------//
+// Framed TBinaryProtocol server on loopback. Checks use a port chosen by
+// the system, so they may run in parallel, port is given to listen on the
+// port of a previous server again.
+template <class Server, class Processor>
+boost::shared_ptr<Server> make_server(boost::shared_ptr<Processor> const& processor, unsigned short port = 0U)
+{
+  return boost::make_shared<Server>(processor,
+    boost::make_shared<apache::thrift::transport::TFramedTransportFactory>(),
+    boost::make_shared<apache::thrift::protocol::TBinaryProtocolFactory>(),
+    "127.0.0.1", boost::lexical_cast<std::string>(port));
+}
+
+// Serves a configured server on a thread until stop() or destruction. The
+// server listens since it was constructed, clients connect without waiting
+// and their requests are served once serve() runs.
+template <class Server>
+class check_server : private boost::noncopyable
+{
+public:
+  explicit check_server(boost::shared_ptr<Server> const& s)
+    : server(s), serving(boost::bind(&Server::serve, s.get()))
+  {}
+
+  ~check_server()
+  {
+    stop();
+  }
+
+  void stop()
+  {
+    if (!serving.joinable())
+      return;
+    // stop() before serve() has started is not lost
+    server->stop();
+    serving.join();
+  }
+
+  unsigned short port() const
+  {
+    return server->local_endpoint().port();
+  }
+
+  Server* operator->() const
+  {
+    return server.get();
+  }
+
+private:
+  boost::shared_ptr<Server> server;
+  boost::thread serving;
+};
+
+// Loopback port nobody listens on, connections to it are refused.
+inline unsigned short unused_port()
+{
+  boost::asio::io_service io_service;
+  boost::asio::ip::tcp::acceptor acceptor(io_service,
+    boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0U));
+  return acceptor.local_endpoint().port();
+}
+
+} // namespace benchmark
+} // namespace thrift
+} // namespace apache
+
+#define THRIFT_CHECK(expression) \
+  ::apache::thrift::benchmark::check(!!(expression), #expression, __FILE__, __LINE__)
+
+#endif // _THRIFT_BENCHMARK_CHECK_HPP_
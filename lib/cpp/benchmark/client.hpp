@@ -0,0 +1,262 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_BENCHMARK_CLIENT_HPP_
+#define _THRIFT_BENCHMARK_CLIENT_HPP_
+
+#include "benchmark.hpp"
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/chrono.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+
+namespace apache { namespace thrift { namespace benchmark {
+
+typedef boost::chrono::steady_clock clock_type;
+
+// Connection setup that varies on stream type.
+inline void handshake(boost::asio::ip::tcp::socket&)
+{}
+
+inline void handshake(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>& s)
+{
+  s.handshake(boost::asio::ssl::stream_base::client);
+}
+
+//  scenario   -----------------------------------------------//
+struct scenario
+{
+  std::size_t connections;
+  std::size_t payload;
+  std::size_t depth;       // requests in flight per connection
+  std::size_t requests;    // measured requests per connection
+  std::size_t warmup;      // not measured requests per connection
+  std::size_t threads;     // client threads
+};
+
+//  result   -----------------------------------------------//
+struct result
+{
+  result() : replies(0U), requests(0U), bytes(0U), errors(0U), seconds(0.0)
+  {}
+
+  boost::uint64_t replies;   // including warmup
+  boost::uint64_t requests;  // measured
+  boost::uint64_t bytes;
+  boost::uint64_t errors;
+  double seconds;
+  latency_stats latency;
+};
+
+//  client_connection   -----------------------------------------------//
+// Keeps up to depth framed requests in flight on a single connection and
+// measures the time from queuing a request until its reply is read.
+template <class Stream>
+class client_connection : public boost::enable_shared_from_this<client_connection<Stream> >, private boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr<client_connection> pointer_type;
+
+  client_connection(boost::shared_ptr<Stream> const& s, std::string const& request, scenario const& sc)
+    : stream(s), request_size(request.size()), depth(std::max<std::size_t>(sc.depth, 1U)),
+      total(sc.requests + sc.warmup), warmup(sc.warmup), sent(0U), received(0U), pending(0U),
+      writing(false), errors(0U), bytes(0U)
+  {
+    pipeline.reserve(request.size() * depth);
+    for (std::size_t i = 0; i < depth; ++i)
+      pipeline += request;
+    latency.reserve(sc.requests);
+  }
+
+  void connect(boost::asio::ip::tcp::endpoint const& endpoint)
+  {
+    stream->lowest_layer().connect(endpoint);
+    stream->lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true));
+    handshake(*stream);
+  }
+
+  void start()
+  {
+    send(std::min(depth, total));
+    read_header();
+  }
+
+  latency_stats const& get_latency() const { return latency; }
+  boost::uint64_t get_errors() const { return errors; }
+  boost::uint64_t get_bytes() const { return bytes; }
+  boost::uint64_t get_replies() const { return received; }
+  boost::uint64_t get_requests() const { return received > warmup ? received - warmup : 0U; }
+
+private:
+  void send(std::size_t n)
+  {
+    const clock_type::time_point now = clock_type::now();
+    for (std::size_t i = 0; i < n; ++i)
+      timestamps.push_back(now);
+    sent += n;
+    pending += n;
+    if (!writing)
+      write();
+  }
+
+  void write()
+  {
+    const std::size_t n = std::min(pending, depth);
+    pending -= n;
+    writing = true;
+    boost::asio::async_write(*stream, boost::asio::buffer(pipeline.data(), n * request_size),
+      boost::bind(&client_connection::handle_write, this->shared_from_this(), boost::asio::placeholders::error));
+  }
+
+  void handle_write(boost::system::error_code const& error)
+  {
+    writing = false;
+    if (error)
+      ++errors;
+    else if (pending)
+      write();
+  }
+
+  void read_header()
+  {
+    boost::asio::async_read(*stream, boost::asio::buffer(header, sizeof(header)),
+      boost::bind(&client_connection::handle_header, this->shared_from_this(), boost::asio::placeholders::error));
+  }
+
+  void handle_header(boost::system::error_code const& error)
+  {
+    if (error)
+    {
+      ++errors;
+      return;
+    }
+    uint32_t frame_size = 0U;
+    std::memcpy(&frame_size, header, sizeof(header));
+    body.resize(ntohl(frame_size));
+    boost::asio::async_read(*stream, boost::asio::buffer(body),
+      boost::bind(&client_connection::handle_body, this->shared_from_this(), boost::asio::placeholders::error));
+  }
+
+  void handle_body(boost::system::error_code const& error)
+  {
+    if (error)
+    {
+      ++errors;
+      return;
+    }
+
+    const clock_type::time_point now = clock_type::now();
+    if (++received > warmup)
+    {
+      latency.add(boost::chrono::duration_cast<boost::chrono::nanoseconds>(now - timestamps.front()).count());
+      bytes += request_size + sizeof(header) + body.size();
+    }
+    timestamps.pop_front();
+
+    if (sent < total)
+      send(1U);
+    if (received < total)
+      read_header();
+    else
+      stream->lowest_layer().close();
+  }
+
+  boost::shared_ptr<Stream> stream;
+  std::string pipeline;
+  std::size_t request_size;
+  std::size_t depth, total, warmup;
+  std::size_t sent, received, pending;
+  bool writing;
+  std::deque<clock_type::time_point> timestamps;
+  uint8_t header[sizeof(uint32_t)];
+  std::vector<uint8_t> body;
+  latency_stats latency;
+  boost::uint64_t errors;
+  boost::uint64_t bytes;
+};
+
+//  load_generator   -----------------------------------------------//
+// Opens sc.connections connections spread over sc.threads io_services
+// (one thread each) and drives them until every request is answered.
+template <class Stream>
+class load_generator : private boost::noncopyable
+{
+public:
+  typedef boost::function<boost::shared_ptr<Stream>(boost::asio::io_service&)> stream_factory;
+
+  load_generator(boost::asio::ip::tcp::endpoint const& ep, stream_factory const& f) : endpoint(ep), factory(f)
+  {}
+
+  result run(scenario const& sc)
+  {
+    typedef typename client_connection<Stream>::pointer_type connection_pointer;
+
+    const std::size_t threads = std::max<std::size_t>(sc.threads, 1U);
+    std::vector<boost::shared_ptr<boost::asio::io_service> > io_services;
+    for (std::size_t i = 0; i < threads; ++i)
+      io_services.push_back(boost::make_shared<boost::asio::io_service>());
+
+    const std::string request = make_request(sc.payload);
+    std::vector<connection_pointer> connections;
+    for (std::size_t i = 0; i < sc.connections; ++i)
+    {
+      connection_pointer c = boost::make_shared<client_connection<Stream> >(factory(*io_services[i % threads]), request, sc);
+      c->connect(endpoint);
+      connections.push_back(c);
+    }
+
+    const clock_type::time_point start = clock_type::now();
+    for (std::size_t i = 0; i < connections.size(); ++i)
+      connections[i]->start();
+
+    boost::thread_group workers;
+    for (std::size_t i = 0; i < threads; ++i)
+      workers.create_thread(boost::bind(&boost::asio::io_service::run, io_services[i].get()));
+    workers.join_all();
+
+    result r;
+    r.seconds = boost::chrono::duration<double>(clock_type::now() - start).count();
+    for (std::size_t i = 0; i < connections.size(); ++i)
+    {
+      r.replies += connections[i]->get_replies();
+      r.requests += connections[i]->get_requests();
+      r.bytes += connections[i]->get_bytes();
+      r.errors += connections[i]->get_errors();
+      r.latency.merge(connections[i]->get_latency());
+    }
+    return r;
+  }
+
+private:
+  boost::asio::ip::tcp::endpoint endpoint;
+  stream_factory factory;
+};
+
+} // namespace benchmark
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_BENCHMARK_CLIENT_HPP_
@@ -0,0 +1,339 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Microbenchmarks of the per-request path of the server without sockets:
+// basic_connection framing driven through an in-memory stream with synchronous
+// and asynchronous processors, request_handler construction and TMemoryBuffer
+// reuse. Results are written to stdout as one JSON object per line.
+//
+// Allocations are the calls to the global operator new made by the measured
+// code, storage that TMemoryBuffer obtains with malloc/realloc is not counted.
+//
+// Options (lists are comma separated):
+//   --payload=bytes,...   request and reply payload size (default: 64,4096,65536)
+//   --requests=n          iterations of every benchmark (default: 100000)
+
+#include "benchmark.hpp"
+#include "memory_stream.hpp"
+#include <thrift/server/tcp/basic_connection.hpp>
+#include <thrift/server/tcp/request_handler.hpp>
+#include <thrift/server/tcp/gather_transport.hpp>
+#include <boost/chrono.hpp>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::size_t allocations = 0U;
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+  ++allocations;
+  if (void* p = std::malloc(size ? size : 1U))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) BOOST_NOEXCEPT_OR_NOTHROW
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) BOOST_NOEXCEPT_OR_NOTHROW
+{
+  std::free(p);
+}
+
+using namespace apache::thrift;
+using namespace apache::thrift::benchmark;
+
+namespace {
+
+typedef boost::chrono::steady_clock clock_type;
+typedef server::tcp::basic_connection<memory_stream, memory_stream_traits> memory_connection;
+
+//  bench_server   -----------------------------------------------//
+// Supplies factories to connections, it never serves.
+class bench_server : public server::tcp::detail::tcp_server_base
+{
+public:
+  explicit bench_server(boost::shared_ptr<TProcessor> const& processor) : server::tcp::detail::tcp_server_base(processor)
+  {
+    set_factories();
+  }
+
+  explicit bench_server(boost::shared_ptr<async::TAsyncProcessor> const& processor) : server::tcp::detail::tcp_server_base(processor)
+  {
+    set_factories();
+  }
+
+  virtual void serve() OVERRIDE
+  {}
+
+  // Replies are written by gather_transport.
+  void gather_output()
+  {
+    setOutputTransportFactory(boost::make_shared<server::tcp::gather_transport_factory>());
+  }
+
+private:
+  void set_factories()
+  {
+    setInputTransportFactory(boost::make_shared<transport::TFramedTransportFactory>());
+    setOutputTransportFactory(boost::make_shared<transport::TFramedTransportFactory>());
+    setInputProtocolFactory(boost::make_shared<protocol::TBinaryProtocolFactory>());
+    setOutputProtocolFactory(boost::make_shared<protocol::TBinaryProtocolFactory>());
+  }
+};
+
+//  async_echo_processor   -----------------------------------------------//
+// Completes immediately on the calling thread, measures the cost of handing
+// the reply back to the connection's io_service.
+class async_echo_processor : public async::TAsyncProcessor
+{
+public:
+  virtual void process
+  (
+    std::tr1::function<void(bool success)> _return,
+    boost::shared_ptr<protocol::TProtocol> in,
+    boost::shared_ptr<protocol::TProtocol> out
+  ) OVERRIDE
+  {
+#ifdef BOOST_NO_CXX11_NULLPTR
+    _return(echo.process(in, out, 0));
+#else
+    _return(echo.process(in, out, nullptr));
+#endif
+  }
+
+private:
+  echo_processor echo;
+};
+
+//  raw_processor   -----------------------------------------------//
+// Answers with a fixed, already serialized reply without decoding the
+// request, so only framing and buffer handling remain.
+class raw_processor : public TProcessor
+{
+public:
+  explicit raw_processor(std::string const& r) : reply(r)
+  {}
+
+  virtual bool process
+  (
+    boost::shared_ptr<protocol::TProtocol> in,
+    boost::shared_ptr<protocol::TProtocol> out,
+    void* /*connectionContext*/
+  ) OVERRIDE
+  {
+    in->getTransport()->readEnd();
+    out->getTransport()->write(reinterpret_cast<const uint8_t*>(reply.data()), static_cast<uint32_t>(reply.size()));
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+
+private:
+  std::string reply;
+};
+
+//  blob_processor   -----------------------------------------------//
+// Replies with a shared blob of payload size. It is referenced when output
+// transport is gather_transport and copied otherwise.
+class blob_processor : public TProcessor
+{
+public:
+  explicit blob_processor(std::size_t size) : blob(boost::make_shared<std::vector<uint8_t> >(size, 'x'))
+  {}
+
+  virtual bool process
+  (
+    boost::shared_ptr<protocol::TProtocol> in,
+    boost::shared_ptr<protocol::TProtocol> out,
+    void* /*connectionContext*/
+  ) OVERRIDE
+  {
+    std::string name, payload;
+    protocol::TMessageType type;
+    int32_t seqid = 0;
+
+    in->readMessageBegin(name, type, seqid);
+    in->readBinary(payload);
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+
+    out->writeMessageBegin(name, protocol::T_REPLY, seqid);
+    server::tcp::write_binary_reference(*out, &(*blob)[0], static_cast<uint32_t>(blob->size()), blob);
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+
+private:
+  boost::shared_ptr<std::vector<uint8_t> > blob;
+};
+
+struct measurement
+{
+  measurement() : start(clock_type::now()), start_allocations(allocations)
+  {}
+
+  void print(std::string const& name, std::size_t payload, std::size_t iterations) const
+  {
+    const double ns = static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>(clock_type::now() - start).count());
+    const double allocs = static_cast<double>(allocations - start_allocations);
+    report()
+      ("benchmark", name)
+      ("payload", payload)
+      ("requests", iterations)
+      ("ns_per_request", ns / iterations)
+      ("allocations_per_request", allocs / iterations)
+      .print();
+  }
+
+  clock_type::time_point start;
+  std::size_t start_allocations;
+};
+
+void bench_connection(std::string const& name, bench_server& server, std::size_t payload, std::size_t requests)
+{
+  boost::asio::io_service io_service;
+
+  boost::shared_ptr<memory_connection> connection = memory_connection::create(io_service, server);
+  connection->stream().reset(make_request(payload), requests);
+  connection->start();
+
+  measurement m;
+  io_service.run();
+  m.print(name, payload, requests);
+
+  if (!connection->stream().get_written_bytes())
+    std::cerr << name << ": no reply has been written" << std::endl;
+}
+
+template <class Processor>
+void bench_connection(std::string const& name, boost::shared_ptr<Processor> const& processor,
+  std::size_t payload, std::size_t requests, server::tcp::method_priorities const* priorities = 0)
+{
+  bench_server server(processor);
+  if (priorities)
+    server.setMethodPriorities(*priorities);
+  bench_connection(name, server, payload, requests);
+}
+
+void bench_gather(std::size_t payload, std::size_t requests)
+{
+  boost::shared_ptr<blob_processor> processor = boost::make_shared<blob_processor>(payload);
+  bench_connection("connection.blob_copied", processor, payload, requests);
+
+  bench_server server(processor);
+  server.gather_output();
+  bench_connection("connection.blob_gathered", server, payload, requests);
+}
+
+void bench_request_handler(std::size_t payload, std::size_t requests)
+{
+  bench_server server(boost::make_shared<echo_processor>());
+  boost::shared_ptr<transport::TMemoryBuffer> rbuf = boost::make_shared<transport::TMemoryBuffer>();
+  boost::shared_ptr<transport::TMemoryBuffer> wbuf = boost::make_shared<transport::TMemoryBuffer>();
+
+  measurement m;
+  for (std::size_t i = 0; i < requests; ++i)
+  {
+    server::tcp::request_handler handler(server, rbuf, wbuf);
+  }
+  m.print("request_handler.construct", payload, requests);
+}
+
+void fill(transport::TMemoryBuffer& buffer, std::string const& request, std::vector<uint8_t>& out)
+{
+  const uint32_t size = static_cast<uint32_t>(request.size());
+  std::memcpy(buffer.getWritePtr(size), request.data(), size);
+  buffer.wroteBytes(size);
+  buffer.read(&out[0], size);
+}
+
+void bench_memory_buffer(std::size_t payload, std::size_t requests)
+{
+  const std::string request = make_request(payload);
+  std::vector<uint8_t> out(request.size());
+
+  {
+    transport::TMemoryBuffer buffer;
+    measurement m;
+    for (std::size_t i = 0; i < requests; ++i)
+    {
+      fill(buffer, request, out);
+      buffer.resetBuffer();
+    }
+    m.print("memory_buffer.reuse", payload, requests);
+  }
+
+  {
+    measurement m;
+    for (std::size_t i = 0; i < requests; ++i)
+    {
+      boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+      fill(*buffer, request, out);
+    }
+    m.print("memory_buffer.fresh", payload, requests);
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  options opts(argc, argv);
+  const std::vector<std::size_t> payloads = opts.get_list<std::size_t>("payload", "64,4096,65536");
+  const std::size_t requests = std::max<std::size_t>(opts.get<std::size_t>("requests", 100000), 1U);
+  server::tcp::method_priorities priorities(2, server::tcp::method_priorities::weighted);
+  priorities.map("echo", 0).weight(0, 4);
+
+  try
+  {
+    for (std::size_t i = 0; i < payloads.size(); ++i)
+    {
+      const std::size_t payload = payloads[i];
+      bench_connection("connection.echo", boost::make_shared<echo_processor>(), payload, requests);
+      bench_connection("connection.raw", boost::make_shared<raw_processor>(std::string(payload, 'x')), payload, requests);
+      bench_connection("connection.async_echo", boost::make_shared<async_echo_processor>(), payload, requests);
+      bench_connection("connection.prioritized_echo", boost::make_shared<echo_processor>(), payload, requests, &priorities);
+      bench_gather(payload, requests);
+      bench_request_handler(payload, requests);
+      bench_memory_buffer(payload, requests);
+    }
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
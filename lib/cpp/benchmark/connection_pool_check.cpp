@@ -0,0 +1,175 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of connection_pool checkout, invalidation, eviction of idle
+// connections and recovery after the server restarts.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/transport/tcp/connection_pool.hpp>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+
+const char* const address = "127.0.0.1";
+typedef benchmark::check_server<tcp::server> server_type;
+
+// Port of the first server, the restarted one listens on it again.
+unsigned short port = 0U;
+
+server_type* start_server()
+{
+  server_type* server = new server_type(benchmark::make_server<tcp::server>(boost::make_shared<benchmark::echo_processor>(), port));
+  port = server->port();
+  return server;
+}
+
+bool call(tt::connection_pool::transport_ptr const& transport)
+{
+  const std::string request = benchmark::make_request(100U);
+  // pooled transport is framed already
+  transport->write(reinterpret_cast<const uint8_t*>(request.data()) + 4, static_cast<uint32_t>(request.size() - 4U));
+  transport->flush();
+
+  protocol::TBinaryProtocol proto(transport);
+  std::string name, payload;
+  protocol::TMessageType type;
+  int32_t seqid = 0;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(payload);
+  proto.readMessageEnd();
+  transport->readEnd();
+  return payload.size() == 100U;
+}
+
+// Waits up to 3 seconds for the pool to hold count idle connections.
+bool wait_idle(tt::connection_pool const& pool, std::size_t count)
+{
+  for (int i = 0; i < 300 && pool.idle(address, port) != count; ++i)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  return pool.idle(address, port) == count;
+}
+
+boost::atomic<int> failed_calls(0);
+
+void call_repeatedly(tt::connection_pool* pool)
+{
+  for (int i = 0; i < 100; ++i)
+  {
+    if (!call(pool->checkout(address, port)))
+      ++failed_calls;
+  }
+}
+
+void check_pool()
+{
+  boost::scoped_ptr<server_type> server(start_server());
+
+  tt::pool_options options;
+  options.min_size = 2U;
+  options.max_size = 4U;
+  options.check_interval = boost::chrono::milliseconds(100);
+  options.idle_timeout = boost::chrono::milliseconds(300);
+  options.checkout_timeout = boost::chrono::milliseconds(200);
+  tt::connection_pool::transport_ptr outliving;
+  {
+    tt::connection_pool pool(options);
+    pool.prewarm(address, port);
+    THRIFT_CHECK(pool.idle(address, port) == 2U);
+
+    {
+      tt::connection_pool::transport_ptr transport = pool.checkout(address, port);
+      THRIFT_CHECK(call(transport));
+      THRIFT_CHECK(pool.checked_out(address, port) == 1U);
+      THRIFT_CHECK(pool.idle(address, port) == 1U);
+    }
+    // returned when dropped
+    THRIFT_CHECK(pool.idle(address, port) == 2U);
+    THRIFT_CHECK(pool.checked_out(address, port) == 0U);
+
+    boost::thread_group callers;
+    for (int i = 0; i < 8; ++i)
+      callers.create_thread(boost::bind(call_repeatedly, &pool));
+    callers.join_all();
+    THRIFT_CHECK(failed_calls == 0);
+    THRIFT_CHECK(pool.idle(address, port) <= options.max_size);
+
+    // max_size checked out, next checkout times out
+    std::vector<tt::connection_pool::transport_ptr> held;
+    for (std::size_t i = 0; i < options.max_size; ++i)
+      held.push_back(pool.checkout(address, port));
+    bool timed_out = false;
+    try
+    {
+      pool.checkout(address, port);
+    }
+    catch (transport::TTransportException const&)
+    {
+      timed_out = true;
+    }
+    THRIFT_CHECK(timed_out);
+
+    // invalidated connection is closed instead of returned
+    tt::connection_pool::invalidate(held[0]);
+    held.clear();
+    THRIFT_CHECK(pool.idle(address, port) == options.max_size - 1U);
+
+    // idle ones above min_size are closed after idle_timeout
+    THRIFT_CHECK(wait_idle(pool, options.min_size));
+
+    // dead connections are dropped while the server is down
+    server.reset();
+    THRIFT_CHECK(wait_idle(pool, 0U));
+
+    // and min_size is reopened once it is back
+    server.reset(start_server());
+    THRIFT_CHECK(wait_idle(pool, options.min_size));
+    THRIFT_CHECK(call(pool.checkout(address, port)));
+
+    // checked out connection may outlive the pool
+    outliving = pool.checkout(address, port);
+  }
+  THRIFT_CHECK(call(outliving));
+  outliving.reset();
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_pool();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of gather_transport: completed frames and referenced buffers are
+// gathered in order and frame sizes count the referenced bytes.
+
+#include "check.hpp"
+#include <thrift/server/tcp/gather_transport.hpp>
+#include <boost/asio/buffers_iterator.hpp>
+#include <boost/make_shared.hpp>
+
+namespace {
+
+using apache::thrift::server::tcp::gather_transport;
+
+std::string gathered(gather_transport& transport)
+{
+  gather_transport::const_buffers buffers = transport.buffers();
+  return std::string(boost::asio::buffers_begin(buffers), boost::asio::buffers_end(buffers));
+}
+
+std::string frame(std::string const& data)
+{
+  const uint32_t size = htonl(static_cast<uint32_t>(data.size()));
+  return std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + data;
+}
+
+void check_gather()
+{
+  boost::shared_ptr<std::string> large = boost::make_shared<std::string>(2 * gather_transport::reference_threshold, 'r');
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(large->data());
+  const uint32_t size = static_cast<uint32_t>(large->size());
+
+  gather_transport transport;
+
+  // reference ending a frame, then a copied frame
+  transport.write(reinterpret_cast<const uint8_t*>("head"), 4U);
+  transport.write_reference(data, size, large);
+  transport.flush();
+  transport.write(reinterpret_cast<const uint8_t*>("xy"), 2U);
+  transport.flush();
+  std::string expected = frame("head" + *large) + frame("xy");
+  THRIFT_CHECK(transport.size() == expected.size());
+  THRIFT_CHECK(gathered(transport) == expected);
+
+  // the incomplete frame is not gathered, its reference neither
+  transport.write_reference(data, size, large);
+  THRIFT_CHECK(gathered(transport) == expected);
+  transport.flush();
+  expected += frame(*large);
+  THRIFT_CHECK(gathered(transport) == expected);
+
+  // short references are copied, empty frames dropped
+  transport.clear();
+  transport.write_reference(data, 10U, large);
+  transport.flush();
+  transport.flush();
+  THRIFT_CHECK(gathered(transport) == frame(large->substr(0, 10U)));
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_gather();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
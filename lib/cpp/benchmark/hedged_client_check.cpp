@@ -0,0 +1,212 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of hedged_client against local servers: backups win over a slow
+// server, the budget bounds backups when all replies are slow and failed
+// idempotent calls go to the next client.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/transport/tcp/hedged_client.hpp>
+#include <boost/thread/future.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+namespace ba = boost::asio;
+
+// Ports of the servers, nothing listens on dead_port.
+unsigned short slow_port = 0U, fast_port = 0U, dead_port = 0U;
+
+const boost::chrono::milliseconds slow_delay(100);
+
+//  delayed_echo_processor   -----------------------------------------------//
+// echo_processor replying after a delay.
+class delayed_echo_processor : public benchmark::echo_processor
+{
+public:
+  explicit delayed_echo_processor(boost::chrono::milliseconds d) : delay(d)
+  {}
+
+  virtual bool process
+  (
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+    void* connectionContext
+  ) OVERRIDE
+  {
+    boost::this_thread::sleep_for(delay);
+    return benchmark::echo_processor::process(in, out, connectionContext);
+  }
+
+private:
+  boost::chrono::milliseconds delay;
+};
+
+typedef benchmark::check_server<tcp::server> server_type;
+
+boost::shared_ptr<tcp::server> make_server(boost::chrono::milliseconds delay)
+{
+  return benchmark::make_server<tcp::server>(boost::make_shared<delayed_echo_processor>(delay));
+}
+
+void opened(boost::shared_ptr<boost::promise<void> > const& promise, boost::system::error_code const&)
+{
+  promise->set_value();
+}
+
+// Client whose open has completed, a client of dead_port has failed.
+tt::async_client_ptr open_client(unsigned short port)
+{
+  tt::async_client_ptr client = tt::async_client::create("127.0.0.1", port);
+  boost::shared_ptr<boost::promise<void> > promise = boost::make_shared<boost::promise<void> >();
+  client->async_open(boost::bind(&opened, promise, _1));
+  promise->get_future().wait();
+  return client;
+}
+
+// Unframed echo call.
+const std::string message = benchmark::make_request(16U).substr(4U);
+
+// Whether the reply echoes the payload of message.
+bool call(tt::hedged_client_ptr const& client, bool idempotent)
+{
+  const std::string reply = client->call(message, idempotent).get();
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  buffer->write(reinterpret_cast<const uint8_t*>(reply.data()), static_cast<uint32_t>(reply.size()));
+  protocol::TBinaryProtocol proto(buffer);
+  std::string name, payload;
+  protocol::TMessageType type;
+  int32_t seqid = 0;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(payload);
+  return type == protocol::T_REPLY && payload == std::string(16U, 'x');
+}
+
+void check_backup_wins()
+{
+  std::vector<tt::async_client_ptr> clients;
+  clients.push_back(open_client(slow_port));
+  clients.push_back(open_client(fast_port));
+
+  // max_delay is used, as min_samples are never known
+  tt::hedge_options options;
+  options.max_delay = boost::chrono::milliseconds(20);
+  options.min_samples = 1000U;
+  tt::hedged_client_ptr client = tt::hedged_client::create(clients, options);
+
+  // calls go to the clients in turn, those sent to the slow one are
+  // answered by their backups
+  for (int i = 0; i < 4; ++i)
+  {
+    const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    THRIFT_CHECK(call(client, true));
+    THRIFT_CHECK(boost::chrono::steady_clock::now() - start < slow_delay);
+  }
+  THRIFT_CHECK(client->calls() == 4U);
+  THRIFT_CHECK(client->hedged() == 2U);
+  THRIFT_CHECK(client->backup_wins() == 2U);
+
+  // no backups of calls which are not idempotent
+  THRIFT_CHECK(call(client, false));
+  THRIFT_CHECK(client->hedged() == 2U);
+}
+
+void check_budget()
+{
+  std::vector<tt::async_client_ptr> clients;
+  clients.push_back(open_client(fast_port));
+  clients.push_back(open_client(fast_port));
+
+  // every call is late
+  tt::hedge_options options;
+  options.min_delay = options.max_delay = boost::chrono::microseconds(1);
+  options.budget = 0.1;
+  options.burst = 5.0;
+  tt::hedged_client_ptr client = tt::hedged_client::create(clients, options);
+
+  const std::size_t calls = 20U;
+  for (std::size_t i = 0; i < calls; ++i)
+    THRIFT_CHECK(call(client, true));
+  // the burst is spent at once, then one backup per 10 calls
+  THRIFT_CHECK(client->hedged() > 0U);
+  THRIFT_CHECK(client->hedged() <= 5U + calls / 10U);
+}
+
+void check_failover()
+{
+  std::vector<tt::async_client_ptr> clients;
+  clients.push_back(open_client(dead_port));
+  clients.push_back(open_client(fast_port));
+  tt::hedged_client_ptr client = tt::hedged_client::create(clients);
+
+  // first call goes to the dead client and is retried on the other one
+  THRIFT_CHECK(call(client, true));
+  THRIFT_CHECK(call(client, true));
+
+  // failed call which is not idempotent is not sent again
+  bool failed = false;
+  try
+  {
+    call(client, false);
+  }
+  catch (transport::TTransportException const&)
+  {
+    failed = true;
+  }
+  THRIFT_CHECK(failed);
+}
+
+} // namespace
+
+int main()
+{
+  // io_service of the clients
+  tt::io_service_access_ptr access = tt::get_io_service();
+  ba::io_service& io_service = *access;
+  ba::io_service::work work(io_service);
+  boost::thread running(boost::bind(&ba::io_service::run, &io_service));
+
+  try
+  {
+    server_type slow(make_server(slow_delay)), fast(make_server(boost::chrono::milliseconds(0)));
+    slow_port = slow.port();
+    fast_port = fast.port();
+    dead_port = benchmark::unused_port();
+
+    check_backup_wins();
+    check_budget();
+    check_failover();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    ++apache::thrift::benchmark::check_failures();
+  }
+
+  io_service.stop();
+  running.join();
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,231 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of memory_budget accounting, on its own and as charged by the
+// connections of a server, and of frames above the maximum frame size.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+
+//  sized_reply_processor   -----------------------------------------------//
+// Replies with as many bytes as the decimal payload of the call asks for.
+class sized_reply_processor : public apache::thrift::TProcessor
+{
+public:
+  virtual bool process
+  (
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+    void* /*connectionContext*/
+  ) OVERRIDE
+  {
+    std::string name, payload;
+    apache::thrift::protocol::TMessageType type;
+    int32_t seqid = 0;
+
+    in->readMessageBegin(name, type, seqid);
+    in->readBinary(payload);
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+
+    out->writeMessageBegin(name, apache::thrift::protocol::T_REPLY, seqid);
+    out->writeBinary(std::string(boost::lexical_cast<std::size_t>(payload), 'x'));
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+};
+
+// Framed "echo" call asking for reply_size bytes, its payload is padded
+// with leading zeros to request_size bytes.
+std::string make_sized_request(std::size_t reply_size, std::size_t request_size = 0U)
+{
+  std::string payload = boost::lexical_cast<std::string>(reply_size);
+  if (payload.size() < request_size)
+    payload.insert(0U, request_size - payload.size(), '0');
+
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  boost::shared_ptr<transport::TFramedTransport> framed = boost::make_shared<transport::TFramedTransport>(buffer);
+  protocol::TBinaryProtocolT<transport::TFramedTransport> proto(framed);
+
+  proto.writeMessageBegin("echo", protocol::T_CALL, 0);
+  proto.writeBinary(payload);
+  proto.writeMessageEnd();
+  framed->writeEnd();
+  framed->flush();
+  return buffer->getBufferAsString();
+}
+
+// Frame length of a reply carrying payload bytes, frame header included.
+std::size_t reply_frame_size(std::size_t payload)
+{
+  return 4U + 4U + 4U + 4U + 4U + 4U + payload;
+}
+
+// Whether the server closes a new connection sending frame.
+bool closed_by_server(unsigned short port, std::string const& frame)
+{
+  boost::asio::io_service io_service;
+  boost::asio::ip::tcp::socket socket(io_service);
+  socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+  // the server may close before the whole frame is written
+  boost::system::error_code ec;
+  boost::asio::write(socket, boost::asio::buffer(frame), ec);
+  if (ec)
+    return ec == boost::asio::error::connection_reset || ec == boost::asio::error::broken_pipe;
+  char byte = 0;
+  boost::asio::read(socket, boost::asio::buffer(&byte, 1U), ec);
+  return ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset;
+}
+
+std::size_t read_reply(boost::asio::ip::tcp::socket& socket)
+{
+  uint32_t length = 0U;
+  boost::asio::read(socket, boost::asio::buffer(&length, sizeof(length)));
+  std::vector<char> body(ntohl(length));
+  boost::asio::read(socket, boost::asio::buffer(body));
+  return body.size();
+}
+
+// Waits up to a second for the budget to hold bytes.
+bool wait_used(tcp::memory_budget const& budget, std::size_t bytes)
+{
+  for (int i = 0; i < 100 && budget.used() != bytes; ++i)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  return budget.used() == bytes;
+}
+
+int woken = 0;
+
+void wake()
+{
+  ++woken;
+}
+
+void check_budget()
+{
+  boost::asio::io_service io_service;
+  tcp::memory_budget budget(100U);
+
+  // nothing above the limit is taken, even when nothing is held
+  THRIFT_CHECK(!budget.try_acquire(500U));
+  THRIFT_CHECK(budget.try_acquire(100U));
+  THRIFT_CHECK(!budget.try_acquire(1U));
+  THRIFT_CHECK(budget.exhausted());
+
+  budget.async_wait(10U, io_service, wake);
+  THRIFT_CHECK(budget.waiting() == 1U);
+  THRIFT_CHECK(woken == 0);
+
+  budget.release(100U);
+  io_service.run();
+  THRIFT_CHECK(woken == 1);
+  THRIFT_CHECK(budget.waiting() == 0U);
+  THRIFT_CHECK(budget.used() == 0U);
+
+  THRIFT_CHECK(budget.try_acquire(60U));
+  THRIFT_CHECK(!budget.try_acquire(60U));
+  // replies are charged beyond the limit
+  budget.acquire(60U);
+  THRIFT_CHECK(budget.used() == 120U);
+  budget.release(120U);
+
+  // no limit
+  tcp::memory_budget unlimited;
+  THRIFT_CHECK(unlimited.try_acquire(1000U) && unlimited.try_acquire(1000U));
+  THRIFT_CHECK(!unlimited.exhausted());
+}
+
+void check_server()
+{
+  boost::shared_ptr<tcp::server> server = benchmark::make_server<tcp::server>(boost::make_shared<sized_reply_processor>());
+  server->setMemoryBudget(64U * 1024U);
+  benchmark::check_server<tcp::server> serving(server);
+
+  tcp::memory_budget& budget = server->getMemoryBudget();
+  try
+  {
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket socket(io_service);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), serving.port()));
+
+    // small replies are not charged
+    boost::asio::write(socket, boost::asio::buffer(make_sized_request(100U)));
+    THRIFT_CHECK(read_reply(socket) + 4U == reply_frame_size(100U));
+    THRIFT_CHECK(budget.used() == 0U);
+
+    // reply larger than socket buffers is charged while it is written, only
+    // by bytes above the initial size of the output buffer
+    const std::size_t large = 32U * 1024U * 1024U;
+    boost::asio::write(socket, boost::asio::buffer(make_sized_request(large)));
+    THRIFT_CHECK(wait_used(budget, reply_frame_size(large) - transport::TMemoryBuffer::defaultSize));
+    THRIFT_CHECK(read_reply(socket) + 4U == reply_frame_size(large));
+    THRIFT_CHECK(wait_used(budget, 0U));
+
+    // large request, its input is released once it is served
+    boost::asio::write(socket, boost::asio::buffer(make_sized_request(100U, 48U * 1024U)));
+    THRIFT_CHECK(read_reply(socket) + 4U == reply_frame_size(100U));
+    THRIFT_CHECK(wait_used(budget, 0U));
+
+    // frames above the budget close their connection before anything is
+    // reserved for them
+    THRIFT_CHECK(server->getMaxFrameSize() == 64U * 1024U);
+    THRIFT_CHECK(closed_by_server(serving.port(), std::string("\xff\xff\xff\xf0", 4U)));
+    THRIFT_CHECK(closed_by_server(serving.port(), make_sized_request(100U, 64U * 1024U)));
+    THRIFT_CHECK(wait_used(budget, 0U));
+
+    // other connections are still served
+    boost::asio::write(socket, boost::asio::buffer(make_sized_request(100U)));
+    THRIFT_CHECK(read_reply(socket) + 4U == reply_frame_size(100U));
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    ++benchmark::check_failures();
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_budget();
+    check_server();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,194 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_BENCHMARK_MEMORY_STREAM_HPP_
+#define _THRIFT_BENCHMARK_MEMORY_STREAM_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/server/tcp/detail/helpers.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/ref.hpp>
+#include <boost/version.hpp>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace apache { namespace thrift { namespace benchmark {
+
+//  memory_stream   -----------------------------------------------//
+// AsyncReadStream/AsyncWriteStream stub which serves reads from a request
+// repeated over and over and swallows writes. After limit requests have
+// been read it reports end of file, so the connection reading from it
+// finishes and io_service::run() returns.
+class memory_stream
+{
+public:
+  explicit memory_stream(boost::asio::io_service& io) : io_service(io), position(0U),
+    read_bytes(0U), limit_bytes(0U), written_bytes(0U)
+  {}
+
+  void reset(std::string const& req, std::size_t limit)
+  {
+    request = req;
+    position = 0U;
+    read_bytes = 0U;
+    written_bytes = 0U;
+    limit_bytes = request.size() * limit;
+  }
+
+  std::size_t get_written_bytes() const
+  {
+    return written_bytes;
+  }
+
+  boost::asio::io_service& get_io_service()
+  {
+    return io_service;
+  }
+
+#if BOOST_VERSION >= 106600
+  typedef boost::asio::io_service::executor_type executor_type;
+
+  executor_type get_executor()
+  {
+    return io_service.get_executor();
+  }
+#endif
+
+  // Options refreshed by the connection loop are ignored.
+  template <class Option>
+  void set_option(Option const&, boost::system::error_code&)
+  {}
+
+  // Handlers are taken by reference as asio's initiating functions do,
+  // composed operations move themselves into the handler argument while the
+  // buffers argument still refers to them.
+  template <class MutableBufferSequence, class ReadHandler>
+  void async_read_some(MutableBufferSequence const& buffers, BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    std::size_t transferred = 0U;
+    for (typename MutableBufferSequence::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+    {
+      uint8_t* data = boost::asio::buffer_cast<uint8_t*>(*it);
+      std::size_t size = std::min(boost::asio::buffer_size(*it), limit_bytes - read_bytes);
+      while (size)
+      {
+        const std::size_t chunk = std::min(size, request.size() - position);
+        std::memcpy(data, request.data() + position, chunk);
+        position = (position + chunk) % request.size();
+        read_bytes += chunk;
+        transferred += chunk;
+        data += chunk;
+        size -= chunk;
+      }
+    }
+
+    const boost::system::error_code ec = transferred || read_bytes < limit_bytes ?
+      boost::system::error_code() : boost::asio::error::eof;
+    io_service.post(boost::asio::detail::bind_handler(handler, ec, transferred));
+  }
+
+  template <class ConstBufferSequence, class WriteHandler>
+  void async_write_some(ConstBufferSequence const& buffers, BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    std::size_t transferred = 0U;
+    for (typename ConstBufferSequence::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+      transferred += boost::asio::buffer_size(*it);
+    written_bytes += transferred;
+    io_service.post(boost::asio::detail::bind_handler(handler, boost::system::error_code(), transferred));
+  }
+
+private:
+  boost::asio::io_service& io_service;
+  std::string request;
+  std::size_t position;
+  std::size_t read_bytes, limit_bytes;
+  std::size_t written_bytes;
+};
+
+//  memory_stream_traits   -----------------------------------------------//
+// StreamTraits for basic_connection<memory_stream, memory_stream_traits>.
+template <class Stream>
+struct memory_stream_traits;
+
+template <>
+struct memory_stream_traits<memory_stream>
+{
+  typedef memory_stream value_type;
+  typedef value_type& reference_type;
+  typedef value_type& param_type;
+
+  static reference_type get_underlying_stream( param_type s )
+  {
+    return s;
+  }
+
+  template <class Host>
+  struct Impl {
+    typedef apache::thrift::server::tcp::detail::tcp_server_base server_type;
+    typedef boost::shared_ptr<Host> pointer_type;
+
+    // There are no socket options to set on memory_stream.
+    void start()
+    {
+      self().run();
+    }
+
+    memory_stream& stream()
+    {
+      return self().get_stream();
+    }
+
+    // Reads and writes of the connection loop.
+    template <class MutableBufferSequence, class CompletionCondition, class Handler>
+    void async_read_stream(MutableBufferSequence const& buffers, CompletionCondition condition, Handler handler)
+    {
+      boost::asio::async_read(self().get_stream(), buffers, condition, handler);
+    }
+
+    template <class ConstBufferSequence, class Handler>
+    void async_write_stream(ConstBufferSequence const& buffers, Handler handler)
+    {
+      boost::asio::async_write(self().get_stream(), buffers, handler);
+    }
+
+    static pointer_type create(boost::asio::io_service& io_service, server_type& server)
+    {
+      return boost::make_shared<Host>(boost::ref(io_service), boost::ref(server));
+    }
+  private:
+    Host& self() {
+      return static_cast<Host&>(*this);
+    }
+  };
+};
+
+} // namespace benchmark
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_BENCHMARK_MEMORY_STREAM_HPP_
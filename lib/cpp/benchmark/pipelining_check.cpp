@@ -0,0 +1,125 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Checks of pipelined frames: frames sent in one write are all served, in
+// order, also when the connection budget ends a turn after every frame or
+// every few bytes, and connections pipelining at once are both served.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace ba = boost::asio;
+
+typedef boost::shared_ptr<ba::ip::tcp::socket> socket_ptr;
+
+socket_ptr connect(ba::io_service& io_service, unsigned short port)
+{
+  socket_ptr socket(new ba::ip::tcp::socket(io_service));
+  socket->connect(ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), port));
+  return socket;
+}
+
+// Writes frames carrying payload_size bytes with sequence ids 0 to count - 1
+// at once.
+void pipeline(ba::ip::tcp::socket& socket, int count, std::size_t payload_size)
+{
+  std::string frames;
+  for (int i = 0; i < count; ++i)
+    frames += benchmark::make_request(payload_size, i);
+  ba::write(socket, ba::buffer(frames));
+}
+
+// Whether count replies echo payload_size bytes in the order of their
+// sequence ids.
+bool replies_in_order(ba::ip::tcp::socket& socket, int count, std::size_t payload_size)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    uint32_t length = 0U;
+    ba::read(socket, ba::buffer(&length, sizeof(length)));
+    std::string frame(ntohl(length), '\0');
+    ba::read(socket, ba::buffer(&frame[0], frame.size()));
+
+    boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+    buffer->write(reinterpret_cast<const uint8_t*>(frame.data()), static_cast<uint32_t>(frame.size()));
+    protocol::TBinaryProtocol proto(buffer);
+    std::string name, payload;
+    protocol::TMessageType type;
+    int32_t seqid = -1;
+    proto.readMessageBegin(name, type, seqid);
+    proto.readBinary(payload);
+    if (type != protocol::T_REPLY || seqid != i || payload != std::string(payload_size, 'x'))
+      return false;
+  }
+  return true;
+}
+
+void check_budget(std::size_t frames, std::size_t bytes)
+{
+  boost::shared_ptr<tcp::server> server = benchmark::make_server<tcp::server>(boost::make_shared<benchmark::echo_processor>());
+  server->setConnectionBudget(frames, bytes);
+  benchmark::check_server<tcp::server> serving(server);
+
+  ba::io_service io_service;
+  socket_ptr first = connect(io_service, serving.port()), second = connect(io_service, serving.port());
+
+  // small frames, many of them per read
+  pipeline(*first, 32, 10U);
+  THRIFT_CHECK(replies_in_order(*first, 32, 10U));
+
+  // frames larger than the byte budget
+  pipeline(*first, 8, 64U * 1024U);
+  THRIFT_CHECK(replies_in_order(*first, 8, 64U * 1024U));
+
+  // two connections at once
+  pipeline(*first, 16, 100U);
+  pipeline(*second, 16, 100U);
+  THRIFT_CHECK(replies_in_order(*second, 16, 100U));
+  THRIFT_CHECK(replies_in_order(*first, 16, 100U));
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    // default, a turn per frame, a turn per few bytes, no budget
+    check_budget(16U, 256U * 1024U);
+    check_budget(1U, 0U);
+    check_budget(0U, 1024U);
+    check_budget(0U, 0U);
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of method_priorities and the order in which priority_scheduler
+// runs queued requests.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/server/tcp/detail/priority_scheduler.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+
+std::string order;
+
+void run(char c)
+{
+  order += c;
+}
+
+void check_classes()
+{
+  tcp::method_priorities priorities(3U);
+  priorities.map("ping", 0U).map("get", 1U);
+  THRIFT_CHECK(priorities.classify("ping") == 0U);
+  THRIFT_CHECK(priorities.classify("get") == 1U);
+  // not mapped methods belong to the least urgent class unless told otherwise
+  THRIFT_CHECK(priorities.classify("put") == 2U);
+  priorities.default_class(1U);
+  THRIFT_CHECK(priorities.classify("put") == 1U);
+
+  bool thrown = false;
+  try
+  {
+    priorities.map("scan", 3U);
+  }
+  catch (std::out_of_range const&)
+  {
+    thrown = true;
+  }
+  THRIFT_CHECK(thrown);
+}
+
+void check_method_reader()
+{
+  tcp::detail::method_reader read_method(boost::make_shared<protocol::TBinaryProtocolFactory>());
+  std::string request = benchmark::make_request(16U);
+  THRIFT_CHECK(read_method(reinterpret_cast<uint8_t*>(&request[4]), static_cast<uint32_t>(request.size() - 4U)) == "echo");
+  // request is left untouched
+  THRIFT_CHECK(request == benchmark::make_request(16U));
+
+  std::string garbage(3U, '\xff');
+  THRIFT_CHECK(read_method(reinterpret_cast<uint8_t*>(&garbage[0]), static_cast<uint32_t>(garbage.size())).empty());
+}
+
+void check_strict()
+{
+  boost::asio::io_service io_service;
+  tcp::detail::priority_scheduler& scheduler = boost::asio::use_service<tcp::detail::priority_scheduler>(io_service);
+  tcp::method_priorities strict(3U);
+
+  order.clear();
+  for (int i = 0; i < 3; ++i)
+    scheduler.post(strict, 2U, boost::bind(run, 'c'));
+  scheduler.post(strict, 1U, boost::bind(run, 'b'));
+  scheduler.post(strict, 0U, boost::bind(run, 'a'));
+  io_service.run();
+  THRIFT_CHECK(order == "abccc");
+
+  // handlers still queued are released with the io_service
+  scheduler.post(strict, 2U, boost::bind(run, 'x'));
+}
+
+void check_weighted()
+{
+  boost::asio::io_service io_service;
+  tcp::detail::priority_scheduler& scheduler = boost::asio::use_service<tcp::detail::priority_scheduler>(io_service);
+  tcp::method_priorities weighted(2U, tcp::method_priorities::weighted);
+  weighted.weight(0U, 3U);
+
+  order.clear();
+  for (int i = 0; i < 8; ++i)
+    scheduler.post(weighted, 1U, boost::bind(run, 'l'));
+  for (int i = 0; i < 8; ++i)
+    scheduler.post(weighted, 0U, boost::bind(run, 'h'));
+  io_service.run();
+
+  // while both classes are queued they share executions 3:1, the less
+  // urgent one does not starve
+  THRIFT_CHECK(order.size() == 16U);
+  const std::string both = order.substr(0U, 8U);
+  THRIFT_CHECK(std::count(both.begin(), both.end(), 'h') == 6);
+  THRIFT_CHECK(std::count(both.begin(), both.end(), 'l') == 2);
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_classes();
+    check_method_reader();
+    check_strict();
+    check_weighted();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,180 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Checks of the read buffer of client transports: small reads are served
+// from what one receive brought, borrow() lends buffered bytes only,
+// consume() follows it, large reads bypass the buffer and resizing keeps
+// buffered bytes. Every way of reading yields the bytes sent, in order.
+
+#include "check.hpp"
+#include <thrift/transport/tcp/transport.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tt = apache::thrift::transport::tcp;
+namespace ba = boost::asio;
+
+typedef tt::transport<ba::ip::tcp::socket> transport_type;
+
+const std::size_t stream_size = 64U * 1024U;
+
+uint8_t pattern(std::size_t offset)
+{
+  return static_cast<uint8_t>(offset % 251U);
+}
+
+// Whether bytes continue the stream at offset.
+bool continues(const uint8_t* bytes, std::size_t size, std::size_t offset)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    if (bytes[i] != pattern(offset + i))
+      return false;
+  return true;
+}
+
+// Accepts connections, sends each the stream at once and closes it.
+void serve(ba::ip::tcp::acceptor& acceptor, int connections)
+{
+  std::vector<uint8_t> stream(stream_size);
+  for (std::size_t i = 0; i < stream.size(); ++i)
+    stream[i] = pattern(i);
+
+  for (int i = 0; i < connections; ++i)
+  {
+    ba::ip::tcp::socket socket(acceptor.get_io_service());
+    acceptor.accept(socket);
+    ba::write(socket, ba::buffer(stream));
+  }
+}
+
+// Opens a transport once the whole stream has arrived.
+void open(transport_type& transport)
+{
+  transport.open();
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+}
+
+void check_buffered(unsigned short port)
+{
+  transport_type transport("127.0.0.1", port);
+  open(transport);
+
+  // one receive fills the buffer, 4 KB by default
+  uint8_t header[4];
+  THRIFT_CHECK(transport.read(header, sizeof(header)) == sizeof(header));
+  THRIFT_CHECK(continues(header, sizeof(header), 0U));
+
+  uint32_t len = 100U;
+  const uint8_t* lent = transport.borrow(0, &len);
+  THRIFT_CHECK(lent && len == 4096U - sizeof(header));
+  THRIFT_CHECK(lent && continues(lent, len, sizeof(header)));
+  transport.consume(100U);
+  std::size_t offset = sizeof(header) + 100U;
+
+  // nothing beyond the buffered bytes is lent or consumed
+  len = 4096U;
+  THRIFT_CHECK(!transport.borrow(0, &len));
+  bool rejected = false;
+  try
+  {
+    transport.consume(4096U);
+  }
+  catch (transport::TTransportException const& e)
+  {
+    rejected = e.getType() == transport::TTransportException::BAD_ARGS;
+  }
+  THRIFT_CHECK(rejected);
+
+  // shrinking keeps buffered bytes
+  transport.setReadBufferSize(16U);
+  len = 1U;
+  lent = transport.borrow(0, &len);
+  THRIFT_CHECK(lent && len == 4096U - offset);
+  THRIFT_CHECK(lent && continues(lent, len, offset));
+
+  // the rest of the buffer, then a read larger than the buffer goes to the
+  // caller's memory directly
+  std::vector<uint8_t> rest(len);
+  THRIFT_CHECK(transport.readAll(&rest[0], len) == len);
+  offset += len;
+  std::vector<uint8_t> large(1024U);
+  THRIFT_CHECK(transport.readAll(&large[0], static_cast<uint32_t>(large.size())) == large.size());
+  THRIFT_CHECK(continues(&large[0], large.size(), offset));
+  offset += large.size();
+  len = 1U;
+  THRIFT_CHECK(!transport.borrow(0, &len));
+
+  // small reads of the remaining stream, then its end
+  transport.setReadBufferSize(4096U);
+  uint8_t byte = 0U;
+  bool ordered = true;
+  while (transport.read(&byte, 1U) == 1U)
+    ordered = ordered && byte == pattern(offset++);
+  THRIFT_CHECK(ordered);
+  THRIFT_CHECK(offset == stream_size);
+  transport.close();
+}
+
+void check_unbuffered(unsigned short port)
+{
+  transport_type transport("127.0.0.1", port);
+  transport.setReadBufferSize(0U);
+  open(transport);
+
+  uint8_t header[4];
+  THRIFT_CHECK(transport.readAll(header, sizeof(header)) == sizeof(header));
+  THRIFT_CHECK(continues(header, sizeof(header), 0U));
+  uint32_t len = 1U;
+  THRIFT_CHECK(!transport.borrow(0, &len));
+
+  std::vector<uint8_t> rest(stream_size - sizeof(header));
+  THRIFT_CHECK(transport.readAll(&rest[0], static_cast<uint32_t>(rest.size())) == rest.size());
+  THRIFT_CHECK(continues(&rest[0], rest.size(), sizeof(header)));
+  transport.close();
+}
+
+} // namespace
+
+int main()
+{
+  ba::io_service io_service;
+  ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0U));
+  boost::thread serving(boost::bind(&serve, boost::ref(acceptor), 2));
+
+  try
+  {
+    check_buffered(acceptor.local_endpoint().port());
+    check_unbuffered(acceptor.local_endpoint().port());
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    // the server may wait for a connection which is not coming
+    serving.detach();
+    return 1;
+  }
+  serving.join();
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of resolver_cache: stale entries are still returned while they are
+// refreshed, refreshes do not start a thread per hit and the cache can be
+// destroyed with refreshes pending.
+
+#include "check.hpp"
+#include <thrift/transport/tcp/resolver_cache.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+namespace {
+
+namespace tt = apache::thrift::transport::tcp;
+
+// Number of threads of the process, 0 where it is not known.
+std::size_t thread_count()
+{
+  std::size_t count = 0U;
+#ifdef __linux__
+  if (DIR* tasks = opendir("/proc/self/task"))
+  {
+    while (dirent* task = readdir(tasks))
+      if (task->d_name[0] != '.')
+        ++count;
+    closedir(tasks);
+  }
+#endif
+  return count;
+}
+
+void check_cache()
+{
+  {
+    tt::resolver_cache cache(boost::chrono::seconds(60), boost::chrono::seconds(60));
+    THRIFT_CHECK(!cache.resolve("127.0.0.1", "9090").empty());
+    THRIFT_CHECK(cache.resolve("127.0.0.1", "9090").front().port() == 9090U);
+    THRIFT_CHECK(cache.size() == 1U);
+
+    cache.resolve("127.0.0.1", "9091");
+    THRIFT_CHECK(cache.size() == 2U);
+    cache.invalidate("127.0.0.1", "9090");
+    THRIFT_CHECK(cache.size() == 1U);
+    cache.clear();
+    THRIFT_CHECK(cache.size() == 0U);
+  }
+
+  // every hit is stale, all of them are answered from the cache and share
+  // the single refresh thread
+  const std::size_t threads = thread_count();
+  {
+    tt::resolver_cache cache(boost::chrono::seconds(0), boost::chrono::seconds(60));
+    cache.resolve("localhost", "9090");
+    for (int i = 0; i < 1000; ++i)
+    {
+      THRIFT_CHECK(!cache.resolve("localhost", "9090").empty());
+      THRIFT_CHECK(!cache.resolve("127.0.0.1", "9091").empty());
+    }
+    THRIFT_CHECK(cache.size() == 2U);
+    THRIFT_CHECK(thread_count() <= threads + 1U);
+    // destroyed with refreshes still queued
+  }
+  THRIFT_CHECK(thread_count() == threads);
+
+  {
+    boost::shared_ptr<tt::resolver_cache> cache = boost::make_shared<tt::resolver_cache>(boost::chrono::seconds(0), boost::chrono::seconds(60));
+    cache->resolve("localhost", "9090");
+    cache->resolve("localhost", "9090");
+    // let the refresh run before the entry is used again
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    THRIFT_CHECK(!cache->resolve("localhost", "9090").empty());
+    THRIFT_CHECK(cache->size() == 1U);
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_cache();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,247 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of async_client matching replies to calls by sequence id, from
+// parsing the sequence id of a message to threads sharing one connection.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/transport/tcp/multiplexed_transport.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+namespace ba = boost::asio;
+
+// Message with binary payload.
+std::string make_message(std::string const& payload, int32_t seqid, protocol::TMessageType type = protocol::T_CALL)
+{
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  protocol::TBinaryProtocol proto(buffer);
+  proto.writeMessageBegin("echo", type, seqid);
+  proto.writeBinary(payload);
+  proto.writeMessageEnd();
+  return buffer->getBufferAsString();
+}
+
+void read_message(std::string const& message, std::string& payload, int32_t& seqid)
+{
+  boost::shared_ptr<transport::TMemoryBuffer> buffer = boost::make_shared<transport::TMemoryBuffer>();
+  buffer->write(reinterpret_cast<const uint8_t*>(message.data()), static_cast<uint32_t>(message.size()));
+  protocol::TBinaryProtocol proto(buffer);
+  std::string name;
+  protocol::TMessageType type;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(payload);
+}
+
+void check_seqid_offset()
+{
+  uint8_t type = 0U;
+
+  // version, name length, name
+  std::string message = make_message("x", 7);
+  THRIFT_CHECK(tt::detail::binary_seqid_offset(message.data(), message.size(), type) == 12U);
+  THRIFT_CHECK(type == protocol::T_CALL);
+
+  // old header without version: name length, name, type
+  message = std::string("\0\0\0\4echo\4\0\0\0\7", 13U);
+  THRIFT_CHECK(tt::detail::binary_seqid_offset(message.data(), message.size(), type) == 9U);
+  THRIFT_CHECK(type == protocol::T_ONEWAY);
+
+  // truncated before or within the sequence id
+  message = make_message("", 7);
+  THRIFT_CHECK(tt::detail::binary_seqid_offset(message.data(), 15U, type) == 0U);
+  THRIFT_CHECK(tt::detail::binary_seqid_offset(message.data(), 3U, type) == 0U);
+
+  // unknown version
+  message[1] = '\x02';
+  THRIFT_CHECK(tt::detail::binary_seqid_offset(message.data(), message.size(), type) == 0U);
+
+  // name longer than the message
+  message = make_message("", 7);
+  message[4] = '\x7f';
+  THRIFT_CHECK(tt::detail::binary_seqid_offset(message.data(), message.size(), type) == 0U);
+
+  THRIFT_CHECK(tt::detail::binary_seqid_offset("garbage", 7U, type) == 0U);
+}
+
+// Accepts one connection, echoes three frames in reverse order, then
+// swallows a oneway frame and echoes one more.
+void reversing_server(ba::ip::tcp::acceptor& acceptor)
+{
+  ba::ip::tcp::socket socket(acceptor.get_io_service());
+  acceptor.accept(socket);
+
+  std::vector<std::string> frames;
+  for (int i = 0; i < 5; ++i)
+  {
+    uint32_t length = 0U;
+    ba::read(socket, ba::buffer(&length, sizeof(length)));
+    std::string frame(ntohl(length), '\0');
+    ba::read(socket, ba::buffer(&frame[0], frame.size()));
+    frames.push_back(std::string(reinterpret_cast<char*>(&length), sizeof(length)) + frame);
+
+    if (i == 2)
+    {
+      for (int k = 2; k >= 0; --k)
+        ba::write(socket, ba::buffer(frames[k]));
+    }
+    else if (i == 4)
+      ba::write(socket, ba::buffer(frames[i]));
+  }
+
+  boost::system::error_code ec;
+  uint8_t end = 0U;
+  ba::read(socket, ba::buffer(&end, 1U), ec);
+}
+
+void check_reply(tt::async_client::reply_future& reply, std::string const& expected_payload, int32_t expected_seqid)
+{
+  std::string payload;
+  int32_t seqid = 0;
+  read_message(reply.get(), payload, seqid);
+  THRIFT_CHECK(payload == expected_payload);
+  THRIFT_CHECK(seqid == expected_seqid);
+}
+
+void check_out_of_order()
+{
+  ba::io_service io_service;
+  ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0U));
+  boost::thread serving(boost::bind(reversing_server, boost::ref(acceptor)));
+
+  tt::async_client_ptr client = tt::async_client::create("127.0.0.1", acceptor.local_endpoint().port());
+  client->set_reply_matching(tt::async_client::by_seqid);
+  tt::multiplexed_transport(client).open();
+
+  // callers may use the same sequence id
+  tt::async_client::reply_future first = client->call(make_message("first", 7));
+  tt::async_client::reply_future second = client->call(make_message("second", 7));
+  tt::async_client::reply_future third = client->call(make_message("third", 9));
+  check_reply(third, "third", 9);
+  check_reply(second, "second", 7);
+  check_reply(first, "first", 7);
+
+  // oneway call completes once written
+  tt::async_client::reply_future oneway = client->call(make_message("one", 1, protocol::T_ONEWAY));
+  THRIFT_CHECK(oneway.get().empty());
+  tt::async_client::reply_future after = client->call(make_message("after", 3));
+  check_reply(after, "after", 3);
+
+  // not a TBinaryProtocol message
+  bool rejected = false;
+  try
+  {
+    client->call("garbage").get();
+  }
+  catch (transport::TTransportException const&)
+  {
+    rejected = true;
+  }
+  THRIFT_CHECK(rejected);
+  THRIFT_CHECK(client->outstanding() == 0U);
+
+  client->close();
+  serving.join();
+}
+
+boost::atomic<int> matched(0), mismatched(0);
+
+void call_shared(tt::async_client_ptr client, int id)
+{
+  boost::shared_ptr<tt::multiplexed_transport> transport = boost::make_shared<tt::multiplexed_transport>(client);
+  protocol::TBinaryProtocol proto(transport);
+  for (int i = 0; i < 200; ++i)
+  {
+    const std::string payload = boost::lexical_cast<std::string>(id * 1000 + i);
+    proto.writeMessageBegin("echo", protocol::T_CALL, i);
+    proto.writeBinary(payload);
+    proto.writeMessageEnd();
+    transport->writeEnd();
+    transport->flush();
+
+    std::string name, reply;
+    protocol::TMessageType type;
+    int32_t seqid = 0;
+    proto.readMessageBegin(name, type, seqid);
+    proto.readBinary(reply);
+    proto.readMessageEnd();
+    transport->readEnd();
+    if (reply == payload && seqid == i)
+      ++matched;
+    else
+      ++mismatched;
+  }
+}
+
+void check_shared_connection()
+{
+  benchmark::check_server<tcp::server> server(benchmark::make_server<tcp::server>(boost::make_shared<benchmark::echo_processor>()));
+
+  tt::async_client_ptr client = tt::async_client::create("127.0.0.1", server.port());
+  client->set_reply_matching(tt::async_client::by_seqid);
+  tt::multiplexed_transport(client).open();
+
+  boost::thread_group callers;
+  for (int i = 0; i < 8; ++i)
+    callers.create_thread(boost::bind(call_shared, client, i));
+  callers.join_all();
+  THRIFT_CHECK(matched == 8 * 200);
+  THRIFT_CHECK(mismatched == 0);
+  THRIFT_CHECK(client->outstanding() == 0U);
+
+  client->close();
+}
+
+} // namespace
+
+int main()
+{
+  // io_service of the clients
+  tt::io_service_access_ptr access = tt::get_io_service();
+  ba::io_service& io_service = *access;
+  ba::io_service::work work(io_service);
+  boost::thread running(boost::bind(&ba::io_service::run, &io_service));
+
+  try
+  {
+    check_seqid_offset();
+    check_out_of_order();
+    check_shared_connection();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    ++apache::thrift::benchmark::check_failures();
+  }
+
+  io_service.stop();
+  running.join();
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,293 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Loopback benchmark of every server configuration from tcp/server.hpp and
+// tcp/tls/server.hpp. Results are written to stdout as one JSON object per
+// line, progress and errors go to stderr.
+//
+// Options (lists are comma separated, the cartesian product is run):
+//   --servers=name,...       tcp.server, tcp.server_io_service_per_core,
+//                            tcp.server_io_service_in_thread_pool,
+//                            tcp.server_io_service_in_thread_pool_serialized
+//                            and their tls.* counterparts (default: all)
+//   --connections=n,...      concurrent client connections (default: 1,16,64)
+//   --payload=bytes,...      request and reply payload size (default: 64,4096)
+//   --depth=n,...            pipelined requests per connection (default: 1,8)
+//   --requests=n             measured requests per connection (default: 10000)
+//   --warmup=n               ignored requests per connection (default: 1000)
+//   --server-threads=n       threads of concurrent servers (default: cores)
+//   --client-threads=n       client io_service threads (default: cores)
+//   --address=host           (default: 127.0.0.1)
+//   --port=n                 first port, incremented per server (default: 19090)
+//   --cert=file --key=file   TLS certificate, generated when not given
+//   --socket-options=name    server socket option profile: defaults,
+//                            low_latency or throughput (default: defaults)
+//   --frame-budget=n         frames a connection serves per turn, 0 means
+//                            no limit (default: 16)
+//   --byte-budget=bytes      bytes a connection serves per turn, 0 means
+//                            no limit (default: 262144)
+//   --memory-budget=bytes    bytes held by large frames and replies of all
+//                            connections, 0 means no limit (default: 0)
+//   --record-size=bytes,...  TLS records starting a reply, 0 leaves sizes to
+//                            OpenSSL (default: 0)
+//   --small-records=bytes    bytes of a reply sent in small records after an
+//                            idle period (default: 16384)
+
+#include "benchmark.hpp"
+#include "client.hpp"
+#include "tls_certificate.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/server/tcp/tls/server.hpp>
+#include <thrift/server/tcp/tls/record_size.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace apache::thrift;
+using namespace apache::thrift::benchmark;
+
+namespace {
+
+typedef boost::asio::ip::tcp::socket tcp_stream;
+typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> tls_stream;
+
+struct settings
+{
+  std::string address;
+  unsigned short port;
+  std::size_t server_threads;
+  std::string cert, key;
+  std::string socket_profile;
+  server::tcp::socket_options socket_options;
+  std::size_t frame_budget, byte_budget;
+  std::size_t memory_budget;
+  std::size_t record_size, small_records;
+  std::vector<scenario> scenarios;
+};
+
+boost::shared_ptr<tcp_stream> make_tcp_stream(boost::asio::io_service& io_service)
+{
+  return boost::shared_ptr<tcp_stream>(new tcp_stream(io_service));
+}
+
+boost::shared_ptr<tls_stream> make_tls_stream(boost::shared_ptr<boost::asio::ssl::context> ctx,
+  boost::asio::io_service& io_service)
+{
+  return boost::shared_ptr<tls_stream>(new tls_stream(io_service, *ctx));
+}
+
+template <class Server>
+boost::shared_ptr<Server> create_server(settings const& s)
+{
+  boost::shared_ptr<Server> server = boost::make_shared<Server>(boost::make_shared<echo_processor>(),
+    boost::make_shared<transport::TFramedTransportFactory>(), boost::make_shared<protocol::TBinaryProtocolFactory>(),
+    s.address, boost::lexical_cast<std::string>(s.port), s.socket_options);
+  server->setConnectionBudget(s.frame_budget, s.byte_budget);
+  server->setMemoryBudget(s.memory_budget);
+  return server;
+}
+
+template <class Server>
+boost::shared_ptr<Server> create_concurrent_server(settings const& s)
+{
+  boost::shared_ptr<Server> server = boost::make_shared<Server>(boost::make_shared<echo_processor>(),
+    boost::make_shared<transport::TFramedTransportFactory>(), boost::make_shared<protocol::TBinaryProtocolFactory>(),
+    s.address, boost::lexical_cast<std::string>(s.port), s.server_threads, s.socket_options);
+  server->setConnectionBudget(s.frame_budget, s.byte_budget);
+  server->setMemoryBudget(s.memory_budget);
+  return server;
+}
+
+template <class Stream>
+void run_scenarios(std::string const& name, bool tls, settings const& s,
+  typename load_generator<Stream>::stream_factory const& factory)
+{
+  boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(s.address), s.port);
+  load_generator<Stream> generator(endpoint, factory);
+
+  for (std::size_t i = 0; i < s.scenarios.size(); ++i)
+  {
+    scenario const& sc = s.scenarios[i];
+    std::cerr << name << ": connections=" << sc.connections << " payload=" << sc.payload
+              << " depth=" << sc.depth << std::endl;
+    try
+    {
+      result r = generator.run(sc);
+      report()
+        ("server", name)
+        ("tls", tls)
+        ("connections", sc.connections)
+        ("payload", sc.payload)
+        ("depth", sc.depth)
+        ("server_threads", s.server_threads)
+        ("socket_options", s.socket_profile)
+        ("frame_budget", s.frame_budget)
+        ("byte_budget", s.byte_budget)
+        ("memory_budget", s.memory_budget)
+        ("record_size", tls ? s.record_size : 0U)
+        ("client_threads", sc.threads)
+        ("requests", r.requests)
+        ("errors", r.errors)
+        ("seconds", r.seconds)
+        ("throughput_rps", r.seconds > 0.0 ? r.replies / r.seconds : 0.0)
+        ("throughput_mbps", r.seconds > 0.0 ? r.bytes / r.seconds / (1024.0 * 1024.0) : 0.0)
+        ("p50_us", r.latency.percentile(0.50) / 1000.0)
+        ("p99_us", r.latency.percentile(0.99) / 1000.0)
+        ("p999_us", r.latency.percentile(0.999) / 1000.0)
+        .print();
+    }
+    catch (std::exception const& e)
+    {
+      std::cerr << name << ": " << e.what() << std::endl;
+    }
+  }
+}
+
+template <class Server>
+void serve_and_run(std::string const& name, boost::shared_ptr<Server> server, settings& s)
+{
+  boost::thread serving(boost::bind(&Server::serve, server.get()));
+  run_scenarios<tcp_stream>(name, false, s, &make_tcp_stream);
+  server->stop();
+  serving.join();
+  ++s.port;
+}
+
+template <class Server>
+void serve_tls_and_run(std::string const& name, boost::shared_ptr<Server> server, settings& s)
+{
+  server->certificate(s.cert);
+  server->private_key(s.key);
+  server->record_size(server::tcp::tls::record_size_policy(s.record_size, s.small_records));
+
+  boost::shared_ptr<boost::asio::ssl::context> ctx =
+    boost::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::sslv23);
+  ctx->set_verify_mode(boost::asio::ssl::verify_none);
+
+  boost::thread serving(boost::bind(&Server::serve, server.get()));
+  run_scenarios<tls_stream>(name, true, s, boost::bind(&make_tls_stream, ctx, _1));
+  server->stop();
+  serving.join();
+  ++s.port;
+}
+
+bool selected(std::vector<std::string> const& servers, std::string const& name)
+{
+  return std::find(servers.begin(), servers.end(), name) != servers.end();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  options opts(argc, argv);
+
+  const std::size_t cores = std::max(boost::thread::hardware_concurrency(), 1U);
+  settings s;
+  s.address = opts.get<std::string>("address", "127.0.0.1");
+  s.port = opts.get<unsigned short>("port", 19090);
+  s.server_threads = opts.get<std::size_t>("server-threads", cores);
+  s.cert = opts.get<std::string>("cert", "");
+  s.key = opts.get<std::string>("key", "");
+  s.frame_budget = opts.get<std::size_t>("frame-budget", 16);
+  s.byte_budget = opts.get<std::size_t>("byte-budget", 256 * 1024);
+  s.memory_budget = opts.get<std::size_t>("memory-budget", 0);
+  s.record_size = 0;
+  s.small_records = opts.get<std::size_t>("small-records", 16 * 1024);
+  const std::vector<std::size_t> record_sizes = opts.get_list<std::size_t>("record-size", "0");
+  s.socket_profile = opts.get<std::string>("socket-options", "defaults");
+  if (s.socket_profile == "low_latency")
+    s.socket_options = server::tcp::socket_options::low_latency();
+  else if (s.socket_profile == "throughput")
+    s.socket_options = server::tcp::socket_options::throughput();
+  else if (s.socket_profile == "defaults")
+    s.socket_options = server::tcp::socket_options::defaults();
+  else
+  {
+    std::cerr << "Unknown socket option profile: " << s.socket_profile << std::endl;
+    return 1;
+  }
+
+  const std::vector<std::size_t> connections = opts.get_list<std::size_t>("connections", "1,16,64");
+  const std::vector<std::size_t> payloads = opts.get_list<std::size_t>("payload", "64,4096");
+  const std::vector<std::size_t> depths = opts.get_list<std::size_t>("depth", "1,8");
+  for (std::size_t c = 0; c < connections.size(); ++c)
+    for (std::size_t p = 0; p < payloads.size(); ++p)
+      for (std::size_t d = 0; d < depths.size(); ++d)
+      {
+        scenario sc;
+        sc.connections = connections[c];
+        sc.payload = payloads[p];
+        sc.depth = depths[d];
+        sc.requests = opts.get<std::size_t>("requests", 10000);
+        sc.warmup = opts.get<std::size_t>("warmup", 1000);
+        sc.threads = opts.get<std::size_t>("client-threads", cores);
+        s.scenarios.push_back(sc);
+      }
+
+  const std::vector<std::string> servers = opts.get_list<std::string>("servers",
+    "tcp.server,tcp.server_io_service_per_core,tcp.server_io_service_in_thread_pool,"
+    "tcp.server_io_service_in_thread_pool_serialized,"
+    "tls.server,tls.server_io_service_per_core,tls.server_io_service_in_thread_pool,"
+    "tls.server_io_service_in_thread_pool_serialized");
+
+  try
+  {
+    namespace tcp = apache::thrift::server::tcp;
+
+    if (selected(servers, "tcp.server"))
+      serve_and_run("tcp.server", create_server<tcp::server>(s), s);
+    if (selected(servers, "tcp.server_io_service_per_core"))
+      serve_and_run("tcp.server_io_service_per_core", create_concurrent_server<tcp::server_io_service_per_core>(s), s);
+    if (selected(servers, "tcp.server_io_service_in_thread_pool"))
+      serve_and_run("tcp.server_io_service_in_thread_pool", create_concurrent_server<tcp::server_io_service_in_thread_pool>(s), s);
+    if (selected(servers, "tcp.server_io_service_in_thread_pool_serialized"))
+      serve_and_run("tcp.server_io_service_in_thread_pool_serialized", create_concurrent_server<tcp::server_io_service_in_thread_pool_serialized>(s), s);
+
+    const bool any_tls = selected(servers, "tls.server") || selected(servers, "tls.server_io_service_per_core")
+      || selected(servers, "tls.server_io_service_in_thread_pool")
+      || selected(servers, "tls.server_io_service_in_thread_pool_serialized");
+    if (any_tls && (s.cert.empty() || s.key.empty()))
+    {
+      s.cert = "thrift_benchmark_cert.pem";
+      s.key = "thrift_benchmark_key.pem";
+      generate_self_signed_certificate(s.cert, s.key);
+    }
+
+    for (std::size_t r = 0; r < record_sizes.size(); ++r)
+    {
+      s.record_size = record_sizes[r];
+      if (selected(servers, "tls.server"))
+        serve_tls_and_run("tls.server", create_server<tcp::tls::server>(s), s);
+      if (selected(servers, "tls.server_io_service_per_core"))
+        serve_tls_and_run("tls.server_io_service_per_core", create_concurrent_server<tcp::tls::server_io_service_per_core>(s), s);
+      if (selected(servers, "tls.server_io_service_in_thread_pool"))
+        serve_tls_and_run("tls.server_io_service_in_thread_pool", create_concurrent_server<tcp::tls::server_io_service_in_thread_pool>(s), s);
+      if (selected(servers, "tls.server_io_service_in_thread_pool_serialized"))
+        serve_tls_and_run("tls.server_io_service_in_thread_pool_serialized", create_concurrent_server<tcp::tls::server_io_service_in_thread_pool_serialized>(s), s);
+    }
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Checks of transports with static_binding: TBinaryProtocolT instantiated on
+// the plain and TLS transport types, created by the typed getTCPTransport()
+// and getTLSTransport(), completes a round trip with the server.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include "tls_certificate.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/server/tcp/tls/server.hpp>
+#include <thrift/transport/TTCPTransport.h>
+#include <thrift/transport/TTLSTransport.h>
+#include <thrift/transport/tcp/tls/transport.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+
+const char* const cert_file = "static_binding_check_cert.pem";
+const char* const key_file = "static_binding_check_key.pem";
+
+typedef tt::transport<boost::asio::ip::tcp::socket, tt::detail::static_binding> plain_transport;
+typedef tt::transport<tt::tls::socket, tt::detail::static_binding> tls_transport;
+
+// Length of an echo message of "echo" carrying payload bytes.
+uint32_t message_size(std::size_t payload)
+{
+  return static_cast<uint32_t>(4U + 4U + 4U + 4U + 4U + payload);
+}
+
+// Echo call whose frame size is written by hand, the message by a protocol
+// calling the transport without virtual calls.
+template <class Transport>
+bool round_trip(boost::shared_ptr<Transport> const& transport, std::size_t payload_size)
+{
+  protocol::TBinaryProtocolT<Transport> proto(transport);
+  const std::string payload(payload_size, 'x');
+
+  const uint32_t length = htonl(message_size(payload_size));
+  transport->write(reinterpret_cast<const uint8_t*>(&length), sizeof(length));
+  proto.writeMessageBegin("echo", protocol::T_CALL, 7);
+  proto.writeBinary(payload);
+  proto.writeMessageEnd();
+  transport->flush();
+
+  uint32_t reply_length = 0U;
+  transport->readAll(reinterpret_cast<uint8_t*>(&reply_length), sizeof(reply_length));
+  std::string name, echoed;
+  protocol::TMessageType type;
+  int32_t seqid = 0;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(echoed);
+  proto.readMessageEnd();
+  return ntohl(reply_length) == message_size(payload_size) && type == protocol::T_REPLY && seqid == 7
+    && echoed == payload;
+}
+
+void check_plain()
+{
+  benchmark::check_server<tcp::server> serving(benchmark::make_server<tcp::server>(
+    boost::make_shared<benchmark::echo_processor>()));
+
+  boost::shared_ptr<plain_transport> client = transport::getTCPTransport<plain_transport>("127.0.0.1", serving.port());
+  client->open();
+  // served from the read buffer and read directly
+  THRIFT_CHECK(round_trip(client, 100U));
+  THRIFT_CHECK(round_trip(client, 64U * 1024U));
+  client->close();
+}
+
+void check_tls()
+{
+  benchmark::generate_self_signed_certificate(cert_file, key_file);
+  boost::shared_ptr<tcp::tls::server> server = benchmark::make_server<tcp::tls::server>(
+    boost::make_shared<benchmark::echo_processor>());
+  server->certificate(cert_file);
+  server->private_key(key_file);
+  benchmark::check_server<tcp::tls::server> serving(server);
+
+  tt::tls::context_ptr ctx = boost::make_shared<tt::tls::context>();
+  ctx->certificate_authority(cert_file);
+  boost::shared_ptr<tls_transport> client = transport::getTLSTransport<tls_transport>("127.0.0.1", serving.port(), ctx);
+  client->open();
+  THRIFT_CHECK(round_trip(client, 100U));
+  THRIFT_CHECK(round_trip(client, 64U * 1024U));
+  client->close();
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_plain();
+    check_tls();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
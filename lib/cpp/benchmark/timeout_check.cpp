@@ -0,0 +1,251 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Checks of client transport timeouts kept by the kernel: a late reply, a
+// peer which does not read and a connection which is not accepted throw
+// TIMED_OUT once their timeout expires, also over TLS, and calls within the
+// timeouts complete.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include "tls_certificate.hpp"
+#include <thrift/server/tcp/server.hpp>
+#include <thrift/server/tcp/tls/server.hpp>
+#include <thrift/transport/tcp/transport.hpp>
+#include <thrift/transport/tcp/tls/transport.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+namespace ba = boost::asio;
+
+const char* const cert_file = "timeout_check_cert.pem";
+const char* const key_file = "timeout_check_key.pem";
+
+typedef tt::transport<ba::ip::tcp::socket> plain_transport;
+typedef tt::transport<tt::tls::socket> tls_transport;
+
+const int timeout_ms = 100;
+// Delay of replies of the slow server.
+const boost::chrono::milliseconds late(500);
+
+//  delayed_echo_processor   -----------------------------------------------//
+// echo_processor replying after a delay.
+class delayed_echo_processor : public benchmark::echo_processor
+{
+public:
+  virtual bool process
+  (
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+    void* connectionContext
+  ) OVERRIDE
+  {
+    boost::this_thread::sleep_for(late);
+    return benchmark::echo_processor::process(in, out, connectionContext);
+  }
+};
+
+template <class Transport>
+void send_request(Transport& transport, std::size_t payload_size)
+{
+  const std::string request = benchmark::make_request(payload_size);
+  transport.write(reinterpret_cast<const uint8_t*>(request.data()), static_cast<uint32_t>(request.size()));
+}
+
+// Reads a reply frame, returns its length.
+template <class Transport>
+uint32_t read_reply(Transport& transport)
+{
+  uint32_t length = 0U;
+  transport.readAll(reinterpret_cast<uint8_t*>(&length), sizeof(length));
+  std::vector<uint8_t> body(ntohl(length));
+  if (!body.empty())
+    transport.readAll(&body[0], static_cast<uint32_t>(body.size()));
+  return static_cast<uint32_t>(body.size());
+}
+
+template <class Transport>
+void wait_reply(Transport* transport)
+{
+  read_reply(*transport);
+}
+
+template <class Transport>
+void open_transport(Transport* transport)
+{
+  transport->open();
+}
+
+// Writes until the peer, which does not read, has its buffers full.
+template <class Transport>
+void flood(Transport* transport)
+{
+  const std::vector<uint8_t> chunk(1024U * 1024U, 'x');
+  for (int i = 0; i < 256; ++i)
+    transport->write(&chunk[0], static_cast<uint32_t>(chunk.size()));
+}
+
+// Whether f throws TIMED_OUT after about timeout_ms, well before the slow
+// server would reply.
+template <class Function>
+bool times_out(Function f)
+{
+  const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+  try
+  {
+    f();
+  }
+  catch (transport::TTransportException const& e)
+  {
+    const boost::chrono::steady_clock::duration elapsed = boost::chrono::steady_clock::now() - start;
+    return e.getType() == transport::TTransportException::TIMED_OUT
+      && elapsed >= boost::chrono::milliseconds(timeout_ms / 2) && elapsed < late;
+  }
+  return false;
+}
+
+void check_receive(unsigned short slow_port)
+{
+  // set before open
+  {
+    plain_transport transport("127.0.0.1", slow_port);
+    transport.setRecvTimeout(timeout_ms);
+    transport.open();
+    send_request(transport, 100U);
+    THRIFT_CHECK(times_out(boost::bind(&wait_reply<plain_transport>, &transport)));
+    transport.close();
+  }
+
+  // set on an open transport
+  {
+    plain_transport transport("127.0.0.1", slow_port);
+    transport.open();
+    transport.setRecvTimeout(timeout_ms);
+    send_request(transport, 100U);
+    THRIFT_CHECK(times_out(boost::bind(&wait_reply<plain_transport>, &transport)));
+    transport.close();
+  }
+}
+
+void check_within_timeouts(unsigned short fast_port)
+{
+  plain_transport transport("127.0.0.1", fast_port);
+  transport.setRecvTimeout(1000);
+  transport.setSendTimeout(1000);
+  transport.open();
+  // larger than socket buffers, sent and received in parts
+  const std::size_t payload = 8U * 1024U * 1024U;
+  send_request(transport, payload);
+  THRIFT_CHECK(read_reply(transport) == 4U + 4U + 4U + 4U + 4U + payload);
+  transport.close();
+}
+
+void check_send()
+{
+  // connections complete in the backlog, nothing reads them
+  ba::io_service io_service;
+  ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0U));
+
+  plain_transport transport("127.0.0.1", acceptor.local_endpoint().port());
+  transport.setSendTimeout(timeout_ms);
+  transport.open();
+  THRIFT_CHECK(times_out(boost::bind(&flood<plain_transport>, &transport)));
+  transport.close();
+}
+
+void ignore_connect(boost::system::error_code const&)
+{}
+
+void check_connect()
+{
+  // The backlog is full, further SYNs are dropped and connect waits.
+  ba::io_service io_service;
+  ba::ip::tcp::acceptor acceptor(io_service);
+  const ba::ip::tcp::endpoint loopback(ba::ip::address_v4::loopback(), 0U);
+  acceptor.open(loopback.protocol());
+  acceptor.bind(loopback);
+  acceptor.listen(0);
+  const ba::ip::tcp::endpoint endpoint = acceptor.local_endpoint();
+
+  std::vector<boost::shared_ptr<ba::ip::tcp::socket> > queued;
+  for (int i = 0; i < 4; ++i)
+  {
+    queued.push_back(boost::shared_ptr<ba::ip::tcp::socket>(new ba::ip::tcp::socket(io_service)));
+    queued.back()->async_connect(endpoint, &ignore_connect);
+  }
+  io_service.poll();
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+
+  plain_transport transport("127.0.0.1", endpoint.port());
+  transport.setConnTimeout(timeout_ms);
+  THRIFT_CHECK(times_out(boost::bind(&open_transport<plain_transport>, &transport)));
+  THRIFT_CHECK(!transport.isOpen());
+}
+
+// OpenSSL reads the socket itself, the kernel timeout applies to it too.
+void check_tls_receive()
+{
+  benchmark::generate_self_signed_certificate(cert_file, key_file);
+  boost::shared_ptr<tcp::tls::server> server = benchmark::make_server<tcp::tls::server>(
+    boost::make_shared<delayed_echo_processor>());
+  server->certificate(cert_file);
+  server->private_key(key_file);
+  benchmark::check_server<tcp::tls::server> serving(server);
+
+  tt::tls::context_ptr ctx = boost::make_shared<tt::tls::context>();
+  ctx->certificate_authority(cert_file);
+  tls_transport transport("127.0.0.1", serving.port(), ctx);
+  transport.setRecvTimeout(timeout_ms);
+  transport.open();
+  send_request(transport, 100U);
+  THRIFT_CHECK(times_out(boost::bind(&wait_reply<tls_transport>, &transport)));
+  transport.close();
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    benchmark::check_server<tcp::server> slow(benchmark::make_server<tcp::server>(boost::make_shared<delayed_echo_processor>()));
+    benchmark::check_server<tcp::server> fast(benchmark::make_server<tcp::server>(boost::make_shared<benchmark::echo_processor>()));
+
+    check_receive(slow.port());
+    check_within_timeouts(fast.port());
+    check_send();
+    check_connect();
+    check_tls_receive();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,429 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Loopback benchmark of the TLS path of tcp/tls/server.hpp: rate and latency
+// of full handshakes, of handshakes resuming a session and steady-state
+// encrypted throughput and latency. Results are written to stdout as one JSON
+// object per line, progress and errors go to stderr.
+//
+// Every connection of the handshake phases does its handshake followed by a
+// single small request, so TLS 1.3 handshakes complete on the server and
+// session tickets reach the client. Handshake latency is measured up to the
+// client's Finished message, "connect" latency up to the first reply.
+//
+// Options (lists are comma separated, the cartesian product is run):
+//   --servers=name,...       tls.server, tls.server_io_service_per_core,
+//                            tls.server_io_service_in_thread_pool (default: all)
+//   --phases=name,...        full, resumed, throughput (default: all)
+//   --ciphers=list,...       OpenSSL cipher lists of TLS 1.2, colon separated
+//                            within an item (default: OpenSSL's)
+//   --groups=name,...        key exchange group, e.g. X25519 or P-256
+//                            (default: OpenSSL's)
+//   --protocol=v,...         highest protocol version of clients: 1.2, 1.3
+//                            (default: 1.3)
+//   --handshakes=n           connections per handshake phase (default: 2000)
+//   --clients=n              client threads of handshake phases (default: cores)
+//   --connections=n,...      connections of throughput phase (default: 1,16)
+//   --payload=bytes,...      request and reply payload size (default: 64,16384)
+//   --depth=n,...            pipelined requests per connection (default: 1,8)
+//   --requests=n             measured requests per connection (default: 10000)
+//   --warmup=n               ignored requests per connection (default: 1000)
+//   --server-threads=n       threads of concurrent servers (default: cores)
+//   --handshake-threads=n    handshake pool of servers, 0 runs handshakes on
+//                            io_service threads (default: 0)
+//   --address=host           (default: 127.0.0.1)
+//   --port=n                 first port, incremented per server (default: 19190)
+//   --cert=file --key=file   TLS certificate, generated when not given
+//   --rsa-bits=n             key size of the generated certificate (default: 2048)
+
+#include "benchmark.hpp"
+#include "client.hpp"
+#include "tls_certificate.hpp"
+#include <thrift/server/tcp/tls/server.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace apache::thrift;
+using namespace apache::thrift::benchmark;
+
+namespace {
+
+typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> tls_stream;
+
+struct settings
+{
+  std::string address;
+  unsigned short port;
+  std::size_t server_threads;
+  std::size_t handshake_threads;
+  std::size_t handshakes;
+  std::size_t clients;
+  std::string cert, key;
+  std::vector<std::string> phases;
+  std::vector<scenario> scenarios;
+};
+
+// TLS settings of a single run.
+struct tls_settings
+{
+  std::string ciphers;
+  std::string group;
+  std::string protocol;
+};
+
+bool selected(std::vector<std::string> const& names, std::string const& name)
+{
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+boost::shared_ptr<boost::asio::ssl::context> make_client_context(tls_settings const& t)
+{
+  boost::shared_ptr<boost::asio::ssl::context> ctx =
+    boost::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::sslv23);
+  ctx->set_verify_mode(boost::asio::ssl::verify_none);
+  SSL_CTX_set_max_proto_version(ctx->native_handle(), t.protocol == "1.2" ? TLS1_2_VERSION : TLS1_3_VERSION);
+  // sessions are resumed only when the resumed phase sets one
+  SSL_CTX_set_session_cache_mode(ctx->native_handle(), SSL_SESS_CACHE_OFF);
+  return ctx;
+}
+
+boost::shared_ptr<tls_stream> make_tls_stream(boost::shared_ptr<boost::asio::ssl::context> ctx,
+  boost::asio::io_service& io_service)
+{
+  return boost::shared_ptr<tls_stream>(new tls_stream(io_service, *ctx));
+}
+
+//  handshake_client   -----------------------------------------------//
+// Opens connections one after another, each doing a handshake and a single
+// request, optionally resuming session.
+class handshake_client : private boost::noncopyable
+{
+public:
+  handshake_client(boost::asio::ip::tcp::endpoint const& ep, boost::asio::ssl::context& c,
+    std::string const& r, std::size_t n, SSL_SESSION* s)
+    : endpoint(ep), ctx(c), request(r), count(n), session(s), errors(0U), resumed(0U)
+  {
+    handshake_latency.reserve(n);
+    connect_latency.reserve(n);
+  }
+
+  void run()
+  {
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      try
+      {
+        connect_once();
+      }
+      catch (std::exception const& e)
+      {
+        if (!errors++)
+          std::cerr << e.what() << std::endl;
+      }
+    }
+  }
+
+  // Connects once and returns the session to resume, the caller frees it.
+  SSL_SESSION* connect_once()
+  {
+    boost::asio::io_service io_service;
+    tls_stream stream(io_service, ctx);
+
+    const clock_type::time_point start = clock_type::now();
+    stream.lowest_layer().connect(endpoint);
+    stream.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true));
+    if (session)
+      SSL_set_session(stream.native_handle(), session);
+    stream.handshake(boost::asio::ssl::stream_base::client);
+    const clock_type::time_point handshaken = clock_type::now();
+
+    boost::asio::write(stream, boost::asio::buffer(request));
+    uint8_t header[sizeof(uint32_t)];
+    boost::asio::read(stream, boost::asio::buffer(header, sizeof(header)));
+    uint32_t frame_size = 0U;
+    std::memcpy(&frame_size, header, sizeof(header));
+    body.resize(ntohl(frame_size));
+    boost::asio::read(stream, boost::asio::buffer(body));
+    const clock_type::time_point replied = clock_type::now();
+
+    handshake_latency.add(boost::chrono::duration_cast<boost::chrono::nanoseconds>(handshaken - start).count());
+    connect_latency.add(boost::chrono::duration_cast<boost::chrono::nanoseconds>(replied - start).count());
+    if (SSL_session_reused(stream.native_handle()))
+      ++resumed;
+
+    // OpenSSL does not resume sessions of connections freed without TLS
+    // shutdown, mark it done as there is no need to wait for the peer.
+    SSL_set_shutdown(stream.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_SESSION* next = SSL_get1_session(stream.native_handle());
+    stream.lowest_layer().close();
+    return next;
+  }
+
+  latency_stats handshake_latency;
+  latency_stats connect_latency;
+
+  boost::uint64_t get_errors() const { return errors; }
+  boost::uint64_t get_resumed() const { return resumed; }
+
+private:
+  boost::asio::ip::tcp::endpoint endpoint;
+  boost::asio::ssl::context& ctx;
+  std::string request;
+  std::size_t count;
+  SSL_SESSION* session;
+  std::vector<uint8_t> body;
+  boost::uint64_t errors;
+  boost::uint64_t resumed;
+};
+
+template <class Server>
+boost::shared_ptr<Server> create_server(settings const& s)
+{
+  return boost::make_shared<Server>(boost::make_shared<echo_processor>(),
+    boost::make_shared<transport::TFramedTransportFactory>(), boost::make_shared<protocol::TBinaryProtocolFactory>(),
+    s.address, boost::lexical_cast<std::string>(s.port));
+}
+
+template <class Server>
+boost::shared_ptr<Server> create_concurrent_server(settings const& s)
+{
+  return boost::make_shared<Server>(boost::make_shared<echo_processor>(),
+    boost::make_shared<transport::TFramedTransportFactory>(), boost::make_shared<protocol::TBinaryProtocolFactory>(),
+    s.address, boost::lexical_cast<std::string>(s.port), s.server_threads);
+}
+
+void common_fields(report& r, std::string const& name, std::string const& phase, settings const& s, tls_settings const& t)
+{
+  r ("server", name)
+    ("phase", phase)
+    ("protocol", t.protocol)
+    ("ciphers", t.ciphers.empty() ? std::string("default") : t.ciphers)
+    ("group", t.group.empty() ? std::string("default") : t.group)
+    ("server_threads", s.server_threads)
+    ("handshake_threads", s.handshake_threads);
+}
+
+void run_handshakes(std::string const& name, std::string const& phase, settings const& s, tls_settings const& t)
+{
+  boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(s.address), s.port);
+  boost::shared_ptr<boost::asio::ssl::context> ctx = make_client_context(t);
+  const std::string request = make_request(64);
+
+  // session issued to a first connection is resumed by all of them
+  SSL_SESSION* session = 0;
+  if (phase == "resumed")
+  {
+    handshake_client first(endpoint, *ctx, request, 1U, 0);
+    session = first.connect_once();
+  }
+
+  const std::size_t clients = std::max<std::size_t>(s.clients, 1U);
+  std::vector<boost::shared_ptr<handshake_client> > workers;
+  for (std::size_t i = 0; i < clients; ++i)
+    workers.push_back(boost::make_shared<handshake_client>(endpoint, boost::ref(*ctx), request,
+      s.handshakes / clients + (i < s.handshakes % clients ? 1U : 0U), session));
+
+  const clock_type::time_point start = clock_type::now();
+  boost::thread_group threads;
+  for (std::size_t i = 0; i < workers.size(); ++i)
+    threads.create_thread(boost::bind(&handshake_client::run, workers[i].get()));
+  threads.join_all();
+  const double seconds = boost::chrono::duration<double>(clock_type::now() - start).count();
+
+  latency_stats handshake_latency, connect_latency;
+  boost::uint64_t errors = 0U, resumed = 0U;
+  for (std::size_t i = 0; i < workers.size(); ++i)
+  {
+    handshake_latency.merge(workers[i]->handshake_latency);
+    connect_latency.merge(workers[i]->connect_latency);
+    errors += workers[i]->get_errors();
+    resumed += workers[i]->get_resumed();
+  }
+  if (session)
+    SSL_SESSION_free(session);
+
+  report r;
+  common_fields(r, name, phase, s, t);
+  r ("clients", clients)
+    ("handshakes", handshake_latency.count())
+    ("resumed", resumed)
+    ("errors", errors)
+    ("seconds", seconds)
+    ("handshakes_per_s", seconds > 0.0 ? handshake_latency.count() / seconds : 0.0)
+    ("handshake_p50_us", handshake_latency.percentile(0.50) / 1000.0)
+    ("handshake_p99_us", handshake_latency.percentile(0.99) / 1000.0)
+    ("connect_p50_us", connect_latency.percentile(0.50) / 1000.0)
+    ("connect_p99_us", connect_latency.percentile(0.99) / 1000.0)
+    .print();
+}
+
+void run_throughput(std::string const& name, settings const& s, tls_settings const& t)
+{
+  boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(s.address), s.port);
+  load_generator<tls_stream> generator(endpoint, boost::bind(&make_tls_stream, make_client_context(t), _1));
+
+  for (std::size_t i = 0; i < s.scenarios.size(); ++i)
+  {
+    scenario const& sc = s.scenarios[i];
+    std::cerr << name << ": connections=" << sc.connections << " payload=" << sc.payload
+              << " depth=" << sc.depth << std::endl;
+    result res = generator.run(sc);
+
+    report r;
+    common_fields(r, name, "throughput", s, t);
+    r ("connections", sc.connections)
+      ("payload", sc.payload)
+      ("depth", sc.depth)
+      ("client_threads", sc.threads)
+      ("requests", res.requests)
+      ("errors", res.errors)
+      ("seconds", res.seconds)
+      ("throughput_rps", res.seconds > 0.0 ? res.replies / res.seconds : 0.0)
+      ("throughput_mbps", res.seconds > 0.0 ? res.bytes / res.seconds / (1024.0 * 1024.0) : 0.0)
+      ("p50_us", res.latency.percentile(0.50) / 1000.0)
+      ("p99_us", res.latency.percentile(0.99) / 1000.0)
+      ("p999_us", res.latency.percentile(0.999) / 1000.0)
+      .print();
+  }
+}
+
+template <class Server>
+void serve_and_run(std::string const& name, boost::shared_ptr<Server> server, settings& s, tls_settings const& t)
+{
+  server->certificate(s.cert);
+  server->private_key(s.key);
+  if (!t.ciphers.empty())
+    server->ciphers(t.ciphers);
+  if (!t.group.empty() && 1 != SSL_CTX_set1_groups_list(server->get_shared_handle()->native_handle(), t.group.c_str()))
+    throw std::runtime_error("Unknown group: " + t.group);
+  server->setHandshakeThreads(s.handshake_threads);
+
+  boost::thread serving(boost::bind(&Server::serve, server.get()));
+  try
+  {
+    for (std::size_t i = 0; i < s.phases.size(); ++i)
+    {
+      std::cerr << name << ": " << s.phases[i] << " protocol=" << t.protocol << std::endl;
+      if (s.phases[i] == "throughput")
+        run_throughput(name, s, t);
+      else
+        run_handshakes(name, s.phases[i], s, t);
+    }
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << name << ": " << e.what() << std::endl;
+  }
+  server->stop();
+  serving.join();
+  ++s.port;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  options opts(argc, argv);
+
+  const std::size_t cores = std::max(boost::thread::hardware_concurrency(), 1U);
+  settings s;
+  s.address = opts.get<std::string>("address", "127.0.0.1");
+  s.port = opts.get<unsigned short>("port", 19190);
+  s.server_threads = opts.get<std::size_t>("server-threads", cores);
+  s.handshake_threads = opts.get<std::size_t>("handshake-threads", 0);
+  s.handshakes = opts.get<std::size_t>("handshakes", 2000);
+  s.clients = opts.get<std::size_t>("clients", cores);
+  s.cert = opts.get<std::string>("cert", "");
+  s.key = opts.get<std::string>("key", "");
+  s.phases = opts.get_list<std::string>("phases", "full,resumed,throughput");
+  for (std::size_t i = 0; i < s.phases.size(); ++i)
+  {
+    if (s.phases[i] != "full" && s.phases[i] != "resumed" && s.phases[i] != "throughput")
+    {
+      std::cerr << "Unknown phase: " << s.phases[i] << std::endl;
+      return 1;
+    }
+  }
+
+  const std::vector<std::size_t> connections = opts.get_list<std::size_t>("connections", "1,16");
+  const std::vector<std::size_t> payloads = opts.get_list<std::size_t>("payload", "64,16384");
+  const std::vector<std::size_t> depths = opts.get_list<std::size_t>("depth", "1,8");
+  for (std::size_t c = 0; c < connections.size(); ++c)
+    for (std::size_t p = 0; p < payloads.size(); ++p)
+      for (std::size_t d = 0; d < depths.size(); ++d)
+      {
+        scenario sc;
+        sc.connections = connections[c];
+        sc.payload = payloads[p];
+        sc.depth = depths[d];
+        sc.requests = opts.get<std::size_t>("requests", 10000);
+        sc.warmup = opts.get<std::size_t>("warmup", 1000);
+        sc.threads = opts.get<std::size_t>("client-threads", cores);
+        s.scenarios.push_back(sc);
+      }
+
+  // empty item keeps OpenSSL's default
+  std::vector<std::string> ciphers = opts.get_list<std::string>("ciphers", "");
+  if (ciphers.empty())
+    ciphers.push_back(std::string());
+  std::vector<std::string> groups = opts.get_list<std::string>("groups", "");
+  if (groups.empty())
+    groups.push_back(std::string());
+  const std::vector<std::string> protocols = opts.get_list<std::string>("protocol", "1.3");
+
+  const std::vector<std::string> servers = opts.get_list<std::string>("servers",
+    "tls.server,tls.server_io_service_per_core,tls.server_io_service_in_thread_pool");
+
+  try
+  {
+    namespace tcp = apache::thrift::server::tcp;
+
+    if (s.cert.empty() || s.key.empty())
+    {
+      s.cert = "thrift_benchmark_cert.pem";
+      s.key = "thrift_benchmark_key.pem";
+      generate_self_signed_certificate(s.cert, s.key, opts.get<int>("rsa-bits", 2048));
+    }
+
+    for (std::size_t c = 0; c < ciphers.size(); ++c)
+      for (std::size_t g = 0; g < groups.size(); ++g)
+        for (std::size_t p = 0; p < protocols.size(); ++p)
+        {
+          tls_settings t;
+          t.ciphers = ciphers[c];
+          t.group = groups[g];
+          t.protocol = protocols[p];
+
+          if (selected(servers, "tls.server"))
+            serve_and_run("tls.server", create_server<tcp::tls::server>(s), s, t);
+          if (selected(servers, "tls.server_io_service_per_core"))
+            serve_and_run("tls.server_io_service_per_core", create_concurrent_server<tcp::tls::server_io_service_per_core>(s), s, t);
+          if (selected(servers, "tls.server_io_service_in_thread_pool"))
+            serve_and_run("tls.server_io_service_in_thread_pool", create_concurrent_server<tcp::tls::server_io_service_in_thread_pool>(s), s, t);
+        }
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_BENCHMARK_TLS_CERTIFICATE_HPP_
+#define _THRIFT_BENCHMARK_TLS_CERTIFICATE_HPP_
+
+#include <thrift/config.hpp>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/rsa.h>
+#include <boost/shared_ptr.hpp>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace apache { namespace thrift { namespace benchmark {
+
+// Generates a self-signed certificate for CN=localhost together with its
+// private key and stores both as PEM files. Benchmarks use it so they do not
+// depend on certificates shipped with the sources.
+inline void generate_self_signed_certificate(std::string const& cert_file, std::string const& key_file, int rsa_bits = 2048)
+{
+  boost::shared_ptr<EVP_PKEY_CTX> kctx(EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr), EVP_PKEY_CTX_free);
+  EVP_PKEY* raw_key = nullptr;
+  if ( !kctx || EVP_PKEY_keygen_init(kctx.get()) <= 0 ||
+       EVP_PKEY_CTX_set_rsa_keygen_bits(kctx.get(), rsa_bits) <= 0 ||
+       EVP_PKEY_keygen(kctx.get(), &raw_key) <= 0 )
+    throw std::runtime_error("Cannot generate RSA key.");
+  boost::shared_ptr<EVP_PKEY> key(raw_key, EVP_PKEY_free);
+
+  boost::shared_ptr<X509> cert(X509_new(), X509_free);
+  X509_set_version(cert.get(), 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+  X509_gmtime_adj(X509_get_notBefore(cert.get()), 0);
+  X509_gmtime_adj(X509_get_notAfter(cert.get()), 24L * 60L * 60L);
+  X509_set_pubkey(cert.get(), key.get());
+
+  X509_NAME* name = X509_get_subject_name(cert.get());
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(cert.get(), name);
+  if ( !X509_sign(cert.get(), key.get(), EVP_sha256()) )
+    throw std::runtime_error("Cannot sign certificate.");
+
+  FILE* cf = std::fopen(cert_file.c_str(), "wb");
+  const bool cert_written = cf && PEM_write_X509(cf, cert.get());
+  if ( cf )
+    std::fclose(cf);
+
+  FILE* kf = std::fopen(key_file.c_str(), "wb");
+  const bool key_written = kf && PEM_write_PrivateKey(kf, key.get(), nullptr, nullptr, 0, nullptr, nullptr);
+  if ( kf )
+    std::fclose(kf);
+
+  if ( !cert_written || !key_written )
+    throw std::runtime_error("Cannot write certificate files.");
+}
+
+} // namespace benchmark
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_BENCHMARK_TLS_CERTIFICATE_HPP_
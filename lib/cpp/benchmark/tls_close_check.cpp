@@ -0,0 +1,259 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of TLS client transport shutdown: close() sends close_notify, a
+// close_notify of the server reads as end of stream, a reset connection
+// throws on read and can still be closed, writing to a server which has
+// gone throws instead of raising SIGPIPE and a failed handshake leaves the
+// transport closed.
+
+#include "check.hpp"
+#include "tls_certificate.hpp"
+#include <thrift/transport/tcp/tls/transport.hpp>
+#include <boost/atomic.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <csignal>
+#include <unistd.h>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tt = apache::thrift::transport::tcp;
+
+const char* const cert_file = "tls_close_check_cert.pem";
+const char* const key_file = "tls_close_check_key.pem";
+
+enum server_close
+{
+  await_close_notify,
+  send_close_notify,
+  reset,
+  // closes without TLS shutdown and reading
+  leave,
+  // closes before the handshake
+  refuse_tls
+};
+
+boost::atomic<bool> close_notify_received(false);
+
+// Plain OpenSSL server accepting one connection per scenario.
+void serve(int listener, std::vector<server_close> scenarios)
+{
+  // writes to a client which went away must not kill the check
+  sigset_t pipe;
+  sigemptyset(&pipe);
+  sigaddset(&pipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe, 0);
+
+  boost::shared_ptr<SSL_CTX> ctx(SSL_CTX_new(TLS_server_method()), SSL_CTX_free);
+  SSL_CTX_use_certificate_file(ctx.get(), cert_file, SSL_FILETYPE_PEM);
+  SSL_CTX_use_PrivateKey_file(ctx.get(), key_file, SSL_FILETYPE_PEM);
+  for (std::size_t i = 0; i < scenarios.size(); ++i)
+  {
+    const int fd = accept(listener, 0, 0);
+    if (fd < 0)
+      return;
+    if (scenarios[i] == refuse_tls)
+    {
+      close(fd);
+      continue;
+    }
+    boost::shared_ptr<SSL> ssl(SSL_new(ctx.get()), SSL_free);
+    SSL_set_fd(ssl.get(), fd);
+    if (SSL_accept(ssl.get()) == 1)
+    {
+      switch (scenarios[i])
+      {
+      case await_close_notify:
+        {
+          char buffer[16];
+          const int read = SSL_read(ssl.get(), buffer, sizeof(buffer));
+          close_notify_received = SSL_get_error(ssl.get(), read) == SSL_ERROR_ZERO_RETURN;
+        }
+        break;
+      case send_close_notify:
+        SSL_shutdown(ssl.get());
+        break;
+      case reset:
+        {
+          // let the client block in read first
+          boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+          linger abort = {1, 0};
+          setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    else
+      ERR_clear_error();
+    ssl.reset();
+    close(fd);
+  }
+}
+
+void check_close()
+{
+  benchmark::generate_self_signed_certificate(cert_file, key_file);
+
+  // port chosen by the system
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = sockaddr_in();
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_size = sizeof(address);
+  if ( bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 4) != 0 ||
+       getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_size) != 0 )
+  {
+    close(listener);
+    throw std::runtime_error("Cannot listen on loopback.");
+  }
+  const unsigned short port = ntohs(address.sin_port);
+
+  std::vector<server_close> scenarios;
+  scenarios.push_back(await_close_notify);
+  scenarios.push_back(send_close_notify);
+  scenarios.push_back(reset);
+  scenarios.push_back(leave);
+  scenarios.push_back(refuse_tls);
+  boost::thread serving(boost::bind(&serve, listener, scenarios));
+
+  boost::shared_ptr<server::tcp::tls::context> ctx = boost::make_shared<server::tcp::tls::context>();
+  ctx->certificate_authority(cert_file);
+  typedef tt::transport<tt::tls::socket> transport_type;
+  try
+  {
+    // close_notify is sent, closing twice is harmless
+    {
+      transport_type t("127.0.0.1", port, ctx);
+      t.open();
+      t.close();
+      t.close();
+    }
+
+    // close_notify of the server is the end of stream
+    {
+      transport_type t("127.0.0.1", port, ctx);
+      t.open();
+      uint8_t buffer[4];
+      bool eof = false;
+      try
+      {
+        eof = t.read(buffer, sizeof(buffer)) == 0U;
+      }
+      catch (transport::TTransportException const&)
+      {}
+      THRIFT_CHECK(eof);
+      t.close();
+    }
+
+    // reset is an error, the transport is closed without writing to it
+    {
+      transport_type t("127.0.0.1", port, ctx);
+      t.open();
+      uint8_t buffer[4];
+      bool thrown = false;
+      try
+      {
+        t.read(buffer, sizeof(buffer));
+      }
+      catch (transport::TTransportException const&)
+      {
+        thrown = true;
+      }
+      THRIFT_CHECK(thrown);
+      t.close();
+    }
+
+    // writes reach a closed socket of the server, which resets the
+    // connection, the next write fails with EPIPE and must not kill us
+    {
+      transport_type t("127.0.0.1", port, ctx);
+      t.open();
+      const std::string data(1024U, 'x');
+      bool thrown = false;
+      for (int i = 0; i < 300 && !thrown; ++i)
+      {
+        try
+        {
+          t.write(reinterpret_cast<const uint8_t*>(data.data()), static_cast<uint32_t>(data.size()));
+        }
+        catch (transport::TTransportException const&)
+        {
+          thrown = true;
+        }
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+      }
+      THRIFT_CHECK(thrown);
+      t.close();
+    }
+
+    // connection without TLS is not open
+    {
+      transport_type t("127.0.0.1", port, ctx);
+      bool thrown = false;
+      try
+      {
+        t.open();
+      }
+      catch (transport::TTransportException const&)
+      {
+        thrown = true;
+      }
+      THRIFT_CHECK(thrown);
+      THRIFT_CHECK(!t.isOpen());
+      t.close();
+    }
+  }
+  catch (...)
+  {
+    shutdown(listener, SHUT_RDWR);
+    serving.join();
+    close(listener);
+    throw;
+  }
+  serving.join();
+  close(listener);
+  THRIFT_CHECK(close_notify_received);
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_close();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
@@ -0,0 +1,301 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks of the TLS server with OpenSSL doing socket I/O (kernel_tls()):
+// a client leaving while its reply is written does not kill the server,
+// clients resume their sessions across ticket key rotations, and the first
+// connection accepted after reload() gets the new certificate. A server
+// running handshakes on a handshake pool serves its clients and counts
+// completed and failed handshakes. Dynamic record sizes start replies after
+// an idle period with records fitting a TCP segment.
+
+#include "benchmark.hpp"
+#include "check.hpp"
+#include "tls_certificate.hpp"
+#include <thrift/server/tcp/tls/server.hpp>
+#include <thrift/transport/tcp/tls/transport.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/thread/thread.hpp>
+#include <openssl/ssl.h>
+
+namespace {
+
+using namespace apache::thrift;
+namespace tcp = apache::thrift::server::tcp;
+namespace tt = apache::thrift::transport::tcp;
+
+const char* const cert_file = "tls_server_check_cert.pem";
+const char* const key_file = "tls_server_check_key.pem";
+const char* const reloaded_cert_file = "tls_server_check_reloaded_cert.pem";
+const char* const reloaded_key_file = "tls_server_check_reloaded_key.pem";
+
+typedef tt::transport<tt::tls::socket> transport_type;
+typedef boost::shared_ptr<transport_type> transport_ptr;
+
+transport_ptr open_transport(unsigned short port, tt::tls::context_ptr const& ctx)
+{
+  transport_ptr transport = boost::make_shared<transport_type>("127.0.0.1", port, ctx);
+  transport->open();
+  return transport;
+}
+
+void send_request(transport_type& transport, std::size_t payload_size)
+{
+  const std::string request = benchmark::make_request(payload_size);
+  transport.write(reinterpret_cast<const uint8_t*>(request.data()), static_cast<uint32_t>(request.size()));
+}
+
+// Whether the echoed payload of a request comes back.
+bool round_trip(transport_ptr const& transport, std::size_t payload_size)
+{
+  send_request(*transport, payload_size);
+  uint32_t length = 0U;
+  transport->readAll(reinterpret_cast<uint8_t*>(&length), sizeof(length));
+
+  protocol::TBinaryProtocol proto(transport);
+  std::string name, payload;
+  protocol::TMessageType type;
+  int32_t seqid = 0;
+  proto.readMessageBegin(name, type, seqid);
+  proto.readBinary(payload);
+  proto.readMessageEnd();
+  return type == protocol::T_REPLY && payload == std::string(payload_size, 'x');
+}
+
+tt::tls::context_ptr client_context(const char* authority = cert_file)
+{
+  tt::tls::context_ptr ctx = boost::make_shared<tt::tls::context>();
+  ctx->certificate_authority(authority);
+  return ctx;
+}
+
+// Whether a client trusting authority only completes a round trip.
+bool trusted_round_trip(unsigned short port, const char* authority)
+{
+  try
+  {
+    return round_trip(open_transport(port, client_context(authority)), 100U);
+  }
+  catch (transport::TTransportException const&)
+  {
+    return false;
+  }
+}
+
+void check_client_leaving(unsigned short port)
+{
+  tt::tls::context_ptr ctx = client_context();
+
+  // clients close while large replies are written to them, the server gets
+  // EPIPE instead of SIGPIPE
+  for (int i = 0; i < 3; ++i)
+  {
+    transport_ptr leaving = open_transport(port, ctx);
+    send_request(*leaving, 4U * 1024U * 1024U);
+    uint8_t header[4];
+    leaving->readAll(header, sizeof(header));
+    leaving->close();
+    leaving.reset();
+  }
+
+  THRIFT_CHECK(round_trip(open_transport(port, ctx), 100U));
+}
+
+// Whether a round trip over a new connection resumed a session.
+bool resumed(unsigned short port, tt::tls::context_ptr const& ctx)
+{
+  transport_ptr transport = open_transport(port, ctx);
+  // TLS 1.3 tickets arrive after the handshake, with the reply
+  THRIFT_CHECK(round_trip(transport, 100U));
+  const bool reused = transport->session_reused();
+  transport->close();
+  return reused;
+}
+
+void check_resumption(tcp::tls::server& server, unsigned short port)
+{
+  // tickets issued with OpenSSL's own key are not carried over a rotation
+  server.rotate_session_ticket_key();
+
+  tt::tls::context_ptr ctx = client_context();
+  THRIFT_CHECK(!resumed(port, ctx));
+  THRIFT_CHECK(resumed(port, ctx));
+
+  // a reopened transport resumes its previous session
+  {
+    transport_ptr transport = open_transport(port, ctx);
+    THRIFT_CHECK(round_trip(transport, 100U));
+    transport->close();
+    transport->open();
+    THRIFT_CHECK(transport->session_reused());
+    THRIFT_CHECK(round_trip(transport, 100U));
+    transport->close();
+  }
+
+  // tickets of the previous key are accepted and renewed with the current
+  // one, so clients keep resuming across rotations
+  server.rotate_session_ticket_key();
+  THRIFT_CHECK(resumed(port, ctx));
+  server.rotate_session_ticket_key();
+  THRIFT_CHECK(resumed(port, ctx));
+
+  // sessions are cached by the client context
+  THRIFT_CHECK(!resumed(port, client_context()));
+}
+
+// The server has created its next connection with the current context
+// already, it is accepted with the reloaded one.
+void check_reload(tcp::tls::server& server, unsigned short port)
+{
+  benchmark::generate_self_signed_certificate(reloaded_cert_file, reloaded_key_file);
+  tcp::tls::context fresh;
+  fresh.certificate(reloaded_cert_file);
+  fresh.private_key(reloaded_key_file);
+  fresh.kernel_tls(true);
+  server.reload(fresh);
+
+  THRIFT_CHECK(trusted_round_trip(port, reloaded_cert_file));
+  THRIFT_CHECK(!trusted_round_trip(port, cert_file));
+  THRIFT_CHECK(trusted_round_trip(port, reloaded_cert_file));
+}
+
+void check_handshake_pool()
+{
+  boost::shared_ptr<tcp::tls::server> server = benchmark::make_server<tcp::tls::server>(
+    boost::make_shared<benchmark::echo_processor>());
+  server->certificate(cert_file);
+  server->private_key(key_file);
+  server->setHandshakeThreads(2U);
+  benchmark::check_server<tcp::tls::server> serving(server);
+  tcp::tls::handshake_pool const& pool = server->getHandshakePool();
+
+  // each client handshakes on the pool, then is served by its io_service
+  std::vector<transport_ptr> clients;
+  for (int i = 0; i < 8; ++i)
+    clients.push_back(open_transport(serving.port(), client_context()));
+  for (std::size_t i = 0; i < clients.size(); ++i)
+    THRIFT_CHECK(round_trip(clients[i], 64U * 1024U));
+  THRIFT_CHECK(pool.completed() == clients.size());
+  THRIFT_CHECK(pool.failed() == 0U);
+  THRIFT_CHECK(pool.max_duration() > boost::chrono::nanoseconds::zero());
+  THRIFT_CHECK(pool.total_duration() >= pool.max_duration());
+
+  // a client which is not speaking TLS fails its handshake
+  {
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket socket(io_service);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), serving.port()));
+    boost::asio::write(socket, boost::asio::buffer(benchmark::make_request(100U)));
+    for (int i = 0; i < 500 && !pool.failed(); ++i)
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  }
+  THRIFT_CHECK(pool.failed() == 1U);
+  THRIFT_CHECK(pool.queue_depth() == 0U);
+  THRIFT_CHECK(pool.in_progress() == 0U);
+  THRIFT_CHECK(round_trip(clients.front(), 100U));
+}
+
+// Lengths of TLS records received by clients of reply_records().
+std::vector<std::size_t> received_records;
+
+void record_received(int write_p, int, int content_type, const void* buf, size_t len, SSL*, void*)
+{
+  if (!write_p && content_type == SSL3_RT_HEADER && len == SSL3_RT_HEADER_LENGTH)
+  {
+    const unsigned char* header = static_cast<const unsigned char*>(buf);
+    received_records.push_back(static_cast<std::size_t>(header[3] << 8 | header[4]));
+  }
+}
+
+// Lengths of the records carrying a 64 KB reply sent after an idle period.
+std::vector<std::size_t> reply_records(unsigned short port)
+{
+  tt::tls::context_ptr ctx = client_context();
+  SSL_CTX_set_msg_callback(ctx->get_shared_handle()->native_handle(), &record_received);
+  transport_ptr transport = open_transport(port, ctx);
+  // session tickets arrive with the first reply
+  THRIFT_CHECK(round_trip(transport, 100U));
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(1100));
+  received_records.clear();
+  THRIFT_CHECK(round_trip(transport, 64U * 1024U));
+  const std::vector<std::size_t> records = received_records;
+  transport->close();
+  return records;
+}
+
+// Record lengths include the encryption overhead of at most 256 bytes.
+bool starts_small(std::vector<std::size_t> const& records)
+{
+  return !records.empty() && records.front() <= 1400U + 256U
+    && *std::max_element(records.begin(), records.end()) > 8U * 1024U;
+}
+
+void check_record_size(unsigned short default_port)
+{
+  THRIFT_CHECK(!starts_small(reply_records(default_port)));
+
+  // with user-space crypto and with OpenSSL doing socket I/O
+  for (int kernel_tls = 0; kernel_tls < 2; ++kernel_tls)
+  {
+    boost::shared_ptr<tcp::tls::server> server = benchmark::make_server<tcp::tls::server>(
+      boost::make_shared<benchmark::echo_processor>());
+    server->certificate(cert_file);
+    server->private_key(key_file);
+    server->kernel_tls(kernel_tls != 0);
+    server->record_size(tcp::tls::record_size_policy::dynamic());
+    benchmark::check_server<tcp::tls::server> serving(server);
+    THRIFT_CHECK(starts_small(reply_records(serving.port())));
+  }
+}
+
+void check_server()
+{
+  benchmark::generate_self_signed_certificate(cert_file, key_file);
+
+  boost::shared_ptr<tcp::tls::server> server = benchmark::make_server<tcp::tls::server>(
+    boost::make_shared<benchmark::echo_processor>());
+  server->certificate(cert_file);
+  server->private_key(key_file);
+  server->kernel_tls(true);
+  benchmark::check_server<tcp::tls::server> serving(server);
+
+  check_client_leaving(serving.port());
+  check_record_size(serving.port());
+  check_resumption(*server, serving.port());
+  check_reload(*server, serving.port());
+}
+
+} // namespace
+
+int main()
+{
+  try
+  {
+    check_server();
+    check_handshake_pool();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return apache::thrift::benchmark::check_result();
+}
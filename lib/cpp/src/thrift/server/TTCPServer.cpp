@@ -73,11 +73,15 @@ boost::shared_ptr<apache::thrift::server::TServer> getTCPServer
   default:
     BOOST_THROW_EXCEPTION( apache::thrift::TException("Invalid IOConcurrencyStrategy.") );
   case IOServiceInThreadPool:
-    boost::make_shared<tcp::server_io_service_in_thread_pool>(processor, transportFactory,
+    server = boost::make_shared<tcp::server_io_service_in_thread_pool>(processor, transportFactory,
       protocolFactory, address, port, concurrencyHint);
     break;
   case IOServicePerCore:
-    boost::make_shared<tcp::server_io_service_per_core>(processor, transportFactory,
+    server = boost::make_shared<tcp::server_io_service_per_core>(processor, transportFactory,
+      protocolFactory, address, port, concurrencyHint);
+    break;
+  case IOServiceInThreadPoolSerialized:
+    server = boost::make_shared<tcp::server_io_service_in_thread_pool_serialized>(processor, transportFactory,
       protocolFactory, address, port, concurrencyHint);
     break;
   }
@@ -42,7 +42,8 @@ boost::shared_ptr<apache::thrift::server::TServer> getTCPServer
 enum IOConcurrencyStrategy
 {
   IOServiceInThreadPool,
-  IOServicePerCore
+  IOServicePerCore,
+  IOServiceInThreadPoolSerialized
 };
 
 boost::shared_ptr<apache::thrift::server::TServer> getTCPServer
@@ -103,6 +103,14 @@ boost::shared_ptr<apache::thrift::server::TServer> getTLSServer
       update_context(*server, tlsContext);
       return server;
     }
+  case IOServiceInThreadPoolSerialized:
+    {
+      boost::shared_ptr<tcp::tls::server_io_service_in_thread_pool_serialized> server =
+        boost::make_shared<tcp::tls::server_io_service_in_thread_pool_serialized>(processor, transportFactory,
+        protocolFactory, address, port, concurrencyHint);
+      update_context(*server, tlsContext);
+      return server;
+    }
   }
 }
 
@@ -24,16 +24,20 @@
 
 #include <thrift/config.hpp>
 #include <thrift/transport/TBufferTransports.h>
+#include <vector>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/buffer.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/type_traits/remove_reference.hpp>
 #include <boost/type_traits/is_same.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <thrift/server/tcp/detail/helpers.hpp>
 #include <thrift/server/tcp/detail/concepts.hpp>
 #include <thrift/server/tcp/detail/handler_policies.hpp>
+#include <thrift/server/tcp/detail/priority_scheduler.hpp>
 #include <thrift/server/tcp/request_handler.hpp>
 #include <thrift/server/tcp/stream_traits.hpp>
 
@@ -69,6 +73,8 @@ class basic_connection : public boost::enable_shared_from_this<basic_connection<
 {
   BOOST_CONCEPT_ASSERT((detail::concepts::HandlerPolicyConcept<HandlerPolicy>));
 
+  friend struct detail::connection_loop<basic_connection>;
+
 #ifndef BOOST_NO_MEMBER_TEMPLATE_FRIENDS
   template <class Connection, class IOServingPolicy>
   friend class basic_server;
@@ -93,18 +99,56 @@ public:
   // get_socket() returns socket and get_stream() returns ssl::stream<socket>.
   stream_reference get_stream();
 
+  // Server the connection was accepted by.
+  typename detail::server_type<basic_connection>::reference_type get_server();
+
   void set_socket_options();
 
-  void process();
-  void read_frame_size();
-  void read_frame( std::size_t frame_size );
-  void write_reply();
+  // Starts the connection loop: read input, process buffered frames, write
+  // their replies.
+  void run();
 
-#ifdef BOOST_NO_CXX11_LAMBDAS
-  void handle_read_frame_size(uint8_t* buff, boost::system::error_code const& error, std::size_t bytes_transferred);
-  void handle_read_frame(boost::system::error_code const& error, std::size_t bytes_transferred);
-  void handle_write_reply(boost::system::error_code const& error, std::size_t bytes_transferred);
-#endif
+  // Body of the connection loop, resumed by completion of every operation it
+  // starts.
+  void resume( detail::connection_loop<basic_connection>& loop, boost::system::error_code const& error, std::size_t bytes_transferred );
+
+  boost::asio::const_buffers_1 reply_buffer();
+
+  // Length of the complete frame (with its size) at the front of input, 0 if
+  // it is not received yet.
+  std::size_t buffered_frame() const;
+
+  // Bytes still needed to complete the frame at the front of input.
+  std::size_t missing_input() const;
+
+  // Whether the size of the frame at the front of input is above the
+  // maximum frame size of the server, such frame closes the connection.
+  bool oversized_frame() const;
+
+  // Makes room for at least missing bytes in input, false if memory budget
+  // of the server has no room for it.
+  bool reserve_input( std::size_t missing );
+
+  // Free space of input.
+  boost::asio::mutable_buffers_1 input_buffer();
+
+  // Bytes of replies waiting to be written.
+  std::size_t reply_size() const;
+
+  // Large reply is charged to memory budget while it is written.
+  void charge_reply();
+
+  void reply_written();
+
+  // Hands the buffered frame over to rbuf and charges it to the budget.
+  void take_frame();
+
+  bool within_budget() const;
+
+  // Queues handler by priority of the method of the frame in rbuf, see
+  // method_priorities.
+  template <class Handler>
+  void schedule( Handler handler );
 
 public:
   typedef typename detail::server_type<basic_connection>::reference_type server_reference;
@@ -123,12 +167,28 @@ public:
 #endif
   basic_connection( boost::asio::io_service& io_service, boost::asio::ssl::context&, ServerReference& servref );
 
+  ~basic_connection();
+
 private:
+  static const std::size_t initial_input_size = 4096U;
+
+  // Read-ahead buffer, holds pipelined frames received by one read.
+  std::vector<uint8_t> input;
+  std::size_t input_begin, input_end;
+  // Frames and bytes served in the current turn.
+  std::size_t turn_frames, turn_bytes;
+  // Bytes charged to memory budget of the server.
+  std::size_t input_charged, reply_charged;
   boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> wbuf;
   boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> rbuf;
   socket_type socket;
   server_reference server;
   request_handler handle_request;
+  // Set when output transport factory is gather_transport_factory.
+  boost::shared_ptr<gather_transport> gather;
+  // Set when requests are scheduled by priority.
+  boost::shared_ptr<method_priorities const> priorities;
+  boost::scoped_ptr<detail::method_reader> read_method;
 };
 
 } // namespace tcp
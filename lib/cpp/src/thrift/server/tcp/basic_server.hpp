@@ -27,12 +27,15 @@
 #include <thrift/server/tcp/detail/io_serving_policies.hpp>
 #include <thrift/server/tcp/detail/concepts.hpp>
 #include <thrift/server/TServer.h>
+#include <thrift/transport/tcp/socket_options.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/noncopyable.hpp>
 
 namespace apache { namespace thrift { namespace server { namespace tcp {
 
+using apache::thrift::transport::tcp::socket_options;
+
 template <class Connection, class IOServingPolicy = detail::default_io_serving_policy>
 class basic_server : public detail::security_policy_chooser<Connection>, private IOServingPolicy, private boost::noncopyable
 {
@@ -50,7 +53,8 @@ public:
     const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
     const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
     std::string const& address,
-    std::string const& port
+    std::string const& port,
+    socket_options const& options = socket_options::defaults()
   );
 
   basic_server
@@ -60,14 +64,49 @@ public:
     const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
     std::string const& address,
     std::string const& port,
-    std::size_t num_threads 
+    std::size_t num_threads,
+    socket_options const& options = socket_options::defaults()
+  );
+
+  // Requests are handed to asynchronous processor, reply is written when it completes.
+  basic_server
+  (
+    const boost::shared_ptr<apache::thrift::async::TAsyncProcessor>& processor,
+    const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
+    const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
+    std::string const& address,
+    std::string const& port,
+    socket_options const& options = socket_options::defaults()
+  );
+
+  basic_server
+  (
+    const boost::shared_ptr<apache::thrift::async::TAsyncProcessor>& processor,
+    const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
+    const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
+    std::string const& address,
+    std::string const& port,
+    std::size_t num_threads,
+    socket_options const& options = socket_options::defaults()
   );
 
   virtual void serve() OVERRIDE;
   virtual void stop() OVERRIDE;
 
+  // The server listens from construction on, port "0" lets the system
+  // choose the port, which is told by local_endpoint().
+  boost::asio::ip::tcp::endpoint local_endpoint() const;
+
 private:
   void start();
+  void init
+  (
+    const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
+    const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
+    std::string const& address,
+    std::string const& port,
+    socket_options const& options
+  );
   void start_listen(std::string const& address, std::string const& port);
   void start_accept();
 #ifdef BOOST_NO_CXX11_LAMBDAS
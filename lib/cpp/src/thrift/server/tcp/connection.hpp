@@ -28,6 +28,7 @@ namespace apache { namespace thrift { namespace server { namespace tcp {
 
 typedef basic_connection<boost::asio::ip::tcp::socket> connection;
 typedef basic_connection<boost::asio::ip::tcp::socket, stream_traits, detail::concurrent_handler_execution_policy> concurrent_connection;
+typedef basic_connection<boost::asio::ip::tcp::socket, stream_traits, detail::serialized_handler_execution_policy> serialized_connection;
 
 } // namespace tcp
 } // namespace server
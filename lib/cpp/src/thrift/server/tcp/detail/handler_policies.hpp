@@ -24,6 +24,11 @@
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+#include <boost/atomic.hpp>
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace apache { namespace thrift { namespace server { namespace tcp { namespace detail {
 
@@ -69,6 +74,129 @@ private:
   boost::asio::io_service::strand strand_;
 };
 
+//  operation_state   -----------------------------------------------//
+// State of the single asynchronous operation that basic_connection may have
+// outstanding. Starting an operation publishes the connection's state with
+// release semantics and the completion handler acquires it before it runs,
+// so consecutive handlers are ordered even if they run on different threads.
+// Nothing is touched after the handler returns, at that point next handler
+// may already own (and release) the connection.
+class operation_state : private boost::noncopyable
+{
+public:
+  operation_state() : state_( idle )
+  {}
+
+  // Called when an operation is started, from a running handler or when the
+  // connection starts.
+  void arm()
+  {
+    // Second operation while one is outstanding breaks serialization.
+    BOOST_VERIFY( state_.exchange( pending, boost::memory_order_release ) != pending );
+  }
+
+  // Called before completion handler runs.
+  void enter()
+  {
+    // Handler may only be invoked for an outstanding operation.
+    BOOST_VERIFY( state_.exchange( running, boost::memory_order_acquire ) == pending );
+  }
+
+private:
+  enum { idle, pending, running };
+  boost::atomic<int> state_;
+};
+
+//  serialized_handler   -----------------------------------------------//
+template <class Handler>
+class serialized_handler
+{
+public:
+  serialized_handler( Handler h, operation_state& s ) : handler_( BOOST_ASIO_MOVE_CAST(Handler)(h) ), state_( &s )
+  {}
+
+  void operator()()
+  {
+    state_->enter();
+    handler_();
+  }
+
+  template <class Arg1>
+  void operator()( Arg1 const& arg1 )
+  {
+    state_->enter();
+    handler_( arg1 );
+  }
+
+  template <class Arg1, class Arg2>
+  void operator()( Arg1 const& arg1, Arg2 const& arg2 )
+  {
+    state_->enter();
+    handler_( arg1, arg2 );
+  }
+
+private:
+  template <class H>
+  friend void* asio_handler_allocate( std::size_t size, serialized_handler<H>* this_handler );
+  template <class H>
+  friend void asio_handler_deallocate( void* pointer, std::size_t size, serialized_handler<H>* this_handler );
+  template <class Function, class H>
+  friend void asio_handler_invoke( Function& function, serialized_handler<H>* this_handler );
+  template <class Function, class H>
+  friend void asio_handler_invoke( Function const& function, serialized_handler<H>* this_handler );
+
+  Handler handler_;
+  operation_state* state_;
+};
+
+// Intermediate handlers of composed operations use the hooks of the wrapped handler.
+template <class Handler>
+inline void* asio_handler_allocate( std::size_t size, serialized_handler<Handler>* this_handler )
+{
+  return boost_asio_handler_alloc_helpers::allocate( size, this_handler->handler_ );
+}
+
+template <class Handler>
+inline void asio_handler_deallocate( void* pointer, std::size_t size, serialized_handler<Handler>* this_handler )
+{
+  boost_asio_handler_alloc_helpers::deallocate( pointer, size, this_handler->handler_ );
+}
+
+template <class Function, class Handler>
+inline void asio_handler_invoke( Function& function, serialized_handler<Handler>* this_handler )
+{
+  boost_asio_handler_invoke_helpers::invoke( function, this_handler->handler_ );
+}
+
+template <class Function, class Handler>
+inline void asio_handler_invoke( Function const& function, serialized_handler<Handler>* this_handler )
+{
+  boost_asio_handler_invoke_helpers::invoke( function, this_handler->handler_ );
+}
+
+// for concurrent handlers execution without strands, basic_connection never
+// has more than one operation outstanding so its handlers are serialized by
+// construction and operation_state only orders them
+struct serialized_handler_execution_policy
+{
+#ifndef _MSC_VER
+protected:
+#endif
+  explicit serialized_handler_execution_policy( boost::asio::io_service& )
+  {}
+
+  template <class Handler>
+  serialized_handler<Handler> safe_handler(Handler handler)
+  {
+    state_.arm();
+    return serialized_handler<Handler>( BOOST_ASIO_MOVE_CAST(Handler)(handler), state_ );
+  }
+
+private:
+  /// State of the connection's single outstanding operation.
+  operation_state state_;
+};
+
 } // namespace detail
 } // namespace tcp
 } // namespace server
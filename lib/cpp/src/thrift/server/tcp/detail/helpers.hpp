@@ -24,23 +24,175 @@
 
 #include <boost/type_traits/add_lvalue_reference.hpp>
 #include <boost/mpl/if.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 #include <thrift/server/TServer.h>
+#include <thrift/async/TAsyncProcessor.h>
+#include <thrift/transport/tcp/socket_options.hpp>
+#include <thrift/server/tcp/method_priorities.hpp>
+#include <thrift/server/tcp/memory_budget.hpp>
 #include <thrift/server/tcp/tls/context.hpp>
+#include <thrift/server/tcp/tls/handshake_pool.hpp>
 #include <thrift/server/tcp/detail/traits.hpp>
 
 namespace apache { namespace thrift { namespace server { namespace tcp { namespace detail {
 
 //  tcp_server_base   -----------------------------------------------//
-typedef apache::thrift::server::TServer tcp_server_base;
+struct tcp_server_base : apache::thrift::server::TServer
+{
+  // Asynchronous processor, when set requests are not handed to processor
+  // obtained from processor factory.
+  boost::shared_ptr<apache::thrift::async::TAsyncProcessor> getAsyncProcessor() const
+  {
+    return asyncProcessor_;
+  }
+
+  // Options of the listening and accepted sockets.
+  apache::thrift::transport::tcp::socket_options const& getSocketOptions() const
+  {
+    return socketOptions_;
+  }
+
+  // Frames and bytes a connection serves from already received input in one
+  // turn. Once either is spent, replies are written or the connection is
+  // posted to the back of the io_service queue, so it cannot starve other
+  // connections sharing the thread. Zero means no limit.
+  void setConnectionBudget(std::size_t frames, std::size_t bytes)
+  {
+    frameBudget_ = frames;
+    byteBudget_ = bytes;
+  }
+
+  std::size_t getConnectionFrameBudget() const
+  {
+    return frameBudget_;
+  }
+
+  std::size_t getConnectionByteBudget() const
+  {
+    return byteBudget_;
+  }
+
+  // Requests are scheduled by priority of their methods, connections
+  // accepted afterwards are affected.
+  void setMethodPriorities(method_priorities const& priorities)
+  {
+    methodPriorities_ = boost::make_shared<method_priorities>(priorities);
+  }
+
+  // Null unless requests are scheduled by priority.
+  boost::shared_ptr<method_priorities const> getMethodPriorities() const
+  {
+    return methodPriorities_;
+  }
+
+  // Limit of bytes held by large frames and replies of all connections, 0
+  // means no limit. See memory_budget.
+  void setMemoryBudget(std::size_t bytes)
+  {
+    memoryBudget_.set_limit(bytes);
+  }
+
+  memory_budget& getMemoryBudget()
+  {
+    return memoryBudget_;
+  }
+
+  memory_budget const& getMemoryBudget() const
+  {
+    return memoryBudget_;
+  }
+
+  // Frames larger than bytes close their connection without being read, 0
+  // means no limit. 256 MB by default, never above the memory budget when
+  // one is set.
+  void setMaxFrameSize(std::size_t bytes)
+  {
+    maxFrameSize_ = bytes;
+  }
+
+  std::size_t getMaxFrameSize() const
+  {
+    const std::size_t budget = memoryBudget_.limit();
+    return budget && (!maxFrameSize_ || budget < maxFrameSize_) ? budget : maxFrameSize_;
+  }
+
+protected:
+  explicit tcp_server_base(boost::shared_ptr<apache::thrift::TProcessor> const& processor) : apache::thrift::server::TServer(processor),
+    frameBudget_(16U), byteBudget_(256U * 1024U), maxFrameSize_(256U * 1024U * 1024U)
+  {}
+
+  explicit tcp_server_base(boost::shared_ptr<apache::thrift::async::TAsyncProcessor> const& processor) :
+    apache::thrift::server::TServer(boost::shared_ptr<apache::thrift::TProcessor>()), asyncProcessor_(processor),
+    frameBudget_(16U), byteBudget_(256U * 1024U), maxFrameSize_(256U * 1024U * 1024U)
+  {}
+
+  void setSocketOptions(apache::thrift::transport::tcp::socket_options const& options)
+  {
+    socketOptions_ = options;
+  }
+
+private:
+  boost::shared_ptr<apache::thrift::async::TAsyncProcessor> asyncProcessor_;
+  apache::thrift::transport::tcp::socket_options socketOptions_;
+  std::size_t frameBudget_;
+  std::size_t byteBudget_;
+  std::size_t maxFrameSize_;
+  boost::shared_ptr<method_priorities const> methodPriorities_;
+  memory_budget memoryBudget_;
+};
 
 //  tls_server_base   -----------------------------------------------//
-struct tls_server_base : apache::thrift::server::TServer, apache::thrift::server::tcp::tls::context
+struct tls_server_base : tcp_server_base, apache::thrift::server::tcp::tls::context
 {
+  // Threads running handshakes of new connections, 0 (default) runs them
+  // on io_service of connections. See handshake_pool.
+  void setHandshakeThreads(std::size_t threads)
+  {
+    handshakePool_.set_threads(threads);
+  }
+
+  apache::thrift::server::tcp::tls::handshake_pool& getHandshakePool()
+  {
+    return handshakePool_;
+  }
+
+  apache::thrift::server::tcp::tls::handshake_pool const& getHandshakePool() const
+  {
+    return handshakePool_;
+  }
+
 protected:
-  explicit tls_server_base(boost::shared_ptr<apache::thrift::TProcessor> const& processor) : apache::thrift::server::TServer(processor)
+  explicit tls_server_base(boost::shared_ptr<apache::thrift::TProcessor> const& processor) : tcp_server_base(processor)
+  {}
+
+  explicit tls_server_base(boost::shared_ptr<apache::thrift::async::TAsyncProcessor> const& processor) : tcp_server_base(processor)
   {}
+
+private:
+  apache::thrift::server::tcp::tls::handshake_pool handshakePool_;
 };
 
+//  serving_started, serving_stopped   -----------------------------------------------//
+// Threads of TLS handshakes run only while the server serves.
+inline void serving_started(tcp_server_base&)
+{}
+
+inline void serving_started(tls_server_base& server)
+{
+  server.getHandshakePool().run();
+}
+
+inline void serving_stopped(tcp_server_base&)
+{}
+
+inline void serving_stopped(tls_server_base& server)
+{
+  server.getHandshakePool().stop();
+}
+
 //  server_type   -----------------------------------------------//
 template <class Connection>
 struct server_type {
@@ -56,6 +208,88 @@ struct security_policy_chooser : server_type<Connection>::value_type
 protected:
   explicit security_policy_chooser(boost::shared_ptr<apache::thrift::TProcessor> const& processor) : inherited(processor)
   {}
+
+  explicit security_policy_chooser(boost::shared_ptr<apache::thrift::async::TAsyncProcessor> const& processor) : inherited(processor)
+  {}
+};
+
+//  posted_completion   -----------------------------------------------//
+// Completion callback given to an asynchronous processor. The processor may
+// call it from any thread, so the handler is posted to the io_service of the
+// connection that has issued the request.
+template <class Handler>
+struct posted_completion
+{
+  typedef void result_type;
+
+  posted_completion(boost::asio::io_service& io_service, Handler h) : io_service_(&io_service), handler_(h)
+  {}
+
+  void operator()(bool healthy)
+  {
+    io_service_->post( boost::bind<void>( handler_, healthy ) );
+  }
+
+private:
+  boost::asio::io_service* io_service_;
+  Handler handler_;
+};
+
+template <class Handler>
+inline posted_completion<Handler> make_posted_completion(boost::asio::io_service& io_service, Handler h)
+{
+  return posted_completion<Handler>(io_service, h);
+}
+
+//  connection_loop   -----------------------------------------------//
+// Completion handler of every operation started by the connection loop. It
+// carries the state of the stackless coroutine and resumes the loop, which
+// is implemented by Connection::resume(). The reference to the connection is
+// handed over from one handler to the next one, so no reference count is
+// touched per operation.
+template <class Connection>
+struct connection_loop : boost::asio::coroutine
+{
+  typedef void result_type;
+  typedef boost::shared_ptr<Connection> pointer_type;
+
+  explicit connection_loop(pointer_type const& c) : connection(c)
+  {}
+
+  // Handler of the next operation, takes over the reference to the connection.
+  connection_loop next()
+  {
+    connection_loop n(static_cast<boost::asio::coroutine const&>(*this));
+    n.connection.swap(connection);
+    return n;
+  }
+
+  void operator()(boost::system::error_code const& error = boost::system::error_code(), std::size_t bytes_transferred = 0U)
+  {
+    Connection& c = *connection;
+    c.resume(*this, error, bytes_transferred);
+  }
+
+  // Completion of asynchronous processor.
+  void operator()(bool healthy)
+  {
+    if ( healthy )
+    {
+      Connection& c = *connection;
+      c.resume(*this, boost::system::error_code(), 0U);
+    }
+    // Connection is closed after this handler returns.
+    else
+    {
+      apache::thrift::GlobalOutput( "Server async processor failed, connection closed." );
+    }
+  }
+
+private:
+  explicit connection_loop(boost::asio::coroutine const& state) : boost::asio::coroutine(state)
+  {}
+
+  pointer_type connection;
 };
 
 } // namespace detail
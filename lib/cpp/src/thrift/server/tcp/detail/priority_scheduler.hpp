@@ -0,0 +1,175 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_DETAIL_PRIORITY_SCHEDULER_HPP_
+#define _THRIFT_SERVER_TCP_DETAIL_PRIORITY_SCHEDULER_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/Thrift.h>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/server/tcp/method_priorities.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/version.hpp>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace apache { namespace thrift { namespace server { namespace tcp { namespace detail {
+
+//  priority_scheduler   -----------------------------------------------//
+// Service of an io_service, queues handlers by priority. For every queued
+// handler a dispatcher is posted, which runs the most urgent handler queued
+// at the time it is executed, not the one it was posted for. Thus io_service
+// threads keep running io_service::run() and FIFO order of io_service queue
+// only determines when the next request is picked.
+class priority_scheduler : public boost::asio::detail::service_base<priority_scheduler>
+{
+public:
+  explicit priority_scheduler( boost::asio::io_service& io_service ) :
+    boost::asio::detail::service_base<priority_scheduler>( io_service ), io_service_( io_service ),
+    sequence_( 0U ), virtual_time_( 0U )
+  {}
+
+  template <class Handler>
+  void post( method_priorities const& priorities, std::size_t priority_class, Handler handler )
+  {
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      jobs_.insert( std::make_pair( key( priorities, priority_class ),
+        job( priorities.policy() == method_priorities::weighted, handler ) ) );
+    }
+    io_service_.post( boost::bind( &priority_scheduler::run_one, this ) );
+  }
+
+private:
+#if BOOST_VERSION >= 106600
+  void shutdown()
+#else
+  void shutdown_service()
+#endif
+  {
+    // Handlers own connections, release them before io_service goes away.
+    std::multimap<std::pair<uint64_t, uint64_t>, job> jobs;
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      jobs.swap( jobs_ );
+    }
+  }
+
+  struct job
+  {
+    job( bool w, boost::function<void()> const& h ) : weighted( w ), handler( h )
+    {}
+
+    bool weighted;
+    boost::function<void()> handler;
+  };
+
+  // Jobs are ordered by (class, arrival) under strict policy and by
+  // (virtual start time, arrival) under weighted one, i.e. start-time fair
+  // queueing: a class is charged 1/weight of virtual time per request.
+  std::pair<uint64_t, uint64_t> key( method_priorities const& priorities, std::size_t priority_class )
+  {
+    if ( priorities.policy() == method_priorities::strict )
+      return std::make_pair( static_cast<uint64_t>( priority_class ), sequence_++ );
+
+    if ( finish_.size() <= priority_class )
+      finish_.resize( priority_class + 1U, 0U );
+
+    const uint64_t start = std::max( virtual_time_, finish_[priority_class] );
+    finish_[priority_class] = start + cost / priorities.weight_of( priority_class );
+    return std::make_pair( start, sequence_++ );
+  }
+
+  void run_one()
+  {
+    boost::function<void()> handler;
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      if ( jobs_.empty() )
+        return;
+
+      std::multimap<std::pair<uint64_t, uint64_t>, job>::iterator top = jobs_.begin();
+      if ( top->second.weighted )
+        virtual_time_ = top->first.first;
+      handler.swap( top->second.handler );
+      jobs_.erase( top );
+    }
+    handler();
+  }
+
+  static const uint64_t cost = 1U << 20;
+
+  boost::asio::io_service& io_service_;
+  boost::mutex mutex_;
+  std::multimap<std::pair<uint64_t, uint64_t>, job> jobs_;
+  uint64_t sequence_;
+  uint64_t virtual_time_;
+  std::vector<uint64_t> finish_;
+};
+
+//  method_reader   -----------------------------------------------//
+// Reads method name from the message header with connection's input
+// protocol, the message itself is left untouched.
+class method_reader : private boost::noncopyable
+{
+public:
+  explicit method_reader( boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> const& factory ) :
+    buffer( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ), protocol( factory->getProtocol( buffer ) )
+  {}
+
+  // Empty name is returned if header cannot be parsed, process() reports it.
+  std::string const& operator()( uint8_t* message, uint32_t size )
+  {
+    buffer->resetBuffer( message, size );
+    try
+    {
+      apache::thrift::protocol::TMessageType type;
+      int32_t seqid = 0;
+      protocol->readMessageBegin( name, type, seqid );
+    }
+    catch ( apache::thrift::TException const& )
+    {
+      name.clear();
+    }
+    return name;
+  }
+
+private:
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buffer;
+  boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol;
+  std::string name;
+};
+
+} // namespace detail
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_DETAIL_PRIORITY_SCHEDULER_HPP_
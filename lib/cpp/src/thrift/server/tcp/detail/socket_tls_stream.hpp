@@ -0,0 +1,300 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_DETAIL_SOCKET_TLS_STREAM_HPP_
+#define _THRIFT_SERVER_TCP_DETAIL_SOCKET_TLS_STREAM_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/transport/tcp/detail/socket_ops.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/error.hpp>
+#include <boost/asio/detail/buffer_sequence_adapter.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 106600
+# include <boost/asio/associated_executor.hpp>
+#endif
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <cerrno>
+
+namespace apache { namespace thrift { namespace server { namespace tcp { namespace detail {
+
+//  socket_tls_stream   -----------------------------------------------//
+// TLS stream of a connection whose SSL does socket I/O itself, see
+// context::kernel_tls(). Operations call OpenSSL on the non-blocking socket
+// and wait for its readiness when OpenSSL needs it, records are encrypted by
+// the kernel where kTLS is active. Reads and writes share the SSL and must
+// not overlap, only one operation may be outstanding at a time (as
+// basic_connection does).
+class socket_tls_stream : private boost::noncopyable
+{
+public:
+  typedef boost::asio::ip::tcp::socket next_layer_type;
+
+  enum handshake_type { client, server };
+
+  socket_tls_stream( next_layer_type& socket, SSL* ssl ) : socket_( socket ), ssl_( ssl )
+  {
+    socket_.non_blocking( true );
+  }
+
+#if BOOST_VERSION >= 106600
+  typedef next_layer_type::executor_type executor_type;
+
+  executor_type get_executor()
+  {
+    return socket_.get_executor();
+  }
+#else
+  boost::asio::io_service& get_io_service()
+  {
+    return socket_.get_io_service();
+  }
+#endif
+
+  template <class Handler>
+  void async_handshake( handshake_type type, Handler handler )
+  {
+    if ( type == server )
+      SSL_set_accept_state( ssl_ );
+    else
+      SSL_set_connect_state( ssl_ );
+    start( handshake_op(), handler );
+  }
+
+  template <class MutableBufferSequence, class Handler>
+  void async_read_some( MutableBufferSequence const& buffers, Handler handler )
+  {
+    start( read_op( boost::asio::detail::buffer_sequence_adapter<boost::asio::mutable_buffer,
+      MutableBufferSequence>::first( buffers ) ), handler );
+  }
+
+  template <class ConstBufferSequence, class Handler>
+  void async_write_some( ConstBufferSequence const& buffers, Handler handler )
+  {
+    start( write_op( boost::asio::detail::buffer_sequence_adapter<boost::asio::const_buffer,
+      ConstBufferSequence>::first( buffers ) ), handler );
+  }
+
+  // Operations, result of OpenSSL call and a way to complete handler.
+  struct handshake_op
+  {
+    int operator()( SSL* ssl ) const
+    {
+      return SSL_do_handshake( ssl );
+    }
+
+    template <class Handler>
+    static void call( Handler& handler, boost::system::error_code const& ec, std::size_t )
+    {
+      handler( ec );
+    }
+  };
+
+  struct read_op
+  {
+    explicit read_op( boost::asio::mutable_buffer const& b ) : buffer( b )
+    {}
+
+    int operator()( SSL* ssl ) const
+    {
+      return SSL_read( ssl, boost::asio::buffer_cast<void*>( buffer ),
+        static_cast<int>( boost::asio::buffer_size( buffer ) ) );
+    }
+
+    template <class Handler>
+    static void call( Handler& handler, boost::system::error_code const& ec, std::size_t bytes )
+    {
+      handler( ec, bytes );
+    }
+
+    boost::asio::mutable_buffer buffer;
+  };
+
+  struct write_op
+  {
+    explicit write_op( boost::asio::const_buffer const& b ) : buffer( b )
+    {}
+
+    int operator()( SSL* ssl ) const
+    {
+      return SSL_write( ssl, boost::asio::buffer_cast<const void*>( buffer ),
+        static_cast<int>( boost::asio::buffer_size( buffer ) ) );
+    }
+
+    template <class Handler>
+    static void call( Handler& handler, boost::system::error_code const& ec, std::size_t bytes )
+    {
+      handler( ec, bytes );
+    }
+
+    boost::asio::const_buffer buffer;
+  };
+
+  template <class Operation, class Handler>
+  class io_op
+  {
+  public:
+    io_op( next_layer_type& socket, SSL* ssl, Operation const& op, Handler& handler ) : socket_( &socket ),
+      ssl_( ssl ), op_( op ), start_( true ), handler_( BOOST_ASIO_MOVE_CAST(Handler)( handler ) )
+    {}
+
+    // Runs the operation, called again when the socket is ready.
+    void operator()( boost::system::error_code ec = boost::system::error_code(), std::size_t = 0U )
+    {
+      std::size_t bytes = 0U;
+      if ( !ec )
+      {
+        // a write to a client which has gone must not kill the server
+        apache::thrift::transport::tcp::detail::sigpipe_guard guard;
+        ERR_clear_error();
+        const int result = op_( ssl_ );
+        if ( result > 0 )
+          bytes = static_cast<std::size_t>( result );
+        else
+        {
+          switch ( SSL_get_error( ssl_, result ) )
+          {
+          case SSL_ERROR_WANT_READ:
+            start_ = false;
+            socket_->async_read_some( boost::asio::null_buffers(), BOOST_ASIO_MOVE_CAST(io_op)( *this ) );
+            return;
+          case SSL_ERROR_WANT_WRITE:
+            start_ = false;
+            socket_->async_write_some( boost::asio::null_buffers(), BOOST_ASIO_MOVE_CAST(io_op)( *this ) );
+            return;
+          case SSL_ERROR_ZERO_RETURN:
+            ec = boost::asio::error::eof;
+            break;
+          case SSL_ERROR_SYSCALL:
+            if ( !ERR_peek_error() )
+            {
+              ec = errno ? boost::system::error_code( errno, boost::asio::error::get_system_category() )
+                : boost::system::error_code( boost::asio::error::eof );
+              break;
+            }
+            // fall through
+          default:
+            ec = boost::system::error_code( static_cast<int>( ERR_get_error() ), boost::asio::error::get_ssl_category() );
+          }
+        }
+      }
+
+      // handler is not called from the initiating function
+      if ( start_ )
+      {
+        start_ = false;
+        socket_->get_io_service().post( boost::bind( &io_op::complete, *this, ec, bytes ) );
+        return;
+      }
+      complete( ec, bytes );
+    }
+
+    void complete( boost::system::error_code const& ec, std::size_t bytes )
+    {
+      Operation::call( handler_, ec, bytes );
+    }
+
+#if BOOST_VERSION >= 106600
+    typedef typename boost::asio::associated_executor<Handler, next_layer_type::executor_type>::type executor_type;
+
+    executor_type get_executor() const
+    {
+      return boost::asio::get_associated_executor( handler_, socket_->get_executor() );
+    }
+#endif
+
+  private:
+    template <class O, class H>
+    friend void* asio_handler_allocate( std::size_t size, io_op<O, H>* this_handler );
+    template <class O, class H>
+    friend void asio_handler_deallocate( void* pointer, std::size_t size, io_op<O, H>* this_handler );
+    template <class O, class H>
+    friend bool asio_handler_is_continuation( io_op<O, H>* this_handler );
+    template <class Function, class O, class H>
+    friend void asio_handler_invoke( Function& function, io_op<O, H>* this_handler );
+    template <class Function, class O, class H>
+    friend void asio_handler_invoke( Function const& function, io_op<O, H>* this_handler );
+
+    next_layer_type* socket_;
+    SSL* ssl_;
+    Operation op_;
+    bool start_;
+    Handler handler_;
+  };
+
+private:
+  template <class Operation, class Handler>
+  void start( Operation const& op, Handler& handler )
+  {
+    io_op<Operation, Handler>( socket_, ssl_, op, handler )();
+  }
+
+  next_layer_type& socket_;
+  SSL* ssl_;
+};
+
+// Intermediate handlers use the hooks of the wrapped handler.
+template <class Operation, class Handler>
+inline void* asio_handler_allocate( std::size_t size, socket_tls_stream::io_op<Operation, Handler>* this_handler )
+{
+  return boost_asio_handler_alloc_helpers::allocate( size, this_handler->handler_ );
+}
+
+template <class Operation, class Handler>
+inline void asio_handler_deallocate( void* pointer, std::size_t size, socket_tls_stream::io_op<Operation, Handler>* this_handler )
+{
+  boost_asio_handler_alloc_helpers::deallocate( pointer, size, this_handler->handler_ );
+}
+
+template <class Operation, class Handler>
+inline bool asio_handler_is_continuation( socket_tls_stream::io_op<Operation, Handler>* this_handler )
+{
+  return !this_handler->start_ || boost_asio_handler_cont_helpers::is_continuation( this_handler->handler_ );
+}
+
+template <class Function, class Operation, class Handler>
+inline void asio_handler_invoke( Function& function, socket_tls_stream::io_op<Operation, Handler>* this_handler )
+{
+  boost_asio_handler_invoke_helpers::invoke( function, this_handler->handler_ );
+}
+
+template <class Function, class Operation, class Handler>
+inline void asio_handler_invoke( Function const& function, socket_tls_stream::io_op<Operation, Handler>* this_handler )
+{
+  boost_asio_handler_invoke_helpers::invoke( function, this_handler->handler_ );
+}
+
+} // namespace detail
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_DETAIL_SOCKET_TLS_STREAM_HPP_
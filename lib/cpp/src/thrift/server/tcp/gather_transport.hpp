@@ -0,0 +1,237 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_GATHER_TRANSPORT_HPP_
+#define _THRIFT_SERVER_TCP_GATHER_TRANSPORT_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TVirtualTransport.h>
+#include <boost/asio/buffer.hpp>
+#include <boost/make_shared.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace server { namespace tcp {
+
+//  gather_transport   -----------------------------------------------//
+// Framed output transport of the server which, next to serialized bytes,
+// holds references to buffers owned by the application. Every flush()
+// completes a frame, frames are sent by the connection with one gathered
+// write and referenced buffers are not copied. Install it with
+// gather_transport_factory as output transport factory of the server; with
+// TBinaryProtocol as output protocol, processors may then reference binary
+// values with write_binary_reference().
+class gather_transport : public apache::thrift::transport::TVirtualTransport<gather_transport>
+{
+public:
+  // Shorter references are copied, gathering them costs more than memcpy.
+  static const uint32_t reference_threshold = 1024U;
+
+  gather_transport() : frame_start( 0U ), frame_references( 0U ), completed( 0U )
+  {
+    begin_frame();
+  }
+
+  bool isOpen()
+  {
+    return true;
+  }
+
+  void open()
+  {}
+
+  void close()
+  {}
+
+  void write( const uint8_t* buf, uint32_t len )
+  {
+    bytes.insert( bytes.end(), buf, buf + len );
+  }
+
+  // Appends data without copying it, holder keeps data alive until the
+  // frame is written.
+  void write_reference( const uint8_t* data, uint32_t len, boost::shared_ptr<void const> const& holder )
+  {
+    if ( len < reference_threshold )
+    {
+      write( data, len );
+      return;
+    }
+
+    const reference r = { bytes.size(), data, len, holder };
+    references.push_back( r );
+    frame_references += len;
+  }
+
+  // Completes the frame, a frame without data (e.g. oneway) is dropped.
+  void flush()
+  {
+    const std::size_t length = bytes.size() - frame_start - sizeof( uint32_t ) + frame_references;
+    if ( !length )
+      return;
+
+    const uint32_t frame_size = htonl( static_cast<uint32_t>( length ) );
+    std::memcpy( &bytes[frame_start], &frame_size, sizeof( frame_size ) );
+    completed += sizeof( frame_size ) + length;
+    begin_frame();
+  }
+
+  // Bytes of completed frames.
+  std::size_t size() const
+  {
+    return completed;
+  }
+
+  // Bytes held by the transport itself, referenced buffers are not counted.
+  std::size_t buffered_size() const
+  {
+    return bytes.size();
+  }
+
+  // ConstBufferSequence referring to buffers held by the transport, so
+  // asynchronous operations copy it without allocation.
+  struct const_buffers
+  {
+    typedef boost::asio::const_buffer value_type;
+    typedef std::vector<boost::asio::const_buffer>::const_iterator const_iterator;
+
+    const_buffers( const_iterator b, const_iterator e ) : first( b ), last( e )
+    {}
+
+    const_iterator begin() const
+    {
+      return first;
+    }
+
+    const_iterator end() const
+    {
+      return last;
+    }
+
+  private:
+    const_iterator first, last;
+  };
+
+  // Completed frames as a buffer sequence, valid until clear().
+  const_buffers buffers()
+  {
+    sequence.clear();
+    std::size_t position = 0U;
+    // a reference ending a frame is at the next frame_start, references of
+    // the incomplete frame follow its size
+    for ( std::size_t i = 0; i < references.size() && references[i].offset <= frame_start; ++i )
+    {
+      if ( references[i].offset > position )
+        sequence.push_back( boost::asio::buffer( &bytes[position], references[i].offset - position ) );
+      sequence.push_back( boost::asio::buffer( references[i].data, references[i].size ) );
+      position = references[i].offset;
+    }
+
+    if ( frame_start > position )
+      sequence.push_back( boost::asio::buffer( &bytes[position], frame_start - position ) );
+    return const_buffers( sequence.begin(), sequence.end() );
+  }
+
+  // Drops written frames and releases their references. With shrink the
+  // memory of large replies is given back.
+  void clear( bool shrink = false )
+  {
+    if ( shrink )
+      std::vector<uint8_t>().swap( bytes );
+    else
+      bytes.clear();
+
+    references.clear();
+    sequence.clear();
+    frame_start = 0U;
+    completed = 0U;
+    begin_frame();
+  }
+
+private:
+  struct reference
+  {
+    std::size_t offset;
+    const uint8_t* data;
+    uint32_t size;
+    boost::shared_ptr<void const> holder;
+  };
+
+  // Space for frame size is reserved ahead of the frame.
+  void begin_frame()
+  {
+    frame_start = bytes.size();
+    frame_references = 0U;
+    bytes.resize( frame_start + sizeof( uint32_t ) );
+  }
+
+  std::vector<uint8_t> bytes;
+  std::vector<reference> references;
+  std::vector<boost::asio::const_buffer> sequence;
+  std::size_t frame_start;
+  std::size_t frame_references;
+  std::size_t completed;
+};
+
+//  gather_transport_factory   -----------------------------------------------//
+// Output transport factory of the server, the underlying transport is not
+// used since the connection writes gather_transport itself.
+class gather_transport_factory : public apache::thrift::transport::TTransportFactory
+{
+public:
+  virtual boost::shared_ptr<apache::thrift::transport::TTransport> getTransport( boost::shared_ptr<apache::thrift::transport::TTransport> )
+  {
+    return boost::make_shared<gather_transport>();
+  }
+};
+
+// Writes binary value like out.writeBinary(). The data is referenced when
+// out is a TBinaryProtocol over gather_transport, whose encoding is the
+// length followed by the raw bytes, and copied by writeBinary() otherwise.
+// holder keeps data alive until the reply is written.
+inline uint32_t write_binary_reference
+(
+  apache::thrift::protocol::TProtocol& out,
+  const uint8_t* data,
+  uint32_t size,
+  boost::shared_ptr<void const> const& holder
+)
+{
+  gather_transport* gather = dynamic_cast<gather_transport*>( out.getTransport().get() );
+  const bool binary = dynamic_cast<apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TTransport>*>( &out )
+    || dynamic_cast<apache::thrift::protocol::TBinaryProtocolT<gather_transport>*>( &out );
+  if ( !gather || !binary )
+    return out.writeBinary( std::string( reinterpret_cast<const char*>( data ), size ) );
+
+  const uint32_t written = out.writeI32( static_cast<int32_t>( size ) );
+  gather->write_reference( data, size, holder );
+  return written + size;
+}
+
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_GATHER_TRANSPORT_HPP_
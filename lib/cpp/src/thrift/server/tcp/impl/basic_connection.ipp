@@ -25,12 +25,12 @@
 #include <thrift/config.hpp>
 #include <boost/assert.hpp>
 #include <boost/make_shared.hpp>
-#ifdef BOOST_NO_CXX11_LAMBDAS
-# include <boost/asio/placeholders.hpp>
-#endif
 #include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/completion_condition.hpp>
 #include <thrift/output_inserters.hpp>
+#include <cstring>
 
 namespace apache { namespace thrift { namespace server { namespace tcp {
 
@@ -47,9 +47,12 @@ template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
   template <class ServerReference, REQUIRES(which_server<ServerReference, detail::tcp_server_base>)>
 #endif
 BOOST_FORCEINLINE basic_connection<Stream, StreamTraits, HandlerPolicy>::basic_connection( boost::asio::io_service& io_service, ServerReference& serv ) :
-  HandlerPolicy( io_service ), wbuf( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ),
+  HandlerPolicy( io_service ), input( initial_input_size ), input_begin( 0U ), input_end( 0U ), turn_frames( 0U ),
+  turn_bytes( 0U ), input_charged( 0U ), reply_charged( 0U ), wbuf( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ),
   rbuf( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ), socket( io_service ), server( serv ),
-  handle_request( server, rbuf, wbuf )
+  handle_request( server, rbuf, wbuf ), gather( handle_request.gather_output() ),
+  priorities( server.getMethodPriorities() ),
+  read_method( priorities ? new detail::method_reader( server.getInputProtocolFactory() ) : 0 )
 {}
 
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
@@ -59,15 +62,24 @@ template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
   template <class ServerReference, REQUIRES(which_server<ServerReference, detail::tls_server_base>)>
 #endif
 BOOST_FORCEINLINE basic_connection<Stream, StreamTraits, HandlerPolicy>::basic_connection( boost::asio::io_service& io_service, boost::asio::ssl::context& ctx, ServerReference& serv ) :
-  HandlerPolicy( io_service ), wbuf( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ),
+  HandlerPolicy( io_service ), input( initial_input_size ), input_begin( 0U ), input_end( 0U ), turn_frames( 0U ),
+  turn_bytes( 0U ), input_charged( 0U ), reply_charged( 0U ), wbuf( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ),
   rbuf( boost::make_shared<apache::thrift::transport::TMemoryBuffer>() ), socket( io_service, ctx ), server( serv ),
-  handle_request( server, rbuf, wbuf )
+  handle_request( server, rbuf, wbuf ), gather( handle_request.gather_output() ),
+  priorities( server.getMethodPriorities() ),
+  read_method( priorities ? new detail::method_reader( server.getInputProtocolFactory() ) : 0 )
 {}
 
 #ifdef REQUIRES
 # undef REQUIRES
 #endif
 
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+basic_connection<Stream, StreamTraits, HandlerPolicy>::~basic_connection()
+{
+  server.getMemoryBudget().release( input_charged + reply_charged );
+}
+
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
 BOOST_FORCEINLINE typename basic_connection<Stream, StreamTraits, HandlerPolicy>::socket_reference
 basic_connection<Stream, StreamTraits, HandlerPolicy>::get_socket()
@@ -82,236 +94,308 @@ basic_connection<Stream, StreamTraits, HandlerPolicy>::get_stream()
   return socket;
 }
 
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE typename detail::server_type<basic_connection<Stream, StreamTraits, HandlerPolicy> >::reference_type
+basic_connection<Stream, StreamTraits, HandlerPolicy>::get_server()
+{
+  return server;
+}
+
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
 void basic_connection<Stream, StreamTraits, HandlerPolicy>::set_socket_options()
 {
-  get_socket().set_option(boost::asio::ip::tcp::socket::linger(false, 0));
-  get_socket().set_option(boost::asio::ip::tcp::socket::keep_alive(true));
-  get_socket().set_option(boost::asio::ip::tcp::no_delay(true));
+  server.getSocketOptions().apply( get_socket() );
 }
 
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::process() try
+void basic_connection<Stream, StreamTraits, HandlerPolicy>::run()
 {
-  handle_request();
+  detail::connection_loop<basic_connection> loop( this->shared_from_this() );
+  loop();
+}
 
-  // schedule sending reply from outputTransport
-  write_reply();
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE boost::asio::const_buffers_1 basic_connection<Stream, StreamTraits, HandlerPolicy>::reply_buffer()
+{
+#ifdef BOOST_NO_CXX11_NULLPTR
+  uint8_t* buffer = 0;
+#else
+  uint8_t* buffer = nullptr;
+#endif
+  uint32_t length = 0U;
+  wbuf->getBuffer(&buffer, &length);
+  return boost::asio::buffer(static_cast<const void*>(buffer), length);
 }
-// If an error occurs then no new asynchronous operations are started. This
-// means that all shared_ptr references to the connection object will
-// disappear and the object will be destroyed automatically after this
-// handler returns. The connection class's destructor closes the socket.
-catch ( apache::thrift::transport::TTransportException const& ttx )
+
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE std::size_t basic_connection<Stream, StreamTraits, HandlerPolicy>::buffered_frame() const
 {
-  apache::thrift::GlobalOutput.printf("Server transport error in process(): %s", ttx.what() );
+  const std::size_t buffered = input_end - input_begin;
+  if ( buffered < sizeof( uint32_t ) )
+    return 0U;
+
+  uint32_t frame_size;
+  std::memcpy( &frame_size, &input[input_begin], sizeof( frame_size ) );
+  const std::size_t length = sizeof( frame_size ) + ntohl( frame_size );
+  return buffered < length ? 0U : length;
 }
-catch ( std::exception const& x )
+
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE std::size_t basic_connection<Stream, StreamTraits, HandlerPolicy>::missing_input() const
 {
-  apache::thrift::GlobalOutput.printf( "Server::process() uncaught exception: %s: %s", typeid(x).name(), x.what() );
+  const std::size_t buffered = input_end - input_begin;
+  if ( buffered < sizeof( uint32_t ) )
+    return sizeof( uint32_t ) - buffered;
+
+  uint32_t frame_size;
+  std::memcpy( &frame_size, &input[input_begin], sizeof( frame_size ) );
+  return sizeof( frame_size ) + ntohl( frame_size ) - buffered;
 }
-catch ( ... )
+
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+bool basic_connection<Stream, StreamTraits, HandlerPolicy>::oversized_frame() const
 {
-  apache::thrift::GlobalOutput.printf( "Server::process() unknown exception" );
+  const std::size_t limit = server.getMaxFrameSize();
+  if ( !limit || input_end - input_begin < sizeof( uint32_t ) )
+    return false;
+
+  uint32_t frame_size;
+  std::memcpy( &frame_size, &input[input_begin], sizeof( frame_size ) );
+  if ( ntohl( frame_size ) <= limit )
+    return false;
+
+  apache::thrift::GlobalOutput.printf( "Server connection closed, frame of %u bytes is above the limit of %lu bytes",
+    ntohl( frame_size ), static_cast<unsigned long>( limit ) );
+  return true;
 }
 
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::read_frame_size()
+bool basic_connection<Stream, StreamTraits, HandlerPolicy>::reserve_input( std::size_t missing )
 {
-#ifndef BOOST_NO_CXX11_AUTO_DECLARATIONS
-  const auto len = sizeof( uint32_t );
-  auto buff = rbuf->getWritePtr( len );
-#else
-  const uint32_t len = sizeof( uint32_t );
-  uint8_t* buff = rbuf->getWritePtr( len );
-#endif
-  BOOST_ASSERT( buff );
+  memory_budget& budget = server.getMemoryBudget();
+  if ( input_begin == input_end )
+  {
+    input_begin = input_end = 0U;
+    // give memory of large frames back when it is limited
+    if ( input_charged && budget.limit() )
+    {
+      std::vector<uint8_t>( initial_input_size ).swap( input );
+      budget.release( input_charged );
+      input_charged = 0U;
+    }
+  }
+  // move the incomplete frame to the front
+  else if ( input_begin && input.size() - input_end < missing )
+  {
+    std::memmove( &input[0], &input[input_begin], input_end - input_begin );
+    input_end -= input_begin;
+    input_begin = 0U;
+  }
 
-#ifndef BOOST_NO_CXX11_LAMBDAS
-  auto client = this->shared_from_this();
+  if ( input.size() - input_end < missing )
+  {
+    const std::size_t growth = input_end + missing - input.size();
+    if ( !budget.try_acquire( growth ) )
+      return false;
 
-  boost::asio::async_read( socket, boost::asio::buffer(buff, len), this->safe_handler( [ client, buff ]( boost::system::error_code const& error,
-    std::size_t bytes_transferred ){
-      if ( !error )
-      {
-        // obtain the frame size
-        uint32_t frame_size = *static_cast<const uint32_t*>(static_cast<void*>(buff));
-        frame_size = ntohl( frame_size );
+    input_charged += growth;
+    input.resize( input_end + missing );
+  }
+  return true;
+}
 
-        client->rbuf->wroteBytes( bytes_transferred );
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE boost::asio::mutable_buffers_1 basic_connection<Stream, StreamTraits, HandlerPolicy>::input_buffer()
+{
+  return boost::asio::buffer( &input[input_end], input.size() - input_end );
+}
 
-        client->read_frame( frame_size );
-      }
-      // If an error occurs then no new asynchronous operations are started. This
-      // means that all shared_ptr references to the connection object will
-      // disappear and the object will be destroyed automatically after this
-      // handler returns. The connection class's destructor closes the socket.
-      //else
-      //{
-      //  apache::thrift::GlobalOutput << error;
-      //}
-  } ));
-#else
-  boost::asio::async_read( socket, boost::asio::buffer(buff, len)
-      , this->safe_handler(
-       boost::bind( &basic_connection::handle_read_frame_size, this->shared_from_this(), buff
-      , boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred
-       )
-    )
-  );
-#endif
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE std::size_t basic_connection<Stream, StreamTraits, HandlerPolicy>::reply_size() const
+{
+  return gather ? gather->size() : wbuf->available_read();
 }
 
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::read_frame( std::size_t frame_size )
+BOOST_FORCEINLINE void basic_connection<Stream, StreamTraits, HandlerPolicy>::charge_reply()
 {
-#ifndef BOOST_NO_CXX11_AUTO_DECLARATIONS
-  auto buff = rbuf->getWritePtr( frame_size );
-#else
-  uint8_t* buff = rbuf->getWritePtr( frame_size );
-#endif
-  BOOST_ASSERT( buff );
+  // only bytes held by the connection above the initial size of wbuf count,
+  // referenced application buffers are not
+  const std::size_t length = gather ? gather->buffered_size() : wbuf->available_read();
+  if ( length > apache::thrift::transport::TMemoryBuffer::defaultSize )
+  {
+    reply_charged = length - apache::thrift::transport::TMemoryBuffer::defaultSize;
+    server.getMemoryBudget().acquire( reply_charged );
+  }
+}
 
-#ifndef BOOST_NO_CXX11_LAMBDAS
-  auto client = this->shared_from_this();
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+BOOST_FORCEINLINE void basic_connection<Stream, StreamTraits, HandlerPolicy>::reply_written()
+{
+  memory_budget& budget = server.getMemoryBudget();
+  const bool shrink = reply_charged && budget.limit();
+  if ( gather )
+    gather->clear( shrink );
+  else if ( shrink )
+    wbuf->resetBuffer( apache::thrift::transport::TMemoryBuffer::defaultSize );
+  else
+    wbuf->resetBuffer();
 
-  boost::asio::async_read(socket, boost::asio::buffer(buff, frame_size),
-   this->safe_handler( [client]( boost::system::error_code const& error, std::size_t bytes_transferred ){
-      if ( !error )
-      {
-        client->rbuf->wroteBytes( bytes_transferred );
-        client->process();
-      }
-      // If an error occurs then no new asynchronous operations are started. This
-      // means that all shared_ptr references to the connection object will
-      // disappear and the object will be destroyed automatically after this
-      // handler returns. The connection class's destructor closes the socket.
-      else
-      {
-        apache::thrift::GlobalOutput << error;
-      }
-  } ));
-#else
-  boost::asio::async_read(socket, boost::asio::buffer(buff, frame_size),
-    this->safe_handler( boost::bind( &basic_connection::handle_read_frame, this->shared_from_this()
-    , boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred ) ));
-#endif
+  budget.release( reply_charged );
+  reply_charged = 0U;
 }
 
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::write_reply()
+BOOST_FORCEINLINE void basic_connection<Stream, StreamTraits, HandlerPolicy>::take_frame()
 {
-  if ( wbuf->available_read() )
-  {
-    uint8_t* buffer = nullptr;
-    uint32_t length = 0U;
-    wbuf->getBuffer(&buffer, &length);
-
-#ifndef BOOST_NO_CXX11_LAMBDAS
-    auto client = this->shared_from_this();
-    boost::asio::async_write( socket, boost::asio::buffer(buffer, length),
-     this->safe_handler( [client]( boost::system::error_code const& error, std::size_t /*bytes_transferred*/ ) {
-        if ( !error )
-        {
-          client->rbuf->resetBuffer();
-          client->wbuf->resetBuffer();
-
-          client->read_frame_size();
-        }
-
-        // If an error occurs then no new asynchronous operations are started. This
-        // means that all shared_ptr references to the connection object will
-        // disappear and the object will be destroyed automatically after this
-        // handler returns. The connection class's destructor closes the socket.
-        else
-        {
-          apache::thrift::GlobalOutput << error;
-        }
-    } ));
-#else
-boost::asio::async_write( socket, boost::asio::buffer(buffer, length),
-     this->safe_handler( boost::bind( &basic_connection::handle_write_reply, this->shared_from_this()
-    , boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred ) ) );
-#endif
-  }
+  const std::size_t length = buffered_frame();
+  // rbuf only observes input, the frame stays in place until next read
+  rbuf->resetBuffer( &input[input_begin], static_cast<uint32_t>( length ) );
+  input_begin += length;
+  ++turn_frames;
+  turn_bytes += length;
 }
 
-#ifdef BOOST_NO_CXX11_LAMBDAS
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::handle_read_frame_size
-(
-  uint8_t* buff, 
-  boost::system::error_code const& error,
-  std::size_t bytes_transferred
-)
+BOOST_FORCEINLINE bool basic_connection<Stream, StreamTraits, HandlerPolicy>::within_budget() const
 {
-  if ( !error )
-  {
-    // obtain the frame size
-    uint32_t frame_size = *static_cast<const uint32_t*>(static_cast<void*>(buff));
-    frame_size = ntohl( frame_size );
+  const std::size_t frames = server.getConnectionFrameBudget();
+  const std::size_t bytes = server.getConnectionByteBudget();
+  return ( !frames || turn_frames < frames ) && ( !bytes || turn_bytes < bytes );
+}
 
-    rbuf->wroteBytes( bytes_transferred );
+template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
+template <class Handler>
+void basic_connection<Stream, StreamTraits, HandlerPolicy>::schedule( Handler handler )
+{
+  BOOST_ASSERT( read_method );
+#ifdef BOOST_NO_CXX11_NULLPTR
+  uint8_t* frame = 0;
+#else
+  uint8_t* frame = nullptr;
+#endif
+  uint32_t length = 0U;
+  rbuf->getBuffer( &frame, &length );
 
-    read_frame( frame_size );
-  }
-  // If an error occurs then no new asynchronous operations are started. This
-  // means that all shared_ptr references to the connection object will
-  // disappear and the object will be destroyed automatically after this
-  // handler returns. The connection class's destructor closes the socket.
-  //else
-  //{
-  //  apache::thrift::GlobalOutput << error;
-  //}
+  // skip the frame size
+  std::string const& method = ( *read_method )( frame + sizeof( uint32_t ), length - sizeof( uint32_t ) );
+
+  boost::asio::io_service& io_service = get_socket().get_io_service();
+  boost::asio::use_service<detail::priority_scheduler>( io_service ).post( *priorities, priorities->classify( method ), handler );
 }
 
 template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::handle_read_frame
+void basic_connection<Stream, StreamTraits, HandlerPolicy>::resume
 (
+  detail::connection_loop<basic_connection>& loop,
   boost::system::error_code const& error,
   std::size_t bytes_transferred
-)
+) try
 {
-  if ( !error )
-  {
-    rbuf->wroteBytes( bytes_transferred );
-    process();
-  }
   // If an error occurs then no new asynchronous operations are started. This
   // means that all shared_ptr references to the connection object will
   // disappear and the object will be destroyed automatically after this
   // handler returns. The connection class's destructor closes the socket.
-  else
+  if ( error )
   {
-    apache::thrift::GlobalOutput << error;
+    // closing connection between frames is not an error
+    if ( input_begin != input_end )
+      apache::thrift::GlobalOutput << error;
+    return;
   }
-}
 
-template <class Stream, template<class> class StreamTraits, class HandlerPolicy>
-void basic_connection<Stream, StreamTraits, HandlerPolicy>::handle_write_reply
-(
-  boost::system::error_code const& error,
-  std::size_t bytes_transferred
-)
-{
-  if ( !error )
+  // Once an operation is started the connection may be resumed on another
+  // thread, so after each yield only the coroutine state of the current
+  // handler is accessed.
+  BOOST_ASIO_CORO_REENTER( loop ) for (;;)
   {
-    rbuf->resetBuffer();
-    wbuf->resetBuffer();
+    // Serve frames already received, one read may bring several pipelined
+    // ones. Their replies are gathered in wbuf and written at once.
+    while ( buffered_frame() && within_budget() )
+    {
+      if ( oversized_frame() )
+        return;
+      take_frame();
+
+      // Requests of all connections sharing the io_service are executed by
+      // priority of their methods.
+      if ( read_method )
+      {
+        BOOST_ASIO_CORO_YIELD schedule( this->safe_handler( loop.next() ) );
+      }
 
-    read_frame_size();
-  }
+      if ( handle_request.is_async() )
+      {
+        // Processor may complete on its own thread, the loop is resumed on the
+        // connection's io_service. No I/O thread is held meanwhile.
+        BOOST_ASIO_CORO_YIELD handle_request( detail::make_posted_completion( get_socket().get_io_service(),
+          this->safe_handler( loop.next() ) ) );
+      }
+      else
+      {
+        handle_request();
+      }
+    }
+
+    // Every completion below goes through the io_service queue, which ends
+    // the turn of this connection.
+    turn_frames = turn_bytes = 0U;
+
+    // oneway requests have no reply
+    if ( reply_size() )
+    {
+      charge_reply();
+      // referenced application buffers are sent without copying
+      if ( gather )
+      {
+        BOOST_ASIO_CORO_YIELD this->async_write_stream( gather->buffers(), this->safe_handler( loop.next() ) );
+      }
+      else
+      {
+        BOOST_ASIO_CORO_YIELD this->async_write_stream( reply_buffer(), this->safe_handler( loop.next() ) );
+      }
 
-  // If an error occurs then no new asynchronous operations are started. This
-  // means that all shared_ptr references to the connection object will
-  // disappear and the object will be destroyed automatically after this
-  // handler returns. The connection class's destructor closes the socket.
-  else
-  {
-    apache::thrift::GlobalOutput << error;
+      reply_written();
+    }
+    // budget is spent on requests without reply, let the others run
+    else if ( buffered_frame() )
+    {
+      BOOST_ASIO_CORO_YIELD get_socket().get_io_service().post( this->safe_handler( loop.next() ) );
+    }
+
+    if ( !buffered_frame() )
+    {
+      // The size of a frame is checked before any memory is reserved for it.
+      if ( oversized_frame() )
+        return;
+
+      // Large frame is not read until memory budget has room for it.
+      while ( !reserve_input( missing_input() ) )
+      {
+        BOOST_ASIO_CORO_YIELD server.getMemoryBudget().async_wait( missing_input(),
+          get_socket().get_io_service(), this->safe_handler( loop.next() ) );
+      }
+
+      BOOST_ASIO_CORO_YIELD this->async_read_stream( input_buffer(), boost::asio::transfer_at_least( missing_input() ),
+        this->safe_handler( loop.next() ) );
+
+      input_end += bytes_transferred;
+      server.getSocketOptions().refresh( get_socket() );
+    }
   }
 }
-#endif
+catch ( apache::thrift::transport::TTransportException const& ttx )
+{
+  apache::thrift::GlobalOutput.printf("Server transport error in process(): %s", ttx.what() );
+}
+catch ( std::exception const& x )
+{
+  apache::thrift::GlobalOutput.printf( "Server::process() uncaught exception: %s: %s", typeid(x).name(), x.what() );
+}
+catch ( ... )
+{
+  apache::thrift::GlobalOutput.printf( "Server::process() unknown exception" );
+}
 
 } // namespace tcp
 } // namespace server
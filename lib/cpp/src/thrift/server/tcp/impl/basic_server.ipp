@@ -43,18 +43,14 @@ basic_server<Connection, IOServingPolicy>::basic_server
   const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
   const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
   std::string const& address,
-  std::string const& port
+  std::string const& port,
+  socket_options const& options
 ) try : inherited( processor ), acceptor( get_io_service() )
 {
   STATIC_ASSERT( !detail::is_concurrent_io_serving_policy<IOServingPolicy>::value,
    "This ctor is only acceptable for IOServingPolicy that does not support multithreading. Use appropriate ctor." );
 
-  this->setInputTransportFactory( transportFactory );
-  this->setOutputTransportFactory( transportFactory );
-  this->setInputProtocolFactory( protocolFactory );
-  this->setOutputProtocolFactory( protocolFactory );
-
-  start_listen(address, port);
+  init(transportFactory, protocolFactory, address, port, options);
 }
 catch ( boost::system::system_error& err )
 {
@@ -69,18 +65,57 @@ basic_server<Connection, IOServingPolicy>::basic_server
   const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
   std::string const& address,
   std::string const& port,
-  std::size_t num_threads
+  std::size_t num_threads,
+  socket_options const& options
 ) try : inherited( processor ), IOServingPolicy( num_threads ), acceptor( get_io_service() )
 {
   STATIC_ASSERT( detail::is_concurrent_io_serving_policy<IOServingPolicy>::value,
    "This ctor is only acceptable for IOServingPolicy that does support multithreading. Use appropriate ctor." );
 
-  this->setInputTransportFactory( transportFactory );
-  this->setOutputTransportFactory( transportFactory );
-  this->setInputProtocolFactory( protocolFactory );
-  this->setOutputProtocolFactory( protocolFactory );
+  init(transportFactory, protocolFactory, address, port, options);
+}
+catch ( boost::system::system_error& err )
+{
+  BOOST_THROW_EXCEPTION( apache::thrift::transport::TTransportException( apache::thrift::transport::TTransportException::INTERNAL_ERROR, err.what() ) );
+}
 
-  start_listen(address, port);
+template <class Connection, class IOServingPolicy>
+basic_server<Connection, IOServingPolicy>::basic_server
+(
+  const boost::shared_ptr<apache::thrift::async::TAsyncProcessor>& processor,
+  const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
+  const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
+  std::string const& address,
+  std::string const& port,
+  socket_options const& options
+) try : inherited( processor ), acceptor( get_io_service() )
+{
+  STATIC_ASSERT( !detail::is_concurrent_io_serving_policy<IOServingPolicy>::value,
+   "This ctor is only acceptable for IOServingPolicy that does not support multithreading. Use appropriate ctor." );
+
+  init(transportFactory, protocolFactory, address, port, options);
+}
+catch ( boost::system::system_error& err )
+{
+  BOOST_THROW_EXCEPTION( apache::thrift::transport::TTransportException( apache::thrift::transport::TTransportException::INTERNAL_ERROR, err.what() ) );
+}
+
+template <class Connection, class IOServingPolicy>
+basic_server<Connection, IOServingPolicy>::basic_server
+(
+  const boost::shared_ptr<apache::thrift::async::TAsyncProcessor>& processor,
+  const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
+  const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
+  std::string const& address,
+  std::string const& port,
+  std::size_t num_threads,
+  socket_options const& options
+) try : inherited( processor ), IOServingPolicy( num_threads ), acceptor( get_io_service() )
+{
+  STATIC_ASSERT( detail::is_concurrent_io_serving_policy<IOServingPolicy>::value,
+   "This ctor is only acceptable for IOServingPolicy that does support multithreading. Use appropriate ctor." );
+
+  init(transportFactory, protocolFactory, address, port, options);
 }
 catch ( boost::system::system_error& err )
 {
@@ -89,6 +124,25 @@ catch ( boost::system::system_error& err )
 
 #undef STATIC_ASSERT
 
+template <class Connection, class IOServingPolicy>
+void basic_server<Connection, IOServingPolicy>::init
+(
+  const boost::shared_ptr<apache::thrift::transport::TTransportFactory>& transportFactory,
+  const boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>& protocolFactory,
+  std::string const& address,
+  std::string const& port,
+  socket_options const& options
+)
+{
+  this->setSocketOptions( options );
+  this->setInputTransportFactory( transportFactory );
+  this->setOutputTransportFactory( transportFactory );
+  this->setInputProtocolFactory( protocolFactory );
+  this->setOutputProtocolFactory( protocolFactory );
+
+  start_listen(address, port);
+}
+
 template <class Connection, class IOServingPolicy>
 void basic_server<Connection, IOServingPolicy>::start_listen(std::string const& address, std::string const& port)
 {
@@ -104,8 +158,9 @@ void basic_server<Connection, IOServingPolicy>::start_listen(std::string const&
     // Call succeeds only on dual stack systems.
   }
   acceptor.set_option( boost::asio::ip::tcp::acceptor::reuse_address(true) );
+  this->getSocketOptions().apply_listener( acceptor );
   acceptor.bind(endpoint);
-  acceptor.listen();
+  acceptor.listen( this->getSocketOptions().listen_backlog() );
 
   if ( this->eventHandler_ )
     this->eventHandler_->preServe();
@@ -159,7 +214,9 @@ template <class Connection, class IOServingPolicy>
 BOOST_FORCEINLINE void basic_server<Connection, IOServingPolicy>::start()
 {
   start_accept();
-  return IOServingPolicy::run_impl();
+  detail::serving_started( *this );
+  IOServingPolicy::run_impl();
+  detail::serving_stopped( *this );
 }
 
 template <class Connection, class IOServingPolicy>
@@ -174,6 +231,12 @@ void basic_server<Connection, IOServingPolicy>::stop()
   return IOServingPolicy::stop_impl();
 }
 
+template <class Connection, class IOServingPolicy>
+boost::asio::ip::tcp::endpoint basic_server<Connection, IOServingPolicy>::local_endpoint() const
+{
+  return acceptor.local_endpoint();
+}
+
 } // namespace tcp
 } // namespace server
 } // namespace thrift
@@ -0,0 +1,170 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_MEMORY_BUDGET_HPP_
+#define _THRIFT_SERVER_TCP_MEMORY_BUDGET_HPP_
+
+#include <thrift/config.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <utility>
+#include <vector>
+
+namespace apache { namespace thrift { namespace server { namespace tcp {
+
+//  memory_budget   -----------------------------------------------//
+// Server-wide limit of bytes held in connection buffers above their initial
+// size, i.e. by large frames and replies. A connection which cannot get
+// room for a large frame does not read it until other connections release
+// memory, small frames are read as usual. Frames larger than the whole
+// budget close their connection, see setMaxFrameSize(). Replies are already
+// produced when they are accounted, so they are charged even beyond the
+// limit.
+// used(), waiting() and exhausted() can be exported as metrics.
+class memory_budget : private boost::noncopyable
+{
+public:
+  // limit 0 means no limit, buffers are then not shrunk after large frames.
+  explicit memory_budget( std::size_t limit = 0U ) : limit_( limit ), used_( 0U ), waiting_( 0U )
+  {}
+
+  // Pending handlers own connections, which release memory when destroyed.
+  ~memory_budget()
+  {
+    std::vector<std::pair<boost::asio::io_service*, boost::function<void()> > > waiters;
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      waiters.swap( waiters_ );
+    }
+  }
+
+  // Must be set before the server starts serving.
+  void set_limit( std::size_t limit )
+  {
+    limit_ = limit;
+  }
+
+  std::size_t limit() const
+  {
+    return limit_;
+  }
+
+  // Bytes currently held.
+  std::size_t used() const
+  {
+    return used_.load();
+  }
+
+  // Connections waiting for memory to read a frame.
+  std::size_t waiting() const
+  {
+    return waiting_.load();
+  }
+
+  bool exhausted() const
+  {
+    return limit_ && used() >= limit_;
+  }
+
+  // Takes bytes if they fit in the budget.
+  bool try_acquire( std::size_t bytes )
+  {
+    std::size_t used = used_.load();
+    do
+    {
+      if ( limit_ && used + bytes > limit_ )
+        return false;
+    }
+    while ( !used_.compare_exchange_weak( used, used + bytes ) );
+    return true;
+  }
+
+  // Takes bytes regardless of the limit.
+  void acquire( std::size_t bytes )
+  {
+    used_.fetch_add( bytes );
+  }
+
+  void release( std::size_t bytes )
+  {
+    if ( !bytes )
+      return;
+
+    used_.fetch_sub( bytes );
+    if ( waiting_.load() )
+      wake_all();
+  }
+
+  // Posts handler to io_service once bytes may fit in the budget, handler
+  // has to try_acquire() them again.
+  template <class Handler>
+  void async_wait( std::size_t bytes, boost::asio::io_service& io_service, Handler handler )
+  {
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      ++waiting_;
+      if ( !fits( bytes ) )
+      {
+        waiters_.push_back( std::make_pair( &io_service, boost::function<void()>( handler ) ) );
+        return;
+      }
+      --waiting_;
+    }
+    io_service.post( handler );
+  }
+
+private:
+  bool fits( std::size_t bytes ) const
+  {
+    const std::size_t used = used_.load();
+    return !limit_ || used + bytes <= limit_;
+  }
+
+  void wake_all()
+  {
+    std::vector<std::pair<boost::asio::io_service*, boost::function<void()> > > waiters;
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      waiters.swap( waiters_ );
+      waiting_ -= waiters.size();
+    }
+
+    for ( std::size_t i = 0; i < waiters.size(); ++i )
+      waiters[i].first->post( waiters[i].second );
+  }
+
+  std::size_t limit_;
+  boost::atomic<std::size_t> used_;
+  boost::atomic<std::size_t> waiting_;
+  boost::mutex mutex_;
+  std::vector<std::pair<boost::asio::io_service*, boost::function<void()> > > waiters_;
+};
+
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_MEMORY_BUDGET_HPP_
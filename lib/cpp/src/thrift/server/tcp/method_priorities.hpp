@@ -0,0 +1,114 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_METHOD_PRIORITIES_HPP_
+#define _THRIFT_SERVER_TCP_METHOD_PRIORITIES_HPP_
+
+#include <thrift/config.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/unordered_map.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace server { namespace tcp {
+
+//  method_priorities   -----------------------------------------------//
+// Maps Thrift method names to priority classes, class 0 is the most urgent
+// one. When given to a server, the method name is peeked from every frame
+// and requests of all connections sharing an io_service are executed in
+// order of their classes, e.g. health checks go ahead of queued bulk writes.
+//
+// strict   - a request is executed only when no more urgent one is queued.
+// weighted - weighted fair queueing, each class gets share of executions
+//            proportional to its weight, so no class starves.
+class method_priorities
+{
+public:
+  enum policy_type { strict, weighted };
+
+  // Methods not mapped belong to the least urgent class.
+  explicit method_priorities( std::size_t classes = 2U, policy_type p = strict ) :
+    policy_( p ), weights_( classes ? classes : 1U, 1U ), default_class_( weights_.size() - 1U )
+  {}
+
+  method_priorities& map( std::string const& method, std::size_t priority_class )
+  {
+    check( priority_class );
+    methods_[method] = priority_class;
+    return *this;
+  }
+
+  method_priorities& default_class( std::size_t priority_class )
+  {
+    check( priority_class );
+    default_class_ = priority_class;
+    return *this;
+  }
+
+  // Share of the class under weighted policy.
+  method_priorities& weight( std::size_t priority_class, std::size_t w )
+  {
+    check( priority_class );
+    weights_[priority_class] = w ? w : 1U;
+    return *this;
+  }
+
+  std::size_t classify( std::string const& method ) const
+  {
+    boost::unordered_map<std::string, std::size_t>::const_iterator it = methods_.find( method );
+    return it == methods_.end() ? default_class_ : it->second;
+  }
+
+  std::size_t weight_of( std::size_t priority_class ) const
+  {
+    return weights_[priority_class];
+  }
+
+  std::size_t classes() const
+  {
+    return weights_.size();
+  }
+
+  policy_type policy() const
+  {
+    return policy_;
+  }
+
+private:
+  void check( std::size_t priority_class ) const
+  {
+    if ( priority_class >= weights_.size() )
+      BOOST_THROW_EXCEPTION( std::out_of_range( "method_priorities: no such priority class" ) );
+  }
+
+  policy_type policy_;
+  std::vector<std::size_t> weights_;
+  std::size_t default_class_;
+  boost::unordered_map<std::string, std::size_t> methods_;
+};
+
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_METHOD_PRIORITIES_HPP_
@@ -24,6 +24,9 @@
 
 #include <thrift/config.hpp>
 #include <thrift/server/TServer.h>
+#include <thrift/server/tcp/detail/helpers.hpp>
+#include <thrift/server/tcp/gather_transport.hpp>
+#include <boost/assert.hpp>
 
 namespace apache { namespace thrift { namespace server { namespace tcp {
 
@@ -31,10 +34,10 @@ struct request_handler
 {
   request_handler
   (
-    apache::thrift::server::TServer& server,
+    detail::tcp_server_base& server,
     boost::shared_ptr<apache::thrift::transport::TTransport> input,
     boost::shared_ptr<apache::thrift::transport::TTransport> output
-  ) : event_handler( server.getEventHandler() )
+  ) : event_handler( server.getEventHandler() ), async_processor( server.getAsyncProcessor() )
   {
     inputTransport = server.getInputTransportFactory()->getTransport( input );
     outputTransport = server.getOutputTransportFactory()->getTransport( output );
@@ -50,7 +53,20 @@ struct request_handler
       conn_ctx = nullptr;
 #endif
 
-    processor = get_processor( server, inputProtocol, outputProtocol, inputTransport );
+    if ( !async_processor )
+      processor = get_processor( server, inputProtocol, outputProtocol, inputTransport );
+  }
+
+  // Set when replies are written by gather_transport instead of output buffer.
+  boost::shared_ptr<gather_transport> gather_output() const
+  {
+    return boost::dynamic_pointer_cast<gather_transport>( outputTransport );
+  }
+
+  // Whether requests are processed by asynchronous processor.
+  bool is_async() const
+  {
+    return static_cast<bool>( async_processor );
   }
 
   void operator()()
@@ -61,6 +77,18 @@ struct request_handler
     processor->process( inputProtocol, outputProtocol, conn_ctx );
   }
 
+  // Hands request to asynchronous processor, completion is called with false
+  // when connection should be closed.
+  template <class Completion>
+  void operator()( Completion completion )
+  {
+    BOOST_ASSERT( async_processor );
+    if ( event_handler )
+      event_handler->processContext( conn_ctx, inputTransport );
+
+    async_processor->process( completion, inputProtocol, outputProtocol );
+  }
+
   ~request_handler()
   {
     if ( event_handler )
@@ -94,6 +122,7 @@ private:
   boost::shared_ptr<apache::thrift::protocol::TProtocol> outputProtocol;
 
   boost::shared_ptr<apache::thrift::TProcessor> processor;
+  boost::shared_ptr<apache::thrift::async::TAsyncProcessor> async_processor;
   void* conn_ctx;
 };
 
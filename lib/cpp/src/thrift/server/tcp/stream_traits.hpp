@@ -25,11 +25,22 @@
 #include <thrift/config.hpp>
 #include <thrift/Thrift.h>
 #include <thrift/output_inserters.hpp>
+#include <thrift/server/tcp/tls/context.hpp>
+#include <thrift/server/tcp/tls/handshake_pool.hpp>
+#include <thrift/server/tcp/tls/record_size.hpp>
+#include <thrift/server/tcp/detail/socket_tls_stream.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/type_traits/add_lvalue_reference.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
+#ifdef BOOST_NO_CXX11_LAMBDAS
+# include <boost/bind.hpp>
+# include <boost/asio/placeholders.hpp>
+#endif
 
 namespace apache { namespace thrift { namespace server { namespace tcp {
 
@@ -60,7 +71,20 @@ struct stream_traits<boost::asio::ip::tcp::socket>
     void start()
     {
       self().set_socket_options();
-      self().read_frame_size();
+      self().run();
+    }
+
+    // Reads and writes of the connection loop.
+    template <class MutableBufferSequence, class CompletionCondition, class Handler>
+    void async_read_stream(MutableBufferSequence const& buffers, CompletionCondition condition, Handler handler)
+    {
+      boost::asio::async_read(self().get_stream(), buffers, condition, handler);
+    }
+
+    template <class ConstBufferSequence, class Handler>
+    void async_write_stream(ConstBufferSequence const& buffers, Handler handler)
+    {
+      boost::asio::async_write(self().get_stream(), buffers, handler);
     }
 
     // Implementation of connection factory method.
@@ -97,45 +121,118 @@ struct stream_traits<boost::asio::ssl::stream<Stream> >
     typedef detail::tls_server_base server_type;
     typedef boost::shared_ptr<Host> pointer_type;
 
-    // Implementation of connection factory method.
+    // Implementation of connection factory method. The stream is created
+    // with the context current before the connection is accepted.
     static pointer_type create(boost::asio::io_service& io_service, server_type& server)
     {
-      return boost::make_shared<Host>(boost::ref(io_service), boost::ref(server.get_handle()), boost::ref(server));
+      boost::shared_ptr<tls::context> context = server.snapshot();
+      pointer_type connection = boost::make_shared<Host>(boost::ref(io_service), boost::ref(context->get_handle()), boost::ref(server));
+      static_cast<Impl&>(*connection).created_context = context;
+      return connection;
     }
 
-    // Starts logic after connection has been established.
+    // Starts logic after connection has been established. The connection
+    // is served with the context current once it is accepted, so reload()
+    // does not affect it afterwards.
     void start()
     {
       self().set_socket_options();
+      try
+      {
+        tls_context = self().get_server().snapshot();
+        tls_context->adopt(self().get_stream().native_handle());
+        records.set_policy(tls_context->record_size());
+
+        // OpenSSL does I/O of the connection itself to offload it to kTLS
+        if ( tls_context->kernel_tls() )
+        {
+          tls_context->attach_socket(self().get_stream().native_handle(),
+            static_cast<int>(self().get_socket().native_handle()));
+          socket_tls.reset(new detail::socket_tls_stream(self().get_stream().next_layer(), self().get_stream().native_handle()));
+        }
+      }
+      catch ( std::exception const& e )
+      {
+        apache::thrift::GlobalOutput( e.what() );
+        return;
+      }
 
 #ifndef BOOST_NO_CXX11_LAMBDAS
       auto client = self().shared_from_this();
-      self().get_stream().async_handshake(boost::asio::ssl::stream_base::server, self().safe_handler([ client ]( boost::system::error_code const& error ){
+      handshake([ client ]( boost::system::error_code const& error ){
         if ( !error )
         {
-          client->read_frame_size();
+          client->run();
         }
         else
         {
           apache::thrift::GlobalOutput << error;
         }
-      } ));
+      } );
 #else
-      self().get_stream().async_handshake(boost::asio::ssl::stream_base::server, boost::bind(&Impl::handle_handshake,
-          self().shared_from_this(), boost::asio::placeholders::error));
+      handshake(boost::bind(&Impl::handle_handshake, self().shared_from_this(), boost::asio::placeholders::error));
 #endif
     }
 
+    // Reads and writes of the connection loop.
+    template <class MutableBufferSequence, class CompletionCondition, class Handler>
+    void async_read_stream(MutableBufferSequence const& buffers, CompletionCondition condition, Handler handler)
+    {
+      if ( socket_tls )
+        boost::asio::async_read(*socket_tls, buffers, condition, handler);
+      else
+        boost::asio::async_read(self().get_stream(), buffers, condition, handler);
+    }
+
+    template <class ConstBufferSequence, class Handler>
+    void async_write_stream(ConstBufferSequence const& buffers, Handler handler)
+    {
+      if ( records.enabled() )
+      {
+        records.begin_write();
+        tls::record_size_condition condition(records, self().get_stream().native_handle());
+        if ( socket_tls )
+          boost::asio::async_write(*socket_tls, buffers, condition, handler);
+        else
+          boost::asio::async_write(self().get_stream(), buffers, condition, handler);
+      }
+      else if ( socket_tls )
+        boost::asio::async_write(*socket_tls, buffers, handler);
+      else
+        boost::asio::async_write(self().get_stream(), buffers, handler);
+    }
+
   private:
     Host& self() {
       return static_cast<Host&>(*this);
     }
+
+    template <class Handler>
+    void handshake(Handler handler)
+    {
+      if ( socket_tls )
+        handshake(*socket_tls, detail::socket_tls_stream::server, handler);
+      else
+        handshake(self().get_stream(), boost::asio::ssl::stream_base::server, handler);
+    }
+
+    // Runs the handshake on handshake pool of the server if it has one, the
+    // handler is then posted back to io_service of the connection.
+    template <class TlsStream, class HandshakeType, class Handler>
+    void handshake(TlsStream& stream, HandshakeType type, Handler handler)
+    {
+      tls::handshake_pool& pool = self().get_server().getHandshakePool();
+      if ( pool.running() )
+        stream.async_handshake(type, pool.wrap(self().get_socket().get_io_service(), self().safe_handler(handler)));
+      else
+        stream.async_handshake(type, self().safe_handler(handler));
+    }
 #ifdef BOOST_NO_CXX11_LAMBDAS
     void handle_handshake(const boost::system::error_code& error)
     {
       if ( !error )
       {
-        self().read_frame_size();
+        self().run();
       }
       else
       {
@@ -143,6 +240,16 @@ struct stream_traits<boost::asio::ssl::stream<Stream> >
       }
     }
 #endif
+
+    // Record sizes of replies.
+    tls::record_sizer records;
+    // Set when the server uses kernel TLS.
+    boost::scoped_ptr<detail::socket_tls_stream> socket_tls;
+    // Context the connection is served with.
+    boost::shared_ptr<tls::context> tls_context;
+    // Context the stream was created with, destroyed after the stream which
+    // refers to it.
+    boost::shared_ptr<tls::context> created_context;
   };
 
 };
@@ -30,6 +30,7 @@ namespace tls {
 
 typedef basic_connection<boost::asio::ssl::stream<boost::asio::ip::tcp::socket> > connection;
 typedef basic_connection<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>, stream_traits, detail::concurrent_handler_execution_policy> concurrent_connection;
+typedef basic_connection<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>, stream_traits, detail::serialized_handler_execution_policy> serialized_connection;
 
 } // namespace tls
 } // namespace tcp
@@ -21,9 +21,24 @@
 
 #include <sstream>
 #include <thrift/server/tcp/tls/context.hpp>
+#include <thrift/server/tcp/tls/record_size.hpp>
 #include <thrift/transport/TTransportException.h>
 #include <boost/asio/ssl/context.hpp>
+#include <boost/atomic.hpp>
 #include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <openssl/rand.h>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/core_names.h>
+#else
+#  include <openssl/hmac.h>
+#endif
 
 #ifndef BOOST_NO_CXX11_HDR_ARRAY
 #  include <array>
@@ -49,7 +64,7 @@ namespace {
       s << "-Error with certificate at depth: " << depth;
 
 #ifndef BOOST_NO_CXX11_HDR_ARRAY
-      using std::array
+      using std::array;
 #else
       using boost::array;
 #endif
@@ -64,21 +79,51 @@ namespace {
 
     return preverified;
   }
+
+  // Index of context_impl_ in SSL_CTX ex_data, app_data is taken by asio.
+  int context_index()
+  {
+    static const int index = SSL_CTX_get_ex_new_index( 0, 0, 0, 0, 0 );
+    return index;
+  }
+
+  // Index of peer name in SSL ex_data of client connections.
+  int peer_index()
+  {
+    static const int index = SSL_get_ex_new_index( 0, 0, 0, 0, 0 );
+    return index;
+  }
+
+  // Session id context is required for resumption when peer is verified.
+  const unsigned char session_id_context[] = "thrift";
 }
 
 namespace apache { namespace thrift { namespace server { namespace tcp { namespace tls {
 
 struct context::context_impl_ : private boost::noncopyable
 {
+  ~context_impl_()
+  {
+    for ( std::map<std::string, SSL_SESSION*>::iterator it = sessions.begin(); it != sessions.end(); ++it )
+      SSL_SESSION_free( it->second );
+  }
+
 private:
   friend struct context;
-  context_impl_() : ctx(boost::asio::ssl::context::sslv23)
+  context_impl_() : ctx(boost::asio::ssl::context::sslv23), ktls(false)
   {
     ctx.set_options(boost::asio::ssl::context_base::default_workarounds | boost::asio::ssl::context_base::no_sslv2 | boost::asio::ssl::context_base::single_dh_use );
     ctx.set_verify_mode(boost::asio::ssl::verify_peer);
     ctx.set_verify_callback( verify_cert );
+
+    SSL_CTX* handle = ctx.native_handle();
+    SSL_CTX_set_ex_data( handle, context_index(), this );
+    SSL_CTX_set_session_id_context( handle, session_id_context, sizeof( session_id_context ) - 1 );
+    SSL_CTX_set_session_cache_mode( handle, SSL_SESS_CACHE_BOTH );
+    SSL_CTX_sess_set_new_cb( handle, &context_impl_::new_session );
   }
 
+
   operator boost::asio::ssl::context&()
   {
     return ctx;
@@ -141,64 +186,396 @@ private:
 #endif
     if ( 1 != ret )
       BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException("SSL_CTX_set_cipher_list error."));
+    cipher_list = ciphers;
+  }
+
+  void session_cache(std::size_t size, long timeout_seconds)
+  {
+    SSL_CTX* handle = ctx.native_handle();
+    if ( !size )
+    {
+      SSL_CTX_set_session_cache_mode( handle, SSL_SESS_CACHE_CLIENT );
+      return;
+    }
+
+    SSL_CTX_set_session_cache_mode( handle, SSL_SESS_CACHE_BOTH );
+    SSL_CTX_sess_set_cache_size( handle, static_cast<long>( size ) );
+    SSL_CTX_set_timeout( handle, timeout_seconds );
+  }
+
+  void session_ticket_key(std::string const& key)
+  {
+    if ( key.size() != sizeof( ticket_key ) )
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException("Session ticket key must have 48 bytes."));
+
+    ticket_key k;
+    std::memcpy( &k, key.data(), sizeof( k ) );
+    {
+      boost::lock_guard<boost::mutex> lock( ticket_mutex );
+      ticket_keys.insert( ticket_keys.begin(), k );
+      if ( ticket_keys.size() > 2U )
+        ticket_keys.pop_back();
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb( ctx.native_handle(), &context_impl_::ticket_key_callback );
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb( ctx.native_handle(), &context_impl_::ticket_key_callback );
+#endif
+  }
+
+  void rotate_session_ticket_key()
+  {
+    std::string key( sizeof( ticket_key ), '\0' );
+    if ( 1 != RAND_bytes( reinterpret_cast<unsigned char*>( &key[0] ), static_cast<int>( key.size() ) ) )
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException("RAND_bytes error."));
+    session_ticket_key( key );
+  }
+
+  void resume_session(SSL* ssl, std::string const& peer)
+  {
+    SSL_set_ex_data( ssl, peer_index(), const_cast<std::string*>( &peer ) );
+
+    boost::lock_guard<boost::mutex> lock( session_mutex );
+    std::map<std::string, SSL_SESSION*>::const_iterator it = sessions.find( peer );
+    if ( it != sessions.end() )
+      SSL_set_session( ssl, it->second );
+  }
+
+  void keep_session(SSL* ssl)
+  {
+    // TLS 1.2 reports only new sessions, a ticket renewed by resumption
+    // comes with a copy of the session that has to replace the cached one.
+    if ( !SSL_session_reused( ssl ) )
+      return;
+    SSL_SESSION* session = SSL_get1_session( ssl );
+    if ( session && !new_session( ssl, session ) )
+      SSL_SESSION_free( session );
+  }
+
+  // Takes ticket keys of the context replaced by reload unless it has own
+  void inherit_ticket_keys(context_impl_& previous)
+  {
+    std::vector<ticket_key> keys;
+    {
+      boost::lock_guard<boost::mutex> lock( previous.ticket_mutex );
+      keys = previous.ticket_keys;
+    }
+    if ( keys.empty() )
+      return;
+
+    {
+      boost::lock_guard<boost::mutex> lock( ticket_mutex );
+      if ( !ticket_keys.empty() )
+        return;
+      ticket_keys.swap( keys );
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb( ctx.native_handle(), &context_impl_::ticket_key_callback );
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb( ctx.native_handle(), &context_impl_::ticket_key_callback );
+#endif
+  }
+
+  void attach_socket(SSL* ssl, int socket)
+  {
+#ifdef SSL_OP_ENABLE_KTLS
+    if ( ktls.load() )
+      SSL_set_options( ssl, SSL_OP_ENABLE_KTLS );
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // frames are sized, closing without TLS shutdown is no truncation
+    SSL_set_options( ssl, SSL_OP_IGNORE_UNEXPECTED_EOF );
+#endif
+    SSL_set_mode( ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER );
+    // the memory BIO of ssl is freed, asio frees its peer
+    if ( 1 != SSL_set_fd( ssl, socket ) )
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException("SSL_set_fd error."));
+  }
+
+  // SSL_set_SSL_CTX() takes certificate, key and session id context, the
+  // rest SSL_new() copied from the previous context is set here.
+  void adopt(SSL* ssl)
+  {
+    SSL_CTX* handle = ctx.native_handle();
+    if ( SSL_get_SSL_CTX( ssl ) == handle )
+      return;
+
+    if ( !SSL_set_SSL_CTX( ssl, handle ) )
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException("SSL_set_SSL_CTX error."));
+    SSL_clear_options( ssl, SSL_get_options( ssl ) );
+    SSL_set_options( ssl, SSL_CTX_get_options( handle ) );
+    SSL_set_verify( ssl, SSL_CTX_get_verify_mode( handle ), SSL_CTX_get_verify_callback( handle ) );
+    SSL_set_verify_depth( ssl, SSL_CTX_get_verify_depth( handle ) );
+    if ( !cipher_list.empty() && 1 != SSL_set_cipher_list( ssl, cipher_list.c_str() ) )
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException("SSL_set_cipher_list error."));
   }
 
   std::string get_passwd()
   {
     return pwd;
   }
+
+  struct ticket_key
+  {
+    unsigned char name[16];
+    unsigned char hmac[16];
+    unsigned char aes[16];
+  };
+
+  // Caches sessions issued to client connections, server connections have
+  // no peer and their sessions are kept by OpenSSL's cache.
+  static int new_session( SSL* ssl, SSL_SESSION* session )
+  {
+    std::string const* peer = static_cast<std::string const*>( SSL_get_ex_data( ssl, peer_index() ) );
+    context_impl_* self = static_cast<context_impl_*>( SSL_CTX_get_ex_data( SSL_get_SSL_CTX( ssl ), context_index() ) );
+    if ( !peer || !self )
+      return 0;
+
+    boost::lock_guard<boost::mutex> lock( self->session_mutex );
+    SSL_SESSION*& cached = self->sessions[*peer];
+    if ( cached )
+      SSL_SESSION_free( cached );
+    cached = session;
+    // reference to the session is taken over
+    return 1;
+  }
+
+  // Finds the key to issue (enc) or to decrypt a ticket with. Returns 0 if
+  // there is none, 2 if the ticket should be renewed with the current key.
+  int find_ticket_key( unsigned char* name, int enc, ticket_key& key )
+  {
+    boost::lock_guard<boost::mutex> lock( ticket_mutex );
+    if ( ticket_keys.empty() )
+      return 0;
+
+    if ( enc )
+    {
+      key = ticket_keys.front();
+      std::memcpy( name, key.name, sizeof( key.name ) );
+      return 1;
+    }
+
+    for ( std::size_t i = 0; i < ticket_keys.size(); ++i )
+    {
+      if ( 0 == std::memcmp( name, ticket_keys[i].name, sizeof( ticket_keys[i].name ) ) )
+      {
+        key = ticket_keys[i];
+        return i ? 2 : 1;
+      }
+    }
+    return 0;
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  static int ticket_key_callback( SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc )
+#else
+  static int ticket_key_callback( SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc )
+#endif
+  {
+    context_impl_* self = static_cast<context_impl_*>( SSL_CTX_get_ex_data( SSL_get_SSL_CTX( ssl ), context_index() ) );
+    ticket_key key;
+    int result = self ? self->find_ticket_key( name, enc, key ) : 0;
+    if ( !result )
+      return enc ? -1 : 0;
+#ifdef TLS1_3_VERSION
+    // TLS 1.3 clients use a ticket once, a resumed connection needs a new one
+    if ( !enc && SSL_version( ssl ) == TLS1_3_VERSION )
+      result = 2;
+#endif
+
+    if ( enc )
+    {
+      if ( 1 != RAND_bytes( iv, EVP_MAX_IV_LENGTH ) || 1 != EVP_EncryptInit_ex( cipher, EVP_aes_128_cbc(), 0, key.aes, iv ) )
+        return -1;
+    }
+    else if ( 1 != EVP_DecryptInit_ex( cipher, EVP_aes_128_cbc(), 0, key.aes, iv ) )
+    {
+      return -1;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] =
+    {
+      OSSL_PARAM_construct_octet_string( OSSL_MAC_PARAM_KEY, key.hmac, sizeof( key.hmac ) ),
+      OSSL_PARAM_construct_utf8_string( OSSL_MAC_PARAM_DIGEST, digest, 0 ),
+      OSSL_PARAM_construct_end()
+    };
+    if ( 1 != EVP_MAC_CTX_set_params( mac, params ) )
+      return -1;
+#else
+    if ( 1 != HMAC_Init_ex( mac, key.hmac, sizeof( key.hmac ), EVP_sha256(), 0 ) )
+      return -1;
+#endif
+    return result;
+  }
+
   std::string pwd;
+  std::string cipher_list;
   boost::asio::ssl::context ctx;
+  // settings may change while connections are created
+  boost::atomic<bool> ktls;
+  boost::mutex record_size_mutex;
+  record_size_policy record_size;
+
+  boost::mutex ticket_mutex;
+  // current key first, then the previous one
+  std::vector<ticket_key> ticket_keys;
+
+  boost::mutex session_mutex;
+  std::map<std::string, SSL_SESSION*> sessions;
 };
 
+void context::session_cache( std::size_t size, long timeout_seconds )
+{
+  return impl()->session_cache( size, timeout_seconds );
+}
+
+void context::session_ticket_key( std::string const& key )
+{
+  return impl()->session_ticket_key( key );
+}
+
+void context::rotate_session_ticket_key()
+{
+  return impl()->rotate_session_ticket_key();
+}
+
+void context::resume_session( ssl_st* ssl, std::string const& peer )
+{
+  return impl()->resume_session( ssl, peer );
+}
+
+void context::keep_session( ssl_st* ssl )
+{
+  return impl()->keep_session( ssl );
+}
+
+void context::kernel_tls( bool enable )
+{
+  impl()->ktls.store( enable );
+}
+
+bool context::kernel_tls() const
+{
+  return impl()->ktls.load();
+}
+
+void context::record_size( record_size_policy const& policy )
+{
+  boost::shared_ptr<context_impl_> p = impl();
+  boost::lock_guard<boost::mutex> lock( p->record_size_mutex );
+  p->record_size = policy;
+}
+
+record_size_policy context::record_size() const
+{
+  boost::shared_ptr<context_impl_> p = impl();
+  boost::lock_guard<boost::mutex> lock( p->record_size_mutex );
+  return p->record_size;
+}
+
+void context::attach_socket( ssl_st* ssl, int socket )
+{
+  return impl()->attach_socket( ssl, socket );
+}
+
+void context::adopt( ssl_st* ssl )
+{
+  return impl()->adopt( ssl );
+}
+
+bool context::kernel_tls_send( ssl_st* ssl )
+{
+#ifdef BIO_get_ktls_send
+  return BIO_get_ktls_send( SSL_get_wbio( ssl ) );
+#else
+  return ( static_cast<void>( ssl ), false );
+#endif
+}
+
+bool context::kernel_tls_receive( ssl_st* ssl )
+{
+#ifdef BIO_get_ktls_recv
+  return BIO_get_ktls_recv( SSL_get_rbio( ssl ) );
+#else
+  return ( static_cast<void>( ssl ), false );
+#endif
+}
+
 void context::password( std::string const& p )
 {
-  BOOST_ASSERT( pimpl );
-  return pimpl->password(p);
+  return impl()->password(p);
 }
 
 void context::ciphers( std::string const& ciphers )
 {
-  BOOST_ASSERT( pimpl );
-  return pimpl->ciphers(ciphers);
+  return impl()->ciphers(ciphers);
 }
 
 void context::private_key( std::string const& priv_key )
 {
-  BOOST_ASSERT( pimpl );
-  return pimpl->private_key(priv_key);
+  return impl()->private_key(priv_key);
 }
 
 void context::certificate( std::string const& cert )
 {
-  BOOST_ASSERT( pimpl );
-  return pimpl->certificate(cert);
+  return impl()->certificate(cert);
 }
 
 void context::certificate_authority( std::string const& ca )
 {
-  BOOST_ASSERT( pimpl );
-  return pimpl->certificate_authority(ca);
+  return impl()->certificate_authority(ca);
 }
 
 context::operator boost::asio::ssl::context&()
 {
-  BOOST_ASSERT( pimpl );
-  return static_cast<boost::asio::ssl::context&>(*pimpl);
+  return impl()->get_context();
+}
+
+void context::reload( context& fresh )
+{
+  boost::shared_ptr<context_impl_> next = fresh.impl();
+  BOOST_ASSERT( next != impl() );
+  next->inherit_ticket_keys( *impl() );
+  fresh.pimpl = boost::atomic_exchange( &pimpl, next );
 }
 
 context::context() : pimpl( new context_impl_ )
 {
 }
 
+context::context( boost::shared_ptr<context_impl_> const& p ) : pimpl( p )
+{
+}
+
 context::~context()
 {
 }
 
+boost::shared_ptr<context::context_impl_> context::impl() const
+{
+  boost::shared_ptr<context_impl_> p = boost::atomic_load( &pimpl );
+  BOOST_ASSERT( p );
+  return p;
+}
+
 boost::asio::ssl::context& context::get_handle()
 {
-  BOOST_ASSERT( pimpl );
-  return pimpl->get_context();
+  return impl()->get_context();
+}
+
+boost::shared_ptr<boost::asio::ssl::context> context::get_shared_handle()
+{
+  boost::shared_ptr<context_impl_> p = impl();
+  return boost::shared_ptr<boost::asio::ssl::context>( p, &p->get_context() );
+}
+
+boost::shared_ptr<context> context::snapshot() const
+{
+  return boost::shared_ptr<context>( new context( impl() ) );
 }
 
 } // namespace tls
@@ -23,12 +23,7 @@
 #define _THRIFT_SERVER_TCP_TLS_CONTEXT_HPP_
 
 #include <thrift/config.hpp>
-
-#ifdef BOOST_NO_CXX11_SMART_PTR
-# include <boost/scoped_ptr.hpp>
-#else
-# include <memory>
-#endif
+#include <boost/shared_ptr.hpp>
 
 namespace boost {
 namespace asio {
@@ -40,15 +35,20 @@ namespace ssl {
 } // namespace asio
 } // namespace boost
 
+// Forward declaration.
+struct ssl_st;
 
 
 namespace apache { namespace thrift { namespace server { namespace tcp { namespace tls {
 
+struct record_size_policy;
+
 struct context {
 
   context();
   ~context();
 
+  // Reference to the current context, like get_handle().
   operator boost::asio::ssl::context&();
 
   void certificate_authority(std::string const& ca);
@@ -61,15 +61,78 @@ struct context {
 
   void ciphers(std::string const& ciphers);
 
+  // Server side cache of sessions for resumption by session id, 0 disables
+  // it. Enabled by default with OpenSSL's size and 300 s timeout.
+  void session_cache(std::size_t size, long timeout_seconds = 300);
+
+  // Key of session tickets, 48 bytes: 16 of key name, 16 of HMAC secret and
+  // 16 of AES key. Tickets issued with the previous key are still accepted
+  // and renewed, so calling it periodically rotates the key. Servers sharing
+  // the key resume each other's sessions.
+  void session_ticket_key(std::string const& key);
+
+  // Rotates to a random session ticket key.
+  void rotate_session_ticket_key();
+
+  // Client side: offers the session cached for peer in the next handshake
+  // of ssl. Sessions issued by the server are cached for peer, which has to
+  // outlive ssl.
+  void resume_session(ssl_st* ssl, std::string const& peer);
+
+  // Client side: caches the session of ssl after its handshake completed.
+  void keep_session(ssl_st* ssl);
+
+  // Connections do socket I/O with OpenSSL's socket BIO instead of asio's
+  // memory BIOs, so OpenSSL 3.0 hands record encryption over to the kernel
+  // (kTLS) after the handshake. Where kernel or negotiated cipher lack the
+  // support OpenSSL keeps encrypting on its own. Disabled by default.
+  void kernel_tls(bool enable);
+  bool kernel_tls() const;
+
+  // Sizes of TLS records written by connections and client transports of
+  // the context, see record_size.hpp. OpenSSL's sizes by default.
+  void record_size(record_size_policy const& policy);
+  record_size_policy record_size() const;
+
+  // Switches ssl from asio's memory BIOs to socket, before the handshake.
+  // kTLS is requested only if kernel_tls() is enabled.
+  void attach_socket(ssl_st* ssl, int socket);
+
+  // Server side: moves ssl, created with another context, to this one before
+  // its handshake. Certificate, key, verification, options and ciphers are
+  // taken, sessions are still cached by the previous context.
+  void adopt(ssl_st* ssl);
+
+  // Whether the kernel encrypts records sent (received) by ssl.
+  static bool kernel_tls_send(ssl_st* ssl);
+  static bool kernel_tls_receive(ssl_st* ssl);
+
+  // Atomically takes over the configuration of fresh, which gets the
+  // previous one. Connections accepted afterwards use the new certificate,
+  // key and settings, established ones keep the context they were accepted
+  // with until they close. Session ticket keys are carried over when fresh
+  // has none, so clients still resume. May be called while serving.
+  void reload(context& fresh);
+
+  // Current context for configuration before serving. The reference is
+  // not safe once reload() may run, the context it refers to is freed with
+  // the last holder of the previous configuration; use get_shared_handle().
   boost::asio::ssl::context& get_handle();
 
+  // Current context shared with its holder, it stays valid after reload().
+  boost::shared_ptr<boost::asio::ssl::context> get_shared_handle();
+
+  // Current configuration with its settings, which later reload() does not
+  // change.
+  boost::shared_ptr<context> snapshot() const;
+
 private:
   struct context_impl_;
-#ifdef BOOST_NO_CXX11_SMART_PTR
-  boost::scoped_ptr<context_impl_> pimpl;
-#else
-  std::unique_ptr<context_impl_> pimpl;
-#endif
+  explicit context(boost::shared_ptr<context_impl_> const& p);
+
+  boost::shared_ptr<context_impl_> impl() const;
+
+  boost::shared_ptr<context_impl_> pimpl;
 };
 
 } // namespace tls
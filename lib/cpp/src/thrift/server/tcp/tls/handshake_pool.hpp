@@ -0,0 +1,364 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_TLS_HANDSHAKE_POOL_HPP_
+#define _THRIFT_SERVER_TCP_TLS_HANDSHAKE_POOL_HPP_
+
+#include <thrift/config.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/version.hpp>
+
+namespace apache { namespace thrift { namespace server { namespace tcp {
+namespace tls {
+
+class handshake_pool;
+
+} // namespace tls
+
+namespace detail {
+
+template <class Handler>
+class offloaded_handshake;
+
+class handshake_executor;
+
+} // namespace detail
+
+namespace tls {
+
+//  handshake_pool   -----------------------------------------------//
+// Threads running TLS handshakes of new connections, so a burst of them does
+// not delay requests of established connections. Every step of a handshake,
+// mostly public key cryptography, is queued to the pool once its I/O
+// completes. The I/O itself stays on the io_service of the connection, which
+// also runs the connection after the handshake. queue_depth(), in_progress()
+// and the durations can be exported as metrics.
+class handshake_pool : private boost::noncopyable
+{
+public:
+  // threads 0 means handshakes run on io_service of their connections.
+  explicit handshake_pool( std::size_t threads = 0U ) : threads_( threads ), queued_( 0U ), in_progress_( 0U ),
+    completed_( 0U ), failed_( 0U ), total_duration_( 0U ), max_duration_( 0U )
+  {}
+
+  ~handshake_pool()
+  {
+    stop();
+  }
+
+  // Must be set before the server starts serving.
+  void set_threads( std::size_t threads )
+  {
+    threads_ = threads;
+  }
+
+  std::size_t threads() const
+  {
+    return threads_;
+  }
+
+  // Starts the threads, called when the server starts serving.
+  void run()
+  {
+    if ( !threads_ || io_service_ )
+      return;
+
+    io_service_.reset( new boost::asio::io_service( threads_ ) );
+    work_.reset( new boost::asio::io_service::work( *io_service_ ) );
+    for ( std::size_t i = 0; i < threads_; ++i )
+      threads_group_.create_thread( boost::bind( &boost::asio::io_service::run, io_service_.get() ) );
+  }
+
+  // Joins the threads and drops handshakes still pending, called when the
+  // server stopped serving, while io_services of connections still exist.
+  void stop()
+  {
+    if ( !io_service_ )
+      return;
+
+    work_.reset();
+    io_service_->stop();
+    threads_group_.join_all();
+    io_service_.reset();
+    queued_ = 0U;
+    in_progress_ = 0U;
+  }
+
+  bool running() const
+  {
+    return io_service_.get() != 0;
+  }
+
+  // Handshake steps waiting for a thread.
+  std::size_t queue_depth() const
+  {
+    return queued_.load();
+  }
+
+  std::size_t in_progress() const
+  {
+    return in_progress_.load();
+  }
+
+  boost::uint64_t completed() const
+  {
+    return completed_.load();
+  }
+
+  boost::uint64_t failed() const
+  {
+    return failed_.load();
+  }
+
+  // Sum of durations of completed and failed handshakes, from the start of
+  // a handshake until the connection is handed back to its io_service.
+  boost::chrono::nanoseconds total_duration() const
+  {
+    return boost::chrono::nanoseconds( total_duration_.load() );
+  }
+
+  boost::chrono::nanoseconds max_duration() const
+  {
+    return boost::chrono::nanoseconds( max_duration_.load() );
+  }
+
+  // Handshake completion handler, handler is posted to io_service once the
+  // handshake completes.
+  template <class Handler>
+  detail::offloaded_handshake<Handler> wrap( boost::asio::io_service& io_service, Handler handler );
+
+private:
+  template <class Handler>
+  friend class detail::offloaded_handshake;
+  friend class detail::handshake_executor;
+
+  template <class Function>
+  struct queued_step
+  {
+    queued_step( handshake_pool& p, Function const& f ) : pool( &p ), function( f )
+    {}
+
+    void operator()()
+    {
+      --pool->queued_;
+      function();
+    }
+
+    handshake_pool* pool;
+    Function function;
+  };
+
+  template <class Function>
+  void queue( Function const& function )
+  {
+    ++queued_;
+    io_service_->post( queued_step<Function>( *this, function ) );
+  }
+
+  void started()
+  {
+    ++in_progress_;
+  }
+
+  void finished( boost::chrono::steady_clock::time_point start, bool succeeded )
+  {
+    const boost::uint64_t duration = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+      boost::chrono::steady_clock::now() - start ).count();
+
+    --in_progress_;
+    ++( succeeded ? completed_ : failed_ );
+    total_duration_ += duration;
+    boost::uint64_t max = max_duration_.load();
+    while ( duration > max && !max_duration_.compare_exchange_weak( max, duration ) )
+    {}
+  }
+
+  std::size_t threads_;
+  boost::scoped_ptr<boost::asio::io_service> io_service_;
+  boost::scoped_ptr<boost::asio::io_service::work> work_;
+  boost::thread_group threads_group_;
+  boost::atomic<std::size_t> queued_;
+  boost::atomic<std::size_t> in_progress_;
+  boost::atomic<boost::uint64_t> completed_;
+  boost::atomic<boost::uint64_t> failed_;
+  boost::atomic<boost::uint64_t> total_duration_;
+  boost::atomic<boost::uint64_t> max_duration_;
+};
+
+} // namespace tls
+
+namespace detail {
+
+//  handshake_executor   -----------------------------------------------//
+// Executor associated with offloaded_handshake, Boost.Asio 1.66 and newer
+// hands intermediate steps of composed operations to it instead of the
+// invocation hook.
+class handshake_executor
+{
+public:
+  explicit handshake_executor( tls::handshake_pool& pool ) : pool_( &pool )
+  {}
+
+  boost::asio::io_service& context() const
+  {
+    return *pool_->io_service_;
+  }
+
+  // The pool keeps its io_service running.
+  void on_work_started() const
+  {}
+
+  void on_work_finished() const
+  {}
+
+  template <class Function, class Allocator>
+  void dispatch( BOOST_ASIO_MOVE_ARG(Function) function, Allocator const& ) const
+  {
+    pool_->queue( function );
+  }
+
+  template <class Function, class Allocator>
+  void post( BOOST_ASIO_MOVE_ARG(Function) function, Allocator const& ) const
+  {
+    pool_->queue( function );
+  }
+
+  template <class Function, class Allocator>
+  void defer( BOOST_ASIO_MOVE_ARG(Function) function, Allocator const& ) const
+  {
+    pool_->queue( function );
+  }
+
+  friend bool operator==( handshake_executor const& a, handshake_executor const& b )
+  {
+    return a.pool_ == b.pool_;
+  }
+
+  friend bool operator!=( handshake_executor const& a, handshake_executor const& b )
+  {
+    return a.pool_ != b.pool_;
+  }
+
+private:
+  tls::handshake_pool* pool_;
+};
+
+//  offloaded_handshake   -----------------------------------------------//
+// Completion handler of a handshake run by handshake_pool. Its invocation
+// hook (or associated executor) queues the intermediate steps of the
+// handshake to the pool instead of running them on the thread that completed
+// their I/O.
+template <class Handler>
+class offloaded_handshake
+{
+public:
+  typedef void result_type;
+#if BOOST_VERSION >= 106600
+  typedef handshake_executor executor_type;
+
+  executor_type get_executor() const
+  {
+    return executor_type( *pool_ );
+  }
+#endif
+
+  offloaded_handshake( tls::handshake_pool& pool, boost::asio::io_service& io_service, Handler h ) : pool_( &pool ),
+    io_service_( &io_service ), start_( boost::chrono::steady_clock::now() ), handler_( h )
+  {
+    pool_->started();
+  }
+
+  void operator()( boost::system::error_code const& error )
+  {
+    pool_->finished( start_, !error );
+    io_service_->post( boost::bind<void>( handler_, error ) );
+  }
+
+  template <class Function>
+  void queue( Function const& function )
+  {
+    pool_->queue( function );
+  }
+
+private:
+  template <class H>
+  friend void* asio_handler_allocate( std::size_t size, offloaded_handshake<H>* this_handler );
+  template <class H>
+  friend void asio_handler_deallocate( void* pointer, std::size_t size, offloaded_handshake<H>* this_handler );
+
+  tls::handshake_pool* pool_;
+  boost::asio::io_service* io_service_;
+  boost::chrono::steady_clock::time_point start_;
+  Handler handler_;
+};
+
+template <class Handler>
+inline void* asio_handler_allocate( std::size_t size, offloaded_handshake<Handler>* this_handler )
+{
+  return boost_asio_handler_alloc_helpers::allocate( size, this_handler->handler_ );
+}
+
+template <class Handler>
+inline void asio_handler_deallocate( void* pointer, std::size_t size, offloaded_handshake<Handler>* this_handler )
+{
+  boost_asio_handler_alloc_helpers::deallocate( pointer, size, this_handler->handler_ );
+}
+
+// Steps run on the pool, hooks of the wrapped handler would bring them back
+// to the io_service of the connection.
+template <class Function, class Handler>
+inline void asio_handler_invoke( Function& function, offloaded_handshake<Handler>* this_handler )
+{
+  this_handler->queue( function );
+}
+
+template <class Function, class Handler>
+inline void asio_handler_invoke( Function const& function, offloaded_handshake<Handler>* this_handler )
+{
+  this_handler->queue( function );
+}
+
+} // namespace detail
+
+namespace tls {
+
+template <class Handler>
+inline detail::offloaded_handshake<Handler> handshake_pool::wrap( boost::asio::io_service& io_service, Handler handler )
+{
+  return detail::offloaded_handshake<Handler>( *this, io_service, handler );
+}
+
+} // namespace tls
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_TLS_HANDSHAKE_POOL_HPP_
@@ -0,0 +1,150 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCP_TLS_RECORD_SIZE_HPP_
+#define _THRIFT_SERVER_TCP_TLS_RECORD_SIZE_HPP_
+
+#include <thrift/config.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/system/error_code.hpp>
+#include <openssl/ssl.h>
+#include <algorithm>
+
+namespace apache { namespace thrift { namespace server { namespace tcp { namespace tls {
+
+//  record_size_policy   -----------------------------------------------//
+// Size of TLS records written by connections. After an idle period the
+// first small_bytes are sent in records of small_record bytes, each fitting
+// a single TCP segment, so the peer decrypts the start of a reply before
+// the rest arrives. Then records grow to the 16 KB maximum, which costs
+// less per byte for large replies.
+struct record_size_policy
+{
+  // small_record 0 (default) leaves record sizes to OpenSSL.
+  explicit record_size_policy( std::size_t record = 0U, std::size_t bytes = 16U * 1024U,
+    boost::chrono::milliseconds idle_time = boost::chrono::milliseconds( 1000 ) )
+    : small_record( record ), small_bytes( bytes ), idle( idle_time )
+  {}
+
+  // One MSS of 1460 bytes less TCP options and record overhead.
+  static record_size_policy dynamic()
+  {
+    return record_size_policy( 1400U );
+  }
+
+  bool enabled() const
+  {
+    return small_record != 0U;
+  }
+
+  std::size_t small_record;
+  std::size_t small_bytes;
+  boost::chrono::milliseconds idle;
+};
+
+//  record_sizer   -----------------------------------------------//
+// Applies record_size_policy to writes of a single connection.
+class record_sizer
+{
+public:
+  typedef boost::chrono::steady_clock clock_type;
+
+  explicit record_sizer( record_size_policy const& policy = record_size_policy() ) : policy_( policy ),
+    sent_( 0U ), write_start_( 0U ), small_( false )
+  {}
+
+  void set_policy( record_size_policy const& policy )
+  {
+    policy_ = policy;
+  }
+
+  bool enabled() const
+  {
+    return policy_.enabled();
+  }
+
+  // Called before every write, bytes written up to now are counted from it.
+  void begin_write()
+  {
+    const clock_type::time_point now = clock_type::now();
+    if ( now - last_write_ > policy_.idle )
+      sent_ = 0U;
+    last_write_ = now;
+    write_start_ = sent_;
+  }
+
+  // Sets record size of ssl for the next SSL_write, given bytes written since
+  // begin_write(). Returns the most bytes the next SSL_write may take.
+  std::size_t next_write( SSL* ssl, std::size_t written )
+  {
+    sent_ = write_start_ + written;
+    last_write_ = clock_type::now();
+
+    const bool small = sent_ < policy_.small_bytes;
+    if ( small != small_ )
+    {
+      // shrinking the maximum also shrinks the split fragment, which then
+      // limits records when the maximum grows again
+      const long size = small ? static_cast<long>( policy_.small_record ) : SSL3_RT_MAX_PLAIN_LENGTH;
+      SSL_set_max_send_fragment( ssl, size );
+      SSL_set_split_send_fragment( ssl, size );
+      small_ = small;
+    }
+    return small ? std::max<std::size_t>( policy_.small_bytes - sent_, 1U ) : default_max_transfer_size;
+  }
+
+  // Matches boost::asio::detail::default_max_transfer_size.
+  BOOST_STATIC_CONSTANT( std::size_t, default_max_transfer_size = 65536U );
+
+private:
+  record_size_policy policy_;
+  std::size_t sent_;
+  std::size_t write_start_;
+  clock_type::time_point last_write_;
+  bool small_;
+};
+
+//  record_size_condition   -----------------------------------------------//
+// Completion condition of boost::asio::async_write which sizes records of
+// every write_some through record_sizer.
+class record_size_condition
+{
+public:
+  record_size_condition( record_sizer& sizer, SSL* ssl ) : sizer_( &sizer ), ssl_( ssl )
+  {}
+
+  std::size_t operator()( boost::system::error_code const& ec, std::size_t written )
+  {
+    return ec ? 0U : sizer_->next_write( ssl_, written );
+  }
+
+private:
+  record_sizer* sizer_;
+  SSL* ssl_;
+};
+
+} // namespace tls
+} // namespace tcp
+} // namespace server
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_SERVER_TCP_TLS_RECORD_SIZE_HPP_
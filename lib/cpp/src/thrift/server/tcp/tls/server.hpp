@@ -31,6 +31,7 @@ namespace tls {
 typedef basic_server<connection> server;
 typedef basic_server<connection, detail::io_service_per_core> server_io_service_per_core;
 typedef basic_server<concurrent_connection, detail::io_service_run_in_thread_pool> server_io_service_in_thread_pool;
+typedef basic_server<serialized_connection, detail::io_service_run_in_thread_pool> server_io_service_in_thread_pool_serialized;
 
 } // namespace tls
 } // namespace tcp
@@ -22,6 +22,7 @@
 #ifndef _THRIFT_TRANSPORT_TTCPTRANSPORT_HPP_
 #define _THRIFT_TRANSPORT_TTCPTRANSPORT_HPP_
 
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 #include <thrift/transport/TTransport.h>
 #include <string>
@@ -40,6 +41,29 @@ boost::shared_ptr<TTransport> getTCPTransport
   std::string const& port
 );
 
+// Typed versions, e.g. getTCPTransport<tcp::transport<boost::asio::ip::tcp::socket,
+// tcp::detail::static_binding> >(address, port) for protocols instantiated on
+// the transport type, which then call it without virtual calls.
+template <class Transport>
+boost::shared_ptr<Transport> getTCPTransport
+(
+  std::string const& address,
+  unsigned short port
+)
+{
+  return boost::make_shared<Transport>(address, port);
+}
+
+template <class Transport>
+boost::shared_ptr<Transport> getTCPTransport
+(
+  std::string const& address,
+  std::string const& port
+)
+{
+  return boost::make_shared<Transport>(address, port);
+}
+
 } // namespace transport
 } // namespace thrift
 } // namespace apache
@@ -20,4 +20,71 @@
  */
 
 #include <thrift/transport/TTLSTransport.h>
-#include <thrift/transport/tcp/tls/transport.hpp>
\ No newline at end of file
+#include <thrift/transport/tcp/tls/transport.hpp>
+#include <boost/make_shared.hpp>
+
+namespace apache { namespace thrift { namespace transport {
+
+namespace {
+  boost::shared_ptr<tcp::tls::context> make_context( TLSContext const& inCtx )
+  {
+    boost::shared_ptr<tcp::tls::context> ctx = boost::make_shared<tcp::tls::context>();
+    if (!inCtx.certificateAuthority.empty())
+      ctx->certificate_authority(inCtx.certificateAuthority);
+    if (!inCtx.certificate.empty())
+      ctx->certificate(inCtx.certificate);
+    if (!inCtx.password.empty())
+      ctx->password(inCtx.password);
+    if (!inCtx.privateKey.empty())
+      ctx->private_key(inCtx.privateKey);
+    if (!inCtx.ciphers.empty())
+      ctx->ciphers(inCtx.ciphers);
+    return ctx;
+  }
+}
+
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  unsigned short port,
+  TLSContext const& tlsContext
+)
+{
+  return getTLSTransport(address, port, make_context(tlsContext));
+}
+
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  std::string const& port,
+  TLSContext const& tlsContext
+)
+{
+  return getTLSTransport(address, port, make_context(tlsContext));
+}
+
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  unsigned short port,
+  boost::shared_ptr<apache::thrift::server::tcp::tls::context> const& context
+)
+{
+  return boost::make_shared<tcp::transport<tcp::tls::socket> >
+    (address, port, context);
+}
+
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  std::string const& port,
+  boost::shared_ptr<apache::thrift::server::tcp::tls::context> const& context
+)
+{
+  return boost::make_shared<tcp::transport<tcp::tls::socket> >
+    (address, port, context);
+}
+
+} // namespace transport
+} // namespace thrift
+} // namespace apache
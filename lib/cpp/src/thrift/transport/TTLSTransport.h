@@ -22,15 +22,85 @@
 #ifndef _THRIFT_TRANSPORT_TTLSTRANSPORT_HPP_
 #define _THRIFT_TRANSPORT_TTLSTRANSPORT_HPP_
 
-namespace apache { namespace thrift { namespace transport {
-
-//struct TLSContext {};
-//
-//boost::shared_ptr<thrift::transport::TTransport> getTLSTransport
-//(
-//	std::string const& address,
-//	unsigned short port,
-//);
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/TTransport.h>
+#include <string>
+
+namespace apache { namespace thrift {
+
+namespace server { namespace tcp { namespace tls {
+
+struct context;
+
+} // namespace tls
+} // namespace tcp
+} // namespace server
+
+namespace transport {
+
+struct TLSContext
+{
+  std::string certificateAuthority;
+  std::string certificate;
+  std::string privateKey;
+  std::string password;
+  std::string ciphers;
+};
+
+// Each transport gets its own context.
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  unsigned short port,
+  TLSContext const& tlsContext
+);
+
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  std::string const& port,
+  TLSContext const& tlsContext
+);
+
+// Transports sharing a context resume each other's sessions.
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  unsigned short port,
+  boost::shared_ptr<apache::thrift::server::tcp::tls::context> const& context
+);
+
+boost::shared_ptr<TTransport> getTLSTransport
+(
+  std::string const& address,
+  std::string const& port,
+  boost::shared_ptr<apache::thrift::server::tcp::tls::context> const& context
+);
+
+// Typed versions, e.g. getTLSTransport<tcp::transport<tcp::tls::socket,
+// tcp::detail::static_binding> >(address, port, context), see getTCPTransport.
+template <class Transport>
+boost::shared_ptr<Transport> getTLSTransport
+(
+  std::string const& address,
+  unsigned short port,
+  boost::shared_ptr<apache::thrift::server::tcp::tls::context> const& context
+)
+{
+  return boost::make_shared<Transport>(address, port, context);
+}
+
+template <class Transport>
+boost::shared_ptr<Transport> getTLSTransport
+(
+  std::string const& address,
+  std::string const& port,
+  boost::shared_ptr<apache::thrift::server::tcp::tls::context> const& context
+)
+{
+  return boost::make_shared<Transport>(address, port, context);
+}
 
 } // namespace transport
 } // namespace thrift
@@ -0,0 +1,188 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_ASYNC_CLIENT_HPP_
+#define _THRIFT_TRANSPORT_TCP_ASYNC_CLIENT_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/transport/tcp/basic_transport.hpp>
+#include <thrift/transport/tcp/io_service_access.hpp>
+#include <thrift/transport/tcp/socket_options.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/future.hpp>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+//  async_client   -----------------------------------------------//
+// Asynchronous counterpart of a framed client transport. A call is a
+// serialized message, the client frames it, pipelines it on its connection
+// and completes the call with the reply frame. Replies are matched to calls
+// in order, or by sequence id when the server may reply out of order.
+// Nothing blocks, so a thread running the io_service drives any
+// number of clients with outstanding calls. io_service is not run by the
+// client, by default it is the one shared with blocking transports.
+//
+// Members may be called from any thread. Calls made while the connection is
+// being opened are queued, calls of a closed or failed client complete with
+// not_connected. Completions
+// run on a thread running io_service and must not block it.
+class async_client : public boost::enable_shared_from_this<async_client>, private boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr<async_client> pointer_type;
+  typedef boost::function<void(boost::system::error_code const&)> open_handler;
+  // Reply is empty when error is set, the handler may swap it out.
+  typedef boost::function<void(boost::system::error_code const&, std::string&)> reply_handler;
+#ifdef BOOST_THREAD_PROVIDES_FUTURE
+  typedef boost::future<std::string> reply_future;
+#else
+  typedef boost::unique_future<std::string> reply_future;
+#endif
+
+  // How replies are matched to calls. Oneway calls complete once written,
+  // they are recognized in messages serialized by TBinaryProtocol, other
+  // protocols must not send them through the client.
+  enum reply_matching
+  {
+    // replies come in order of calls
+    in_order,
+    // Every call is sent with a sequence id unique on the connection and
+    // its reply is found by it, the caller's sequence id is restored in the
+    // reply. Messages must be serialized by TBinaryProtocol.
+    by_seqid
+  };
+
+  static pointer_type create(std::string const& address, port_type port,
+    socket_options const& options = socket_options(),
+    io_service_access_ptr io_service = ::apache::thrift::transport::tcp::get_io_service());
+  static pointer_type create(std::string const& address, std::string const& port,
+    socket_options const& options = socket_options(),
+    io_service_access_ptr io_service = ::apache::thrift::transport::tcp::get_io_service());
+
+  // Resolves the address and connects, IPv4 endpoints are tried first.
+  void async_open(open_handler handler);
+
+  // Sends message and calls handler with the reply.
+  void async_call(std::string const& message, reply_handler handler);
+
+  // Future of the reply, it holds TTransportException on failure.
+  reply_future call(std::string const& message);
+
+  // Closes the connection, outstanding calls complete with operation_aborted.
+  // The client may be opened again.
+  void close();
+
+  bool is_open() const;
+
+  // Calls sent or queued and not completed yet.
+  std::size_t outstanding() const;
+
+  // Set before the first call, in_order by default.
+  void set_reply_matching(reply_matching matching);
+  reply_matching get_reply_matching() const;
+
+  // Larger reply frames fail the connection, 256 MB by default.
+  void set_max_frame_size(uint32_t size);
+
+  boost::asio::io_service& get_io_service();
+
+private:
+  struct pending_call
+  {
+    std::string frame;
+    reply_handler handler;
+    // Set when matched by_seqid, the caller's sequence id is kept in network
+    // byte order.
+    int32_t seqid;
+    uint32_t caller_seqid;
+    bool oneway;
+  };
+  typedef boost::shared_ptr<pending_call> call_ptr;
+
+  enum state_type { closed, opening, open, failed };
+
+  async_client(std::string const& address, std::string const& port, socket_options const& options,
+    io_service_access_ptr io_service);
+
+  // Handlers of socket operations carry the id of the connection which has
+  // started them, completions of a previous connection are ignored.
+  void start_open(open_handler handler);
+  void handle_resolve(boost::system::error_code const& ec, boost::asio::ip::tcp::resolver::iterator it,
+    std::size_t id, open_handler handler);
+  void handle_connect(boost::system::error_code const& ec, std::size_t id, open_handler handler);
+  void enqueue(call_ptr c);
+  bool assign_seqid(pending_call& c);
+  void start_write();
+  void handle_write(boost::system::error_code const& ec, std::size_t id);
+  void start_read();
+  void handle_header(boost::system::error_code const& ec, std::size_t id);
+  void handle_body(boost::system::error_code const& ec, std::size_t id);
+  void fail(boost::system::error_code const& ec, state_type next);
+
+  io_service_access_ptr io_service;
+  std::string address, port;
+  socket_options options;
+  boost::asio::io_service::strand strand;
+  boost::asio::ip::tcp::resolver resolver;
+  boost::asio::ip::tcp::socket socket;
+  std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+
+  // Accessed only on strand.
+  state_type state;
+  std::size_t connection;
+  bool writing;
+  std::deque<call_ptr> queued;
+  std::vector<call_ptr> written;
+  std::deque<call_ptr> awaiting;
+  std::map<int32_t, call_ptr> awaiting_seqid;
+  uint32_t next_seqid;
+  uint8_t header[sizeof(uint32_t)];
+  std::string reply;
+
+  boost::atomic<bool> opened;
+  boost::atomic<std::size_t> outstanding_;
+  uint32_t max_frame_size;
+  reply_matching matching;
+};
+
+typedef async_client::pointer_type async_client_ptr;
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#include <thrift/transport/tcp/impl/async_client.ipp>
+
+#endif // _THRIFT_TRANSPORT_TCP_ASYNC_CLIENT_HPP_
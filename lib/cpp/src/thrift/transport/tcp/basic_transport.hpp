@@ -23,23 +23,71 @@
 #define _THRIFT_TRANSPORT_TCP_BASIC_TRANSPORT_HPP_
 
 #include <string>
+#include <vector>
 #include <thrift/config.hpp>
 #include <thrift/transport/TTransport.h>
 #include <thrift/transport/tcp/io_service_access.hpp>
+#include <thrift/transport/tcp/socket_options.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace apache { namespace thrift { namespace transport { namespace tcp {
 
 namespace detail
 {
+  // Transport is used through TTransport, every call is virtual.
   typedef apache::thrift::transport::TTransport dynamic_binding;
-  typedef struct {} static_binding;
+
+  // Transport is still a TTransport, but its read(), readAll(), write(),
+  // borrow() and consume() hide the virtual ones and call the implementation
+  // directly, so protocols instantiated on the transport type, e.g.
+  // TBinaryProtocolT<transport<boost::asio::ip::tcp::socket, static_binding> >,
+  // inline the whole read and write path.
+  struct static_binding : apache::thrift::transport::TTransport {};
+
+  template <class BindingMode, class Transport>
+  struct binding : BindingMode
+  {};
+
+  template <class Transport>
+  struct binding<static_binding, Transport> : static_binding
+  {
+    uint32_t read(uint8_t* buf, uint32_t len)
+    {
+      return self().Transport::read_virt(buf, len);
+    }
+
+    uint32_t readAll(uint8_t* buf, uint32_t len)
+    {
+      return self().Transport::readAll_virt(buf, len);
+    }
+
+    void write(const uint8_t* buf, uint32_t len)
+    {
+      self().Transport::write_virt(buf, len);
+    }
+
+    const uint8_t* borrow(uint8_t* buf, uint32_t* len)
+    {
+      return self().Transport::borrow_virt(buf, len);
+    }
+
+    void consume(uint32_t len)
+    {
+      self().Transport::consume_virt(len);
+    }
+
+  private:
+    Transport& self()
+    {
+      return static_cast<Transport&>(*this);
+    }
+  };
 }
 
 typedef unsigned short port_type;
 
-template <class Stream, template<class> class TransportImpl, class BindingMode = detail::dynamic_binding>
-class basic_transport : public BindingMode
+template <class Stream, template<class, class> class TransportImpl, class BindingMode = detail::dynamic_binding>
+class basic_transport : public detail::binding<BindingMode, TransportImpl<Stream, BindingMode> >
 {
 public:
   bool isOpen();
@@ -48,8 +96,15 @@ public:
   void close();
   uint32_t read_virt(uint8_t* buf, uint32_t len);
   uint32_t readAll_virt(uint8_t* buf, uint32_t len);
+  // Lends *len bytes of the receive buffer, NULL if fewer are buffered.
+  const uint8_t* borrow_virt(uint8_t* buf, uint32_t* len);
+  void consume_virt(uint32_t len);
   void write_virt(const uint8_t* buf, uint32_t len);
 
+  // Reads shorter than the receive buffer are served from it, it is filled
+  // by a single receive of what has arrived. 0 disables it, 4 KB by default.
+  void setReadBufferSize(uint32_t size);
+
   // Just to mimic some part of the TSocket class interface if needed
   std::string getHost() const;
   port_type getPort() const;
@@ -61,13 +116,16 @@ public:
   int getSocketFD();
 
 protected:
-  basic_transport(std::string const& address, port_type port);
-  basic_transport(std::string const& address, std::string const& port);
+  basic_transport(std::string const& address, port_type port, socket_options const& options = socket_options());
+  basic_transport(std::string const& address, std::string const& port, socket_options const& options = socket_options());
 
   io_service_access_ptr io_service;
 private:
-  TransportImpl<Stream>& self();
+  TransportImpl<Stream, BindingMode>& self();
   void io_op_precond_check();
+  // Reads len bytes, or at least one if some is set. Called through self(),
+  // so transports reading through another layer of the stream hide it.
+  uint32_t read_socket(uint8_t* buf, uint32_t len, bool some);
 
 private:
   boost::posix_time::time_duration send_timeout;
@@ -75,6 +133,12 @@ private:
   boost::posix_time::time_duration connect_timeout;
 
   std::string address, port;
+  socket_options options;
+
+  // Holds more than read_buffer_size while bytes buffered before it was
+  // reduced are read.
+  std::vector<uint8_t> read_buffer;
+  uint32_t read_buffer_size, read_begin, read_end;
 };
 
 } // namespace tcp
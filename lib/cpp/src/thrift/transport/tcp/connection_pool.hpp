@@ -0,0 +1,104 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_CONNECTION_POOL_HPP_
+#define _THRIFT_TRANSPORT_TCP_CONNECTION_POOL_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/tcp/transport.hpp>
+#include <thrift/transport/tcp/socket_options.hpp>
+#include <boost/chrono/duration.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+struct pool_state;
+
+} // namespace detail
+
+//  pool_options   -----------------------------------------------//
+// Sizes and timing of connection_pool, applied to every endpoint.
+struct pool_options
+{
+  pool_options() : min_size(0U), max_size(8U), idle_timeout(boost::chrono::seconds(60)),
+    check_interval(boost::chrono::seconds(5)), checkout_timeout(boost::chrono::seconds(5)),
+    connect_timeout(0), socket(socket_options::defaults())
+  {}
+
+  std::size_t min_size;                          // connections kept open and pre-warmed
+  std::size_t max_size;                          // idle and checked out connections
+  boost::chrono::milliseconds idle_timeout;      // idle connections above min_size are closed after it
+  boost::chrono::milliseconds check_interval;    // period of liveness checks and eviction, 0 disables them
+  boost::chrono::milliseconds checkout_timeout;  // wait for a connection when max_size are checked out
+  int connect_timeout;                           // milliseconds, 0 means none
+  socket_options socket;
+};
+
+//  connection_pool   -----------------------------------------------//
+// Thread-safe pool of client connections keyed by endpoint. checkout()
+// returns a framed transport over an open connection, which goes back to the
+// pool when the last reference to it is dropped. A connection is reused only
+// after complete calls, invalidate() drops one left in an unknown state, e.g.
+// after an exception. Idle connections are checked before they are handed
+// out and periodically by a background thread, which also closes those idle
+// for longer than idle_timeout and reopens up to min_size.
+class connection_pool : private boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr<apache::thrift::transport::TFramedTransport> transport_ptr;
+
+  explicit connection_pool(pool_options const& options = pool_options());
+
+  // Closes idle connections, checked out ones are closed when dropped.
+  ~connection_pool();
+
+  // Opens up to min_size connections to the endpoint, failures are reported
+  // and left to the background thread.
+  void prewarm(std::string const& address, port_type port);
+
+  // Idle connection of the endpoint or a new one, waits up to
+  // checkout_timeout if max_size are checked out. Throws TTransportException.
+  transport_ptr checkout(std::string const& address, port_type port);
+
+  // Connection of transport is closed instead of returned to the pool.
+  static void invalidate(transport_ptr const& transport);
+
+  // Metrics of the endpoint.
+  std::size_t idle(std::string const& address, port_type port) const;
+  std::size_t checked_out(std::string const& address, port_type port) const;
+
+private:
+  boost::shared_ptr<detail::pool_state> state;
+};
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#include <thrift/transport/tcp/impl/connection_pool.ipp>
+
+#endif // _THRIFT_TRANSPORT_TCP_CONNECTION_POOL_HPP_
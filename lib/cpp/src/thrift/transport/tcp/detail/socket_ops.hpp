@@ -24,11 +24,24 @@
 
 #include <thrift/config.hpp>
 #include <boost/asio.hpp>
-#include <boost/system/error_code.hpp>
-#include <boost/optional.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/noncopyable.hpp>
-#include <boost/bind.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <utility>
 #include <vector>
+#if !defined(WIN32)
+# include <fcntl.h>
+# include <poll.h>
+# include <pthread.h>
+# include <signal.h>
+# include <time.h>
+# include <unistd.h>
+#endif
 
 namespace apache { namespace thrift { namespace transport {
 namespace tcp { namespace detail {
@@ -40,119 +53,405 @@ namespace tcp { namespace detail {
   static int const econnreset = WSAECONNRESET;
 #endif
 
-void set_result(boost::optional<boost::system::error_code>& a, boost::system::error_code b)
-{
-  a.reset(b);
-}
+// Timed I/O relies on kernel timeouts of the socket (SO_RCVTIMEO and
+// SO_SNDTIMEO) and calls recv and send directly: asio waits for readiness
+// without a limit when the kernel gives up. Nothing is allocated and no
+// io_service is run, so any number of threads do timed I/O at once.
+#if defined(WIN32)
+  typedef SOCKET native_socket_type;
+  static native_socket_type const invalid_socket = INVALID_SOCKET;
+  typedef int socket_length_type;
+  typedef WSAPOLLFD poll_fd_type;
+  static int const send_flags = 0;
 
-template <class Operation, class Stream>
-typename Operation::result_type operation_with_timeout
-(
-  Stream& s,
-  typename Operation::argument_type arg,
-  boost::asio::deadline_timer::duration_type timeout
-)
-{
-  using boost::system::error_code;
-  using boost::system::system_error;
-  using boost::asio::deadline_timer;
-  using boost::optional;
+  inline int last_socket_error()
+  {
+    return ::WSAGetLastError();
+  }
+
+  inline bool is_would_block(int error)
+  {
+    return error == WSAEWOULDBLOCK || error == WSAETIMEDOUT;
+  }
 
-  optional<error_code> timer_result;
-  boost::asio::io_service& io_service = s.get_io_service();
-  deadline_timer timer(io_service);
-  timer.expires_from_now(timeout);
+  inline bool is_in_progress(int error)
+  {
+    return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+  }
 
-  timer.async_wait(boost::bind(set_result, boost::ref(timer_result), _1));
+  inline int poll_sockets(poll_fd_type* fds, std::size_t count, int ms)
+  {
+    return ::WSAPoll(fds, static_cast<ULONG>(count), ms);
+  }
 
-  optional<error_code> operation_result;
-  Operation async_op;
-  async_op(s, arg, operation_result);
+  inline bool set_non_blocking(native_socket_type s, bool on)
+  {
+    u_long arg = on ? 1 : 0;
+    return !::ioctlsocket(s, FIONBIO, &arg);
+  }
 
-  io_service.reset();
-  while (io_service.run_one())
+  inline void close_socket(native_socket_type s)
   {
-    if (operation_result)
-      timer.cancel();
-    else if (timer_result)
-      s.cancel();
+    ::closesocket(s);
   }
 
-  if (*operation_result)
-    BOOST_THROW_EXCEPTION(system_error(*operation_result));
+  inline long socket_recv(SOCKET s, uint8_t* buf, std::size_t len)
+  {
+    return ::recv(s, reinterpret_cast<char*>(buf), static_cast<int>(len), 0);
+  }
 
-  return async_op.result();
-}
+  inline long socket_send(SOCKET s, const uint8_t* buf, std::size_t len)
+  {
+    return ::send(s, reinterpret_cast<const char*>(buf), static_cast<int>(len), send_flags);
+  }
+#else
+  typedef int native_socket_type;
+  static native_socket_type const invalid_socket = -1;
+  typedef socklen_t socket_length_type;
+  typedef ::pollfd poll_fd_type;
+# if defined(MSG_NOSIGNAL)
+  static int const send_flags = MSG_NOSIGNAL;
+# else
+  static int const send_flags = 0;
+# endif
+
+  inline int last_socket_error()
+  {
+    return errno;
+  }
+
+  inline bool is_would_block(int error)
+  {
+    return error == EAGAIN || error == EWOULDBLOCK;
+  }
+
+  inline bool is_in_progress(int error)
+  {
+    return error == EINPROGRESS || is_would_block(error);
+  }
+
+  inline int poll_sockets(poll_fd_type* fds, std::size_t count, int ms)
+  {
+    return ::poll(fds, static_cast<nfds_t>(count), ms);
+  }
+
+  inline bool set_non_blocking(native_socket_type s, bool on)
+  {
+    const int flags = ::fcntl(s, F_GETFL, 0);
+    return flags != -1 && ::fcntl(s, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) != -1;
+  }
+
+  inline void close_socket(native_socket_type s)
+  {
+    ::close(s);
+  }
+
+  inline long socket_recv(int s, uint8_t* buf, std::size_t len)
+  {
+    return static_cast<long>(::recv(s, buf, len, 0));
+  }
 
-//  async_connect_op   -----------------------------------------------//
-struct async_connect_op : private boost::noncopyable {
-  typedef void result_type;
-  typedef std::vector<boost::asio::ip::tcp::endpoint> const& argument_type;
+  inline long socket_send(int s, const uint8_t* buf, std::size_t len)
+  {
+    return static_cast<long>(::send(s, buf, len, send_flags));
+  }
+#endif
+
+inline boost::system::error_code socket_error(int error)
+{
+  return boost::system::error_code(error, boost::asio::error::get_system_category());
+}
 
-  template <class Stream, class Result>
-  void operator()(Stream& s, argument_type endpoints, Result& op_result)
+//  sigpipe_guard   -----------------------------------------------//
+// OpenSSL doing socket I/O itself writes with write(), which raises SIGPIPE
+// when the peer has gone, unlike send() with send_flags. The guard blocks
+// SIGPIPE of the thread around an OpenSSL call and discards the one raised
+// meanwhile, errno of the call is kept. Nothing is done when the thread
+// blocks SIGPIPE already.
+#if defined(WIN32)
+class sigpipe_guard : private boost::noncopyable
+{};
+#else
+class sigpipe_guard : private boost::noncopyable
+{
+public:
+  sigpipe_guard()
   {
-    boost::asio::async_connect(s, endpoints.begin(), endpoints.end(), boost::bind(set_result, boost::ref(op_result), _1));
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    sigset_t previous;
+    blocked = !pthread_sigmask(SIG_BLOCK, &pipe, &previous) && !sigismember(&previous, SIGPIPE);
   }
 
-  result_type result() const {}
-}; // async_connect_op
+  ~sigpipe_guard()
+  {
+    if (!blocked)
+      return;
+    const int error = errno;
+    sigset_t pending;
+    if (!sigpending(&pending) && sigismember(&pending, SIGPIPE))
+    {
+      const timespec poll = { 0, 0 };
+      while (sigtimedwait(&pipe, 0, &poll) < 0 && errno == EINTR)
+      {}
+    }
+    pthread_sigmask(SIG_UNBLOCK, &pipe, 0);
+    errno = error;
+  }
 
-//  async_rw_op_base   -----------------------------------------------//
-struct async_rw_op_base : private boost::noncopyable {
-  typedef std::size_t result_type;
+private:
+  sigset_t pipe;
+  bool blocked;
+};
+#endif
 
-  async_rw_op_base() : bytes_transferred_(0UL)
-  {}
+// Sets SO_RCVTIMEO or SO_SNDTIMEO, zero timeout means none.
+template <class Socket>
+void set_socket_timeout(Socket& s, int option, boost::posix_time::time_duration timeout)
+{
+  if (timeout.is_negative())
+    timeout = boost::posix_time::time_duration();
+#if defined(WIN32)
+  const DWORD value = static_cast<DWORD>(timeout.total_milliseconds());
+#else
+  timeval value;
+  value.tv_sec = static_cast<time_t>(timeout.total_seconds());
+  value.tv_usec = static_cast<suseconds_t>(timeout.total_microseconds() % 1000000);
+#endif
+  if (::setsockopt(s.native_handle(), SOL_SOCKET, option, reinterpret_cast<const char*>(&value), sizeof(value)))
+    BOOST_THROW_EXCEPTION(boost::system::system_error(socket_error(last_socket_error()), "setsockopt"));
+}
 
-  void set_result(boost::optional<boost::system::error_code>& a,
-    boost::system::error_code b, std::size_t bytes_transferred)
+// Receives len bytes, or at least one if some is set, throws timed_out when
+// SO_RCVTIMEO expires.
+template <class Socket>
+std::size_t recv_with_timeout(Socket& s, uint8_t* buf, std::size_t len, bool some)
+{
+  std::size_t received = 0U;
+  while (received < len)
   {
-    a.reset(b);
-    this->bytes_transferred_ = bytes_transferred;
+    const long r = socket_recv(s.native_handle(), buf + received, len - received);
+    if (r > 0)
+    {
+      received += static_cast<std::size_t>(r);
+      if (some)
+        break;
+      continue;
+    }
+    if (!r)
+      BOOST_THROW_EXCEPTION(boost::system::system_error(boost::asio::error::eof, "recv"));
+
+    const int error = last_socket_error();
+    if (error == EINTR)
+      continue;
+    BOOST_THROW_EXCEPTION(boost::system::system_error(is_would_block(error)
+      ? boost::system::error_code(boost::asio::error::timed_out) : socket_error(error), "recv"));
   }
+  return received;
+}
 
-  result_type result() const
+// Sends len bytes, throws timed_out when SO_SNDTIMEO expires.
+template <class Socket>
+void send_with_timeout(Socket& s, const uint8_t* buf, std::size_t len)
+{
+  for (std::size_t sent = 0U; sent < len; )
   {
-    return bytes_transferred_;
+    const long r = socket_send(s.native_handle(), buf + sent, len - sent);
+    if (r >= 0)
+    {
+      sent += static_cast<std::size_t>(r);
+      continue;
+    }
+
+    const int error = last_socket_error();
+    if (error == EINTR)
+      continue;
+    BOOST_THROW_EXCEPTION(boost::system::system_error(is_would_block(error)
+      ? boost::system::error_code(boost::asio::error::timed_out) : socket_error(error), "send"));
   }
+}
+
+// Delay before the next endpoint is tried while earlier attempts are still
+// in progress, as recommended by RFC 8305.
+static long const connection_attempt_delay_ms = 250;
 
-protected:
-  std::size_t bytes_transferred_;
-  ~async_rw_op_base() {}
-}; // async_rw_op_base
+inline bool is_ipv4_endpoint(boost::asio::ip::tcp::endpoint const& endpoint)
+{
+  return endpoint.protocol() == boost::asio::ip::tcp::v4();
+}
 
-//  async_read_op   -----------------------------------------------//
-template <class MutableBufferSequence>
-struct async_read_op : async_rw_op_base
+// Orders endpoints alternating address families, IPv4 first. Order within a
+// family is kept.
+inline std::vector<boost::asio::ip::tcp::endpoint> interleave_families(
+  std::vector<boost::asio::ip::tcp::endpoint> const& endpoints)
 {
-  using async_rw_op_base::result_type;
-  typedef MutableBufferSequence const& argument_type;
+  std::vector<boost::asio::ip::tcp::endpoint> v4, other, result;
+  for (std::size_t i = 0; i < endpoints.size(); ++i)
+    (is_ipv4_endpoint(endpoints[i]) ? v4 : other).push_back(endpoints[i]);
 
-  template <class Stream, class Result>
-  void operator()(Stream& s, argument_type buff, Result& op_result)
+  result.reserve(endpoints.size());
+  for (std::size_t i = 0; i < v4.size() || i < other.size(); ++i)
   {
-    boost::asio::async_read(s, buff, boost::bind(&async_read_op::set_result
-      , this, boost::ref(op_result), _1, boost::asio::placeholders::bytes_transferred)
-      );
+    if (i < v4.size())
+      result.push_back(v4[i]);
+    if (i < other.size())
+      result.push_back(other[i]);
   }
-}; // async_read_op
+  return result;
+}
 
-//  async_write_op   -----------------------------------------------//
-template <class ConstBufferSequence>
-struct async_write_op : async_rw_op_base
+// Opens a non-blocking socket and starts connecting it, invalid_socket if it
+// has failed at once.
+inline native_socket_type start_connect(boost::asio::ip::tcp::endpoint const& endpoint, bool& connected,
+  boost::system::error_code& ec)
 {
-  using async_rw_op_base::result_type;
-  typedef ConstBufferSequence const& argument_type;
+  native_socket_type s = ::socket(endpoint.protocol().family(), SOCK_STREAM, IPPROTO_TCP);
+  if (s == invalid_socket)
+  {
+    ec = socket_error(last_socket_error());
+    return s;
+  }
+#if defined(SO_NOSIGPIPE)
+  const int on = 1;
+  ::setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
 
-  template <class Stream, class Result>
-  void operator()(Stream& s, argument_type buff, Result& op_result)
+  connected = set_non_blocking(s, true)
+    && !::connect(s, endpoint.data(), static_cast<socket_length_type>(endpoint.size()));
+  if (!connected)
   {
-    boost::asio::async_write(s, buff, boost::bind(&async_write_op::set_result
-      , this, boost::ref(op_result), _1, boost::asio::placeholders::bytes_transferred)
-      );
+    const int error = last_socket_error();
+    if (!is_in_progress(error))
+    {
+      ec = socket_error(error);
+      close_socket(s);
+      return invalid_socket;
+    }
   }
-}; // async_write_op
+  return s;
+}
+
+// Connects like RFC 8305 Happy Eyeballs. Endpoints of both address families
+// are tried in turns, the next one when the previous attempt fails or after
+// connection_attempt_delay_ms. Attempts run in parallel, the first
+// connection wins and the others are closed. A positive timeout limits all
+// attempts together.
+template <class Socket>
+void connect_endpoints(Socket& s, std::vector<boost::asio::ip::tcp::endpoint> const& resolved,
+  boost::posix_time::time_duration timeout)
+{
+  typedef boost::chrono::steady_clock clock;
+  const std::vector<boost::asio::ip::tcp::endpoint> endpoints = interleave_families(resolved);
+  const bool timed = timeout > boost::posix_time::time_duration();
+  const clock::time_point deadline = clock::now() + boost::chrono::microseconds(timeout.total_microseconds());
+
+  // sockets being connected and indexes of their endpoints
+  std::vector<std::pair<native_socket_type, std::size_t> > pending;
+  std::vector<poll_fd_type> fds;
+  native_socket_type winner = invalid_socket;
+  std::size_t winner_index = 0U, next = 0U;
+  clock::time_point next_attempt = clock::now();
+  boost::system::error_code ec = boost::asio::error::host_not_found;
+
+  while (winner == invalid_socket)
+  {
+    const clock::time_point now = clock::now();
+    if (timed && now >= deadline)
+    {
+      ec = boost::asio::error::timed_out;
+      break;
+    }
+
+    if (next < endpoints.size() && (pending.empty() || now >= next_attempt))
+    {
+      bool connected = false;
+      const native_socket_type attempt = start_connect(endpoints[next], connected, ec);
+      if (connected)
+      {
+        winner = attempt;
+        winner_index = next;
+      }
+      else if (attempt != invalid_socket)
+      {
+        pending.push_back(std::make_pair(attempt, next));
+        next_attempt = now + boost::chrono::milliseconds(connection_attempt_delay_ms);
+      }
+      ++next;
+      continue;
+    }
+    if (pending.empty())
+      break;
+
+    // wait for an attempt to complete, the next one to start or the deadline
+    long ms = -1;
+    if (next < endpoints.size())
+      ms = static_cast<long>(boost::chrono::duration_cast<boost::chrono::microseconds>(next_attempt - now).count() + 999) / 1000;
+    if (timed)
+    {
+      const long left = static_cast<long>(boost::chrono::duration_cast<boost::chrono::microseconds>(deadline - now).count() + 999) / 1000;
+      ms = ms < 0 ? left : std::min(ms, left);
+    }
+
+    fds.resize(pending.size());
+    for (std::size_t i = 0; i < pending.size(); ++i)
+    {
+      fds[i].fd = pending[i].first;
+      fds[i].events = POLLOUT;
+      fds[i].revents = 0;
+    }
+    const int ready = poll_sockets(&fds[0], fds.size(), static_cast<int>(std::max(ms, -1L)));
+    if (ready < 0)
+    {
+      const int error = last_socket_error();
+      if (error == EINTR)
+        continue;
+      ec = socket_error(error);
+      break;
+    }
+
+    for (std::size_t i = fds.size(); i-- > 0; )
+    {
+      if (!fds[i].revents)
+        continue;
+
+      int result = 0;
+      socket_length_type length = sizeof(result);
+      if (::getsockopt(pending[i].first, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&result), &length))
+        result = last_socket_error();
+      if (!result && winner == invalid_socket)
+      {
+        winner = pending[i].first;
+        winner_index = pending[i].second;
+      }
+      else
+      {
+        if (result)
+          ec = socket_error(result);
+        close_socket(pending[i].first);
+        // failed attempt is replaced at once
+        next_attempt = now;
+      }
+      pending.erase(pending.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+  }
+
+  for (std::size_t i = 0; i < pending.size(); ++i)
+    close_socket(pending[i].first);
+  if (winner == invalid_socket)
+    BOOST_THROW_EXCEPTION(boost::system::system_error(ec, "connect"));
+
+  boost::system::error_code ignored;
+  s.close(ignored);
+  if (!set_non_blocking(winner, false))
+    ec = socket_error(last_socket_error());
+  else
+    s.assign(endpoints[winner_index].protocol(), winner, ec);
+  if (ec)
+  {
+    close_socket(winner);
+    BOOST_THROW_EXCEPTION(boost::system::system_error(ec, "connect"));
+  }
+}
 
 } // namespace detail
 } // namespace tcp
@@ -0,0 +1,134 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_HEDGED_CLIENT_HPP_
+#define _THRIFT_TRANSPORT_TCP_HEDGED_CLIENT_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/transport/tcp/async_client.hpp>
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+struct hedged_call;
+
+} // namespace detail
+
+//  hedge_options   -----------------------------------------------//
+// When backups of idempotent calls are sent and how many of them.
+struct hedge_options
+{
+  hedge_options() : percentile(0.95), min_delay(boost::chrono::milliseconds(1)),
+    max_delay(boost::chrono::milliseconds(1000)), window(1000U), min_samples(100U), budget(0.05), burst(10.0)
+  {}
+
+  double percentile;                         // of recent latencies after which a backup is sent
+  boost::chrono::microseconds min_delay;     // bounds of the delay, max_delay is used until
+  boost::chrono::microseconds max_delay;     // min_samples latencies are known
+  std::size_t window;                        // latencies of recent calls kept
+  std::size_t min_samples;
+  double budget;                             // backups per call, 0.05 adds at most 5% load
+  double burst;                              // backups which may be sent at once
+};
+
+//  hedged_client   -----------------------------------------------//
+// Hedges idempotent calls over several async_clients, e.g. connections to
+// replicas of a service. A call goes to the next client in turn, when its
+// reply has not come after the given percentile of recent latencies the
+// same message is sent to the following client. The first reply completes
+// the call, the other one is ignored, as async_client cannot withdraw a
+// sent call. A failed call is retried there at once. Each call earns budget
+// of a backup and each backup spends one, up to burst are saved, so
+// hedging adds a bounded share of load even when all replies are slow.
+//
+// Clients are opened by the caller. Members may be called from any thread,
+// completions run on a thread running the io_service of the clients.
+class hedged_client : public boost::enable_shared_from_this<hedged_client>, private boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr<hedged_client> pointer_type;
+  typedef async_client::reply_handler reply_handler;
+  typedef async_client::reply_future reply_future;
+
+  static pointer_type create(std::vector<async_client_ptr> const& clients,
+    hedge_options const& options = hedge_options());
+
+  // Sends message and calls handler with the first reply, backups are sent
+  // only if idempotent is set.
+  void async_call(std::string const& message, bool idempotent, reply_handler handler);
+
+  // Future of the reply, it holds TTransportException on failure.
+  reply_future call(std::string const& message, bool idempotent);
+
+  // Current delay of backups.
+  boost::chrono::microseconds delay() const;
+
+  // Metrics: calls made, backups sent and backups replying first.
+  std::size_t calls() const;
+  std::size_t hedged() const;
+  std::size_t backup_wins() const;
+
+private:
+  typedef boost::chrono::steady_clock clock;
+  typedef boost::shared_ptr<detail::hedged_call> call_ptr;
+
+  hedged_client(std::vector<async_client_ptr> const& clients, hedge_options const& options);
+
+  void send(call_ptr const& c, std::size_t attempt);
+  void handle_reply(boost::system::error_code const& ec, std::string& reply, call_ptr c, std::size_t attempt);
+  void handle_timer(boost::system::error_code const& ec, call_ptr c);
+  // Sends a backup if the budget allows it, called with lock held.
+  bool start_backup(call_ptr const& c);
+  void record(clock::duration latency);
+
+  std::vector<async_client_ptr> clients;
+  hedge_options options;
+
+  mutable boost::mutex mutex;
+  std::size_t next;
+  // ring buffer of latencies of recent calls, replies ignored are left out
+  // so slow backends do not raise the delay
+  std::vector<clock::duration> latencies;
+  std::size_t recorded;
+  clock::duration current_delay;
+  double tokens;
+  std::size_t calls_, hedged_, backup_wins_;
+};
+
+typedef hedged_client::pointer_type hedged_client_ptr;
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#include <thrift/transport/tcp/impl/hedged_client.ipp>
+
+#endif // _THRIFT_TRANSPORT_TCP_HEDGED_CLIENT_HPP_
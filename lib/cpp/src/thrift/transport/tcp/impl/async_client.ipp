@@ -0,0 +1,463 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_ASYNC_CLIENT_IPP_
+#define _THRIFT_TRANSPORT_TCP_ASYNC_CLIENT_IPP_
+
+#include <thrift/transport/tcp/async_client.hpp>
+#include <thrift/transport/tcp/detail/socket_ops.hpp>
+#include <thrift/transport/TTransportException.h>
+#include <thrift/protocol/TProtocol.h>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/move/move.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+// Offset of the sequence id in a message serialized by TBinaryProtocol, 0 if
+// it is not one. type is set to the message type.
+inline std::size_t binary_seqid_offset(const char* message, std::size_t size, uint8_t& type)
+{
+  const uint32_t version_mask = 0xffff0000U, version_1 = 0x80010000U;
+
+  uint32_t word = 0U;
+  if (size < sizeof(word))
+    return 0U;
+  std::memcpy(&word, message, sizeof(word));
+  word = ntohl(word);
+
+  std::size_t offset = sizeof(word);
+  if (word & 0x80000000U)
+  {
+    if ((word & version_mask) != version_1 || size < 2 * sizeof(word))
+      return 0U;
+    type = static_cast<uint8_t>(word & 0xffU);
+    std::memcpy(&word, message + offset, sizeof(word));
+    word = ntohl(word);
+    offset += sizeof(word);
+    if (word > size - offset)
+      return 0U;
+    offset += word;
+  }
+  // old protocol without version, name is followed by type
+  else
+  {
+    if (word >= size - offset)
+      return 0U;
+    offset += word;
+    type = static_cast<uint8_t>(message[offset++]);
+  }
+  return size - offset < sizeof(int32_t) ? 0U : offset;
+}
+
+//  reply_promise   -----------------------------------------------//
+// Handler of async_client::call() that completes its future.
+class reply_promise
+{
+public:
+  typedef void result_type;
+
+  reply_promise() : promise(boost::make_shared<boost::promise<std::string> >())
+  {}
+
+  async_client::reply_future get_future()
+  {
+    return promise->get_future();
+  }
+
+  void operator()(boost::system::error_code const& ec, std::string& reply)
+  {
+    if (!ec)
+    {
+      promise->set_value(boost::move(reply));
+      return;
+    }
+    const int type = ec == boost::asio::error::eof ? TTransportException::END_OF_FILE
+      : ec == boost::asio::error::not_connected ? TTransportException::NOT_OPEN
+      : TTransportException::UNKNOWN;
+    promise->set_exception(boost::copy_exception(TTransportException(
+      static_cast<TTransportException::TTransportExceptionType>(type), ec.message())));
+  }
+
+private:
+  boost::shared_ptr<boost::promise<std::string> > promise;
+};
+
+} // namespace detail
+
+inline async_client::pointer_type async_client::create(std::string const& address, port_type port,
+  socket_options const& options, io_service_access_ptr io_service)
+{
+  return create(address, boost::lexical_cast<std::string>(port), options, io_service);
+}
+
+inline async_client::pointer_type async_client::create(std::string const& address, std::string const& port,
+  socket_options const& options, io_service_access_ptr io_service)
+{
+  return pointer_type(new async_client(address, port, options, io_service));
+}
+
+inline async_client::async_client(std::string const& addr, std::string const& p, socket_options const& o,
+  io_service_access_ptr ios)
+  : io_service(ios), address(addr), port(p), options(o), strand(get_io_service()), resolver(get_io_service()),
+    socket(get_io_service()),
+    state(closed), connection(0U), writing(false), next_seqid(0U), opened(false), outstanding_(0U),
+    max_frame_size(256U * 1024U * 1024U), matching(in_order)
+{}
+
+inline boost::asio::io_service& async_client::get_io_service()
+{
+  return static_cast<boost::asio::io_service&>(*io_service);
+}
+
+inline bool async_client::is_open() const
+{
+  return opened.load();
+}
+
+inline std::size_t async_client::outstanding() const
+{
+  return outstanding_.load();
+}
+
+inline void async_client::set_reply_matching(reply_matching m)
+{
+  matching = m;
+}
+
+inline async_client::reply_matching async_client::get_reply_matching() const
+{
+  return matching;
+}
+
+inline void async_client::set_max_frame_size(uint32_t size)
+{
+  max_frame_size = size;
+}
+
+inline void async_client::async_open(open_handler handler)
+{
+  strand.dispatch(boost::bind(&async_client::start_open, shared_from_this(), handler));
+}
+
+inline void async_client::start_open(open_handler handler)
+{
+  if (state == opening || state == open)
+  {
+    get_io_service().post(boost::bind(handler, boost::asio::error::already_connected));
+    return;
+  }
+
+  state = opening;
+  ++connection;
+  boost::asio::ip::tcp::resolver::query query(address, port);
+  resolver.async_resolve(query, strand.wrap(boost::bind(&async_client::handle_resolve, shared_from_this(),
+    boost::asio::placeholders::error, boost::asio::placeholders::iterator, connection, handler)));
+}
+
+inline void async_client::handle_resolve(boost::system::error_code const& ec,
+  boost::asio::ip::tcp::resolver::iterator it, std::size_t id, open_handler handler)
+{
+  if (id != connection || state != opening)
+    return handler(boost::asio::error::operation_aborted);
+  if (ec)
+  {
+    fail(ec, failed);
+    return handler(ec);
+  }
+
+  endpoints.assign(it, boost::asio::ip::tcp::resolver::iterator());
+  std::stable_partition(endpoints.begin(), endpoints.end(), detail::is_ipv4_endpoint);
+  boost::asio::async_connect(socket, endpoints.begin(), endpoints.end(), strand.wrap(boost::bind(
+    &async_client::handle_connect, shared_from_this(), boost::asio::placeholders::error, id, handler)));
+}
+
+inline void async_client::handle_connect(boost::system::error_code const& ec, std::size_t id, open_handler handler)
+{
+  if (id != connection || state != opening)
+    return handler(boost::asio::error::operation_aborted);
+  if (ec)
+  {
+    fail(ec, failed);
+    return handler(ec);
+  }
+
+  options.apply(socket);
+  state = open;
+  opened = true;
+  start_read();
+  start_write();
+  handler(ec);
+}
+
+inline void async_client::async_call(std::string const& message, reply_handler handler)
+{
+  // framing is done by the caller's thread
+  call_ptr c = boost::make_shared<pending_call>();
+  c->frame.resize(sizeof(uint32_t) + message.size());
+  const uint32_t size = htonl(static_cast<uint32_t>(message.size()));
+  std::memcpy(&c->frame[0], &size, sizeof(size));
+  if (!message.empty())
+    std::memcpy(&c->frame[sizeof(size)], message.data(), message.size());
+  c->handler = handler;
+  c->seqid = 0;
+  c->caller_seqid = 0U;
+  c->oneway = false;
+
+  ++outstanding_;
+  strand.dispatch(boost::bind(&async_client::enqueue, shared_from_this(), c));
+}
+
+inline async_client::reply_future async_client::call(std::string const& message)
+{
+  detail::reply_promise promise;
+  async_call(message, promise);
+  return promise.get_future();
+}
+
+inline void async_client::enqueue(call_ptr c)
+{
+  if (state == closed || state == failed)
+  {
+    --outstanding_;
+    get_io_service().post(boost::bind(c->handler, boost::asio::error::not_connected, std::string()));
+    return;
+  }
+  if (matching == by_seqid && !assign_seqid(*c))
+  {
+    --outstanding_;
+    get_io_service().post(boost::bind(c->handler, boost::asio::error::invalid_argument, std::string()));
+    return;
+  }
+  if (matching == in_order)
+  {
+    // oneway calls must not take the place of a reply
+    uint8_t type = 0U;
+    c->oneway = detail::binary_seqid_offset(c->frame.data() + sizeof(uint32_t), c->frame.size() - sizeof(uint32_t), type)
+      && type == apache::thrift::protocol::T_ONEWAY;
+  }
+
+  queued.push_back(c);
+  if (state == open)
+    start_write();
+}
+
+// Replaces the caller's sequence id in the frame with one not awaited yet.
+inline bool async_client::assign_seqid(pending_call& c)
+{
+  uint8_t type = 0U;
+  const std::size_t offset = detail::binary_seqid_offset(c.frame.data() + sizeof(uint32_t),
+    c.frame.size() - sizeof(uint32_t), type);
+  if (!offset)
+    return false;
+
+  c.oneway = type == apache::thrift::protocol::T_ONEWAY;
+  if (c.oneway)
+    return true;
+
+  do
+    c.seqid = static_cast<int32_t>(next_seqid++);
+  while (awaiting_seqid.count(c.seqid));
+
+  char* seqid = &c.frame[sizeof(uint32_t) + offset];
+  std::memcpy(&c.caller_seqid, seqid, sizeof(c.caller_seqid));
+  const uint32_t id = htonl(static_cast<uint32_t>(c.seqid));
+  std::memcpy(seqid, &id, sizeof(id));
+  return true;
+}
+
+// All queued frames are written at once.
+inline void async_client::start_write()
+{
+  if (writing || queued.empty())
+    return;
+
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.reserve(queued.size());
+  written.reserve(queued.size());
+  for (std::deque<call_ptr>::iterator it = queued.begin(); it != queued.end(); ++it)
+  {
+    buffers.push_back(boost::asio::buffer((*it)->frame));
+    written.push_back(*it);
+    if ((*it)->oneway)
+      continue;
+    if (matching == in_order)
+      awaiting.push_back(*it);
+    else
+      awaiting_seqid[(*it)->seqid] = *it;
+  }
+  queued.clear();
+
+  writing = true;
+  boost::asio::async_write(socket, buffers, strand.wrap(boost::bind(&async_client::handle_write,
+    shared_from_this(), boost::asio::placeholders::error, connection)));
+}
+
+// Frames are kept until written, also when the connection has failed
+// meanwhile, a new connection starts writing after that.
+inline void async_client::handle_write(boost::system::error_code const& ec, std::size_t id)
+{
+  writing = false;
+  std::vector<call_ptr> calls;
+  calls.swap(written);
+  std::string empty;
+  for (std::size_t i = 0; i < calls.size(); ++i)
+  {
+    std::string().swap(calls[i]->frame);
+    // oneway calls have no reply, handlers may start another write
+    if (calls[i]->oneway)
+    {
+      --outstanding_;
+      calls[i]->handler(ec, empty);
+      empty.clear();
+    }
+  }
+
+  if (state != open)
+    return;
+  if (ec && id == connection)
+    return fail(ec, failed);
+  start_write();
+}
+
+inline void async_client::start_read()
+{
+  boost::asio::async_read(socket, boost::asio::buffer(header, sizeof(header)), strand.wrap(
+    boost::bind(&async_client::handle_header, shared_from_this(), boost::asio::placeholders::error, connection)));
+}
+
+inline void async_client::handle_header(boost::system::error_code const& ec, std::size_t id)
+{
+  if (id != connection || state != open)
+    return;
+  if (ec)
+    return fail(ec, failed);
+
+  uint32_t size = 0U;
+  std::memcpy(&size, header, sizeof(header));
+  size = ntohl(size);
+  if (size > max_frame_size)
+    return fail(boost::asio::error::message_size, failed);
+
+  reply.resize(size);
+  if (!size)
+    return handle_body(ec, id);
+  boost::asio::async_read(socket, boost::asio::buffer(&reply[0], size), strand.wrap(
+    boost::bind(&async_client::handle_body, shared_from_this(), boost::asio::placeholders::error, id)));
+}
+
+inline void async_client::handle_body(boost::system::error_code const& ec, std::size_t id)
+{
+  if (id != connection || state != open)
+    return;
+  if (ec)
+    return fail(ec, failed);
+
+  call_ptr c;
+  if (matching == in_order)
+  {
+    // a reply nobody has asked for breaks the order of replies
+    if (awaiting.empty())
+      return fail(boost::system::errc::make_error_code(boost::system::errc::protocol_error), failed);
+
+    c = awaiting.front();
+    awaiting.pop_front();
+  }
+  else
+  {
+    uint8_t type = 0U;
+    const std::size_t offset = detail::binary_seqid_offset(reply.data(), reply.size(), type);
+    int32_t seqid = 0;
+    if (offset)
+    {
+      std::memcpy(&seqid, &reply[offset], sizeof(seqid));
+      seqid = static_cast<int32_t>(ntohl(static_cast<uint32_t>(seqid)));
+    }
+    std::map<int32_t, call_ptr>::iterator it = awaiting_seqid.find(seqid);
+    if (!offset || it == awaiting_seqid.end())
+      return fail(boost::system::errc::make_error_code(boost::system::errc::protocol_error), failed);
+
+    c = it->second;
+    awaiting_seqid.erase(it);
+    std::memcpy(&reply[offset], &c->caller_seqid, sizeof(c->caller_seqid));
+  }
+  --outstanding_;
+  c->handler(ec, reply);
+  // handler may have closed the client
+  if (id == connection && state == open)
+    start_read();
+}
+
+inline void async_client::close()
+{
+  strand.dispatch(boost::bind(&async_client::fail, shared_from_this(),
+    boost::system::error_code(boost::asio::error::operation_aborted), closed));
+}
+
+// Completes every outstanding call with ec.
+inline void async_client::fail(boost::system::error_code const& ec, state_type next)
+{
+  if (state == closed || state == failed)
+  {
+    if (next == closed)
+      state = closed;
+    return;
+  }
+
+  state = next;
+  opened = false;
+  boost::system::error_code ignored;
+  resolver.cancel();
+  socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+  socket.close(ignored);
+
+  std::deque<call_ptr> calls;
+  calls.swap(awaiting);
+  for (std::map<int32_t, call_ptr>::iterator it = awaiting_seqid.begin(); it != awaiting_seqid.end(); ++it)
+    calls.push_back(it->second);
+  awaiting_seqid.clear();
+  calls.insert(calls.end(), queued.begin(), queued.end());
+  queued.clear();
+
+  std::string empty;
+  for (std::deque<call_ptr>::iterator it = calls.begin(); it != calls.end(); ++it)
+  {
+    --outstanding_;
+    (*it)->handler(ec, empty);
+    empty.clear();
+  }
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_TRANSPORT_TCP_ASYNC_CLIENT_IPP_
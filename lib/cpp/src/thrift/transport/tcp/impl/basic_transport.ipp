@@ -25,20 +25,23 @@
 #include <thrift/config.hpp>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 #include <boost/asio.hpp>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/lexical_cast.hpp>
 #include <thrift/transport/TTransportException.h>
+#include <thrift/transport/tcp/resolver_cache.hpp>
 #include <thrift/transport/tcp/detail/socket_ops.hpp>
 
 namespace apache { namespace thrift { namespace transport { namespace tcp {
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE basic_transport<Stream, TransportImpl, BindingMode>::
-basic_transport(std::string const& addr, port_type p) try
-  : io_service(get_io_service()), address(addr), port(boost::lexical_cast<std::string>(p))
+basic_transport(std::string const& addr, port_type p, socket_options const& o) try
+  : io_service(get_io_service()), address(addr), port(boost::lexical_cast<std::string>(p)), options(o),
+    read_buffer(4096U), read_buffer_size(4096U), read_begin(0U), read_end(0U)
 {}
 catch (boost::bad_lexical_cast const&)
 {
@@ -46,29 +49,32 @@ catch (boost::bad_lexical_cast const&)
   ( ::apache::thrift::transport::TTransportException::UNKNOWN, "Invalid port." ) );
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE basic_transport<Stream, TransportImpl, BindingMode>::
-basic_transport(std::string const& addr, std::string const& p)
-  : io_service(get_io_service()), address(addr), port(p)
+basic_transport(std::string const& addr, std::string const& p, socket_options const& o)
+  : io_service(get_io_service()), address(addr), port(p), options(o),
+    read_buffer(4096U), read_buffer_size(4096U), read_begin(0U), read_end(0U)
 {}
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE
-TransportImpl<Stream>& basic_transport<Stream, TransportImpl, BindingMode>::self()
+TransportImpl<Stream, BindingMode>& basic_transport<Stream, TransportImpl, BindingMode>::self()
 {
-  return static_cast<TransportImpl<Stream>&>(*this);
+  return static_cast<TransportImpl<Stream, BindingMode>&>(*this);
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 bool basic_transport<Stream, TransportImpl, BindingMode>::isOpen()
 {
   return self().get_socket().is_open();
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 bool basic_transport<Stream, TransportImpl, BindingMode>::peek()
 {
   io_op_precond_check();
+  if (read_begin != read_end)
+    return true;
 
   uint8_t buff = 0U;
   boost::system::error_code ec;
@@ -87,75 +93,118 @@ bool basic_transport<Stream, TransportImpl, BindingMode>::peek()
   }
 }
 
-#if defined(BOOST_NO_CXX11_LAMBDAS)
-namespace detail {
-
-bool is_ipv4(boost::asio::ip::tcp::endpoint const& endpoint)
-{
-  return endpoint.protocol() == boost::asio::ip::tcp::v4();
-}
-
-} // detail
-#endif
-
 #define IS_TIMEOUT(tv) tv > boost::posix_time::microseconds(0)
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 void basic_transport<Stream, TransportImpl, BindingMode>::open() try
 {
-  boost::asio::ip::tcp::resolver resolver(*io_service);
-  boost::asio::ip::tcp::resolver::query query(address, port);
-  std::vector<boost::asio::ip::tcp::endpoint> endpoints(resolver.resolve(query),
-    boost::asio::ip::tcp::resolver::iterator());
-
-#if !defined(BOOST_NO_CXX11_LAMBDAS) && !defined(BOOST_NO_CXX11_AUTO_DECLARATIONS)
-  auto is_ipv4 = [](boost::asio::ip::tcp::endpoint const& endpoint) {
-    return endpoint.protocol() == boost::asio::ip::tcp::v4();
-  };
-#else
-// local classes can be template arguments in C++11,
-// but lambda expressions are part of C++11 as well
-// so this predicate is defined outside, in detail
-// namespace scope due to conformance with C++98/C++03.
-// for the same reasons non-member versions of begin()/end()
-// aren't used.
-  using detail::is_ipv4;
-#endif
-  std::stable_partition( endpoints.begin(), endpoints.end(), is_ipv4 );
+  const resolver_cache_ptr cache = get_resolver_cache();
+  const resolver_cache::endpoints_type endpoints = cache->resolve(address, port);
+  read_begin = read_end = 0U;
 
-  using detail::async_connect_op;
+  try
+  {
+    detail::connect_endpoints(self().get_socket(), endpoints, connect_timeout);
+  }
+  catch (boost::system::system_error const&)
+  {
+    // the host may have moved, resolve it again next time
+    cache->invalidate(address, port);
+    throw;
+  }
 
-  if (IS_TIMEOUT(connect_timeout))
-    detail::operation_with_timeout<async_connect_op>(self().get_socket(),
-      endpoints, connect_timeout);
-  else
-    boost::asio::connect(self().get_socket(), endpoints.begin(), endpoints.end());
+  options.apply(self().get_socket());
+  if (IS_TIMEOUT(recv_timeout))
+    detail::set_socket_timeout(self().get_socket(), SO_RCVTIMEO, recv_timeout);
+  if (IS_TIMEOUT(send_timeout))
+    detail::set_socket_timeout(self().get_socket(), SO_SNDTIMEO, send_timeout);
 }
 catch (boost::system::system_error const& e)
 {
-  BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(e.what()));
+  BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(e.code() == boost::asio::error::timed_out
+    ? apache::thrift::transport::TTransportException::TIMED_OUT : apache::thrift::transport::TTransportException::UNKNOWN,
+    e.what()));
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 void basic_transport<Stream, TransportImpl, BindingMode>::close()
 {
   // Initiate graceful connection closure.
   boost::system::error_code ignored_ec;
   self().get_socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+  read_begin = read_end = 0U;
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 uint32_t basic_transport<Stream, TransportImpl, BindingMode>::read_virt(uint8_t* buf, uint32_t len)
+{
+  if (read_begin == read_end)
+  {
+    // large reads go to the caller's buffer directly
+    if (len >= read_buffer_size)
+      return self().read_socket(buf, len, false);
+
+    if (read_buffer.size() != read_buffer_size)
+      std::vector<uint8_t>(read_buffer_size).swap(read_buffer);
+    read_begin = 0U;
+    read_end = self().read_socket(&read_buffer[0], static_cast<uint32_t>(read_buffer.size()), true);
+  }
+
+  const uint32_t n = std::min(len, read_end - read_begin);
+  std::memcpy(buf, &read_buffer[read_begin], n);
+  read_begin += n;
+  return n;
+}
+
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
+BOOST_FORCEINLINE const uint8_t* basic_transport<Stream, TransportImpl, BindingMode>::borrow_virt(uint8_t* /*buf*/, uint32_t* len)
+{
+  // reading more could block, so only what is buffered is lent
+  if (read_end - read_begin < *len)
+#ifdef BOOST_NO_CXX11_NULLPTR
+    return 0;
+#else
+    return nullptr;
+#endif
+
+  *len = read_end - read_begin;
+  return &read_buffer[read_begin];
+}
+
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
+BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::consume_virt(uint32_t len)
+{
+  if (read_end - read_begin < len)
+    BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException\
+      (apache::thrift::transport::TTransportException::BAD_ARGS, "consume did not follow a borrow."));
+  read_begin += len;
+}
+
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
+void basic_transport<Stream, TransportImpl, BindingMode>::setReadBufferSize(uint32_t size)
+{
+  // buffered bytes are kept
+  const uint32_t buffered = read_end - read_begin;
+  read_buffer_size = size;
+  std::vector<uint8_t> resized(std::max(size, buffered));
+  if (buffered)
+    std::memcpy(&resized[0], &read_buffer[read_begin], buffered);
+  read_buffer.swap(resized);
+  read_begin = 0U;
+  read_end = buffered;
+}
+
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
+uint32_t basic_transport<Stream, TransportImpl, BindingMode>::read_socket(uint8_t* buf, uint32_t len, bool some)
 {
   io_op_precond_check();
 
   try
   {
-    using detail::async_read_op;
-
     if (IS_TIMEOUT(recv_timeout))
-      return detail::operation_with_timeout<async_read_op<boost::asio::mutable_buffers_1>
-        >(self().get_socket(), boost::asio::buffer(buf, len), recv_timeout);
+      return static_cast<uint32_t>(detail::recv_with_timeout(self().get_socket(), buf, len, some));
+    else if (some)
+      return self().get_socket().read_some(boost::asio::buffer(buf, len));
     else
       return boost::asio::read(self().get_socket(), boost::asio::buffer(buf, len));
   }
@@ -163,39 +212,42 @@ uint32_t basic_transport<Stream, TransportImpl, BindingMode>::read_virt(uint8_t*
   {
     if (e.code() == boost::asio::error::eof || e.code().value() == detail::econnreset)
       return 0;
+    if (e.code() == boost::asio::error::timed_out)
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException\
+        (apache::thrift::transport::TTransportException::TIMED_OUT, e.what()));
     BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(e.what()));
   }
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 uint32_t basic_transport<Stream, TransportImpl, BindingMode>::readAll_virt(uint8_t* buf, uint32_t len)
 {
-  return apache::thrift::transport::readAll(*this, buf, len);
+  return apache::thrift::transport::readAll(self(), buf, len);
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 void basic_transport<Stream, TransportImpl, BindingMode>::write_virt(const uint8_t* buf, uint32_t len)
 {
   io_op_precond_check();
 
   try
   {
-    using detail::async_write_op;
-
     if (IS_TIMEOUT(send_timeout))
-      detail::operation_with_timeout<async_write_op<boost::asio::const_buffers_1>
-        >(self().get_socket(), boost::asio::buffer(buf, len), send_timeout);
+      detail::send_with_timeout(self().get_socket(), buf, len);
     else
       boost::asio::write(self().get_socket(), boost::asio::buffer(buf, len));
   }
   catch (boost::system::system_error const& e)
   {
+    if (e.code() == boost::asio::error::timed_out)
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException\
+        (apache::thrift::transport::TTransportException::TIMED_OUT, e.what()));
     BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(e.what()));
   }
 }
 #undef IS_TIMEOUT
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setLinger(bool on, int linger) try
 {
   boost::asio::socket_base::linger option(on, linger);
@@ -207,7 +259,7 @@ catch (boost::system::system_error const& e)
   apache::thrift::GlobalOutput.perror(e.what(), errno_copy);
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setNoDelay(bool noDelay) try
 {
   boost::asio::ip::tcp::no_delay nodelay(noDelay);
@@ -219,25 +271,39 @@ catch (boost::system::system_error const& e)
   apache::thrift::GlobalOutput.perror(e.what(), errno_copy);
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setConnTimeout(int ms)
 {
   connect_timeout = boost::posix_time::milliseconds( ms );
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
-BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setRecvTimeout(int ms)
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
+BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setRecvTimeout(int ms) try
 {
   recv_timeout = boost::posix_time::milliseconds( ms );
+  if ( self().get_socket().is_open() )
+    detail::set_socket_timeout( self().get_socket(), SO_RCVTIMEO, recv_timeout );
+}
+catch (boost::system::system_error const& e)
+{
+  const int errno_copy = errno;
+  apache::thrift::GlobalOutput.perror(e.what(), errno_copy);
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
-BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setSendTimeout(int ms)
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
+BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::setSendTimeout(int ms) try
 {
   send_timeout = boost::posix_time::milliseconds( ms );
+  if ( self().get_socket().is_open() )
+    detail::set_socket_timeout( self().get_socket(), SO_SNDTIMEO, send_timeout );
+}
+catch (boost::system::system_error const& e)
+{
+  const int errno_copy = errno;
+  apache::thrift::GlobalOutput.perror(e.what(), errno_copy);
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::io_op_precond_check()
 {
   BOOST_ASSERT( io_service );
@@ -247,13 +313,13 @@ BOOST_FORCEINLINE void basic_transport<Stream, TransportImpl, BindingMode>::io_o
        "Cannot perform IO operation on not open socket.") );
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE std::string basic_transport<Stream, TransportImpl, BindingMode>::getHost() const
 {
   return address;
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE port_type basic_transport<Stream, TransportImpl, BindingMode>::getPort() const
 try {
   return boost::lexical_cast<port_type>(port);
@@ -264,7 +330,7 @@ catch (boost::bad_lexical_cast const&)
   (::apache::thrift::transport::TTransportException::UNKNOWN, "Invalid port."));
 }
 
-template <class Stream, template<class> class TransportImpl, class BindingMode>
+template <class Stream, template<class, class> class TransportImpl, class BindingMode>
 BOOST_FORCEINLINE int basic_transport<Stream, TransportImpl, BindingMode>::getSocketFD()
 {
   io_op_precond_check();
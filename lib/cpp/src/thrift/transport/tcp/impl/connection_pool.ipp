@@ -0,0 +1,354 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_CONNECTION_POOL_IPP_
+#define _THRIFT_TRANSPORT_TCP_CONNECTION_POOL_IPP_
+
+#include <thrift/transport/tcp/connection_pool.hpp>
+#include <thrift/transport/TTransportException.h>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/weak_ptr.hpp>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+typedef transport<boost::asio::ip::tcp::socket> pooled_transport;
+typedef boost::shared_ptr<pooled_transport> pooled_transport_ptr;
+typedef boost::chrono::steady_clock pool_clock;
+typedef std::pair<pooled_transport_ptr, pool_clock::time_point> idle_connection;
+
+// Idle connection is alive when the peer has neither closed it nor sent
+// anything. peek() of the transport blocks on an idle socket and does not
+// tell closed connections from idle ones, so the socket is peeked without
+// blocking.
+inline bool is_alive(pooled_transport& t)
+{
+  if (!t.isOpen())
+    return false;
+
+  boost::asio::ip::tcp::socket& s = t.get_socket();
+  boost::system::error_code ec;
+  s.non_blocking(true, ec);
+  if (ec)
+    return false;
+  uint8_t byte = 0U;
+  const std::size_t n = s.receive(boost::asio::buffer(&byte, 1), boost::asio::socket_base::message_peek, ec);
+  boost::system::error_code ignored;
+  s.non_blocking(false, ignored);
+  return !n && ec == boost::asio::error::would_block;
+}
+
+//  pool_endpoint   -----------------------------------------------//
+struct pool_endpoint
+{
+  pool_endpoint() : port(0U), checked_out(0U), pending(0U)
+  {}
+
+  std::size_t open() const
+  {
+    return idle.size() + checked_out + pending;
+  }
+
+  std::string address;
+  port_type port;
+  // most recently used last
+  std::deque<idle_connection> idle;
+  std::size_t checked_out;
+  // being opened or checked by the background thread
+  std::size_t pending;
+};
+
+//  pool_state   -----------------------------------------------//
+// Shared with transports handed out, so they can be dropped after the pool.
+struct pool_state : private boost::noncopyable
+{
+  explicit pool_state(pool_options const& o) : options(o), stopping(false)
+  {}
+
+  static std::string key(std::string const& address, port_type port)
+  {
+    return address + ":" + boost::lexical_cast<std::string>(port);
+  }
+
+  pooled_transport_ptr connect(std::string const& address, port_type port)
+  {
+    pooled_transport_ptr t = boost::make_shared<pooled_transport>(address, port, options.socket);
+    if (options.connect_timeout > 0)
+      t->setConnTimeout(options.connect_timeout);
+    t->open();
+    return t;
+  }
+
+  // Opens up to min_size connections of ep, called with lock held.
+  void fill(boost::unique_lock<boost::mutex>& lock, pool_endpoint& ep)
+  {
+    const std::size_t missing = ep.open() < options.min_size ? options.min_size - ep.open() : 0U;
+    if (!missing)
+      return;
+
+    ep.pending += missing;
+    std::vector<pooled_transport_ptr> opened;
+    lock.unlock();
+    for (std::size_t i = 0; i < missing; ++i)
+    {
+      try
+      {
+        opened.push_back(connect(ep.address, ep.port));
+      }
+      catch (TTransportException const& e)
+      {
+        apache::thrift::GlobalOutput.printf("Cannot open pooled connection to %s:%u: %s", ep.address.c_str(),
+          static_cast<unsigned>(ep.port), e.what());
+        break;
+      }
+    }
+    lock.lock();
+
+    ep.pending -= missing;
+    const pool_clock::time_point now = pool_clock::now();
+    for (std::size_t i = 0; i < opened.size(); ++i)
+      ep.idle.push_front(idle_connection(opened[i], now));
+    released.notify_all();
+  }
+
+  void checkin(std::string const& key, pooled_transport_ptr const& connection, bool reusable)
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (stopping)
+      return;
+    pool_endpoint& ep = endpoints[key];
+    --ep.checked_out;
+    if (reusable && connection->isOpen())
+      ep.idle.push_back(idle_connection(connection, pool_clock::now()));
+    released.notify_one();
+  }
+
+  // Closes idle connections expired or dead and reopens up to min_size.
+  void check()
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (std::map<std::string, pool_endpoint>::iterator it = endpoints.begin(); it != endpoints.end() && !stopping; ++it)
+    {
+      pool_endpoint& ep = it->second;
+      std::deque<idle_connection> checked;
+      checked.swap(ep.idle);
+      ep.pending += checked.size();
+      std::size_t open = ep.open();
+      lock.unlock();
+
+      const pool_clock::time_point expired = pool_clock::now() - options.idle_timeout;
+      std::deque<idle_connection> alive;
+      for (std::size_t i = 0; i < checked.size(); ++i)
+      {
+        // oldest first, so the least recently used are evicted
+        if ((checked[i].second < expired && open > options.min_size) || !is_alive(*checked[i].first))
+          --open;
+        else
+          alive.push_back(checked[i]);
+      }
+      const std::size_t count = checked.size();
+      checked.clear();
+
+      lock.lock();
+      ep.pending -= count;
+      ep.idle.insert(ep.idle.begin(), alive.begin(), alive.end());
+      fill(lock, ep);
+    }
+  }
+
+  // Body of the background thread.
+  void run()
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+      if (wake.wait_for(lock, options.check_interval) == boost::cv_status::timeout && !stopping)
+      {
+        lock.unlock();
+        check();
+        lock.lock();
+      }
+    }
+  }
+
+  pool_options options;
+  mutable boost::mutex mutex;
+  // connection checked in or opened
+  boost::condition_variable released;
+  // stopping set
+  boost::condition_variable wake;
+  bool stopping;
+  std::map<std::string, pool_endpoint> endpoints;
+  boost::thread checker;
+};
+
+//  checkin_deleter   -----------------------------------------------//
+// Deleter of transports handed out by connection_pool::checkout().
+struct checkin_deleter
+{
+  checkin_deleter(boost::shared_ptr<pool_state> const& p, std::string const& k, pooled_transport_ptr const& c)
+    : pool(p), key(k), connection(c), reusable(true)
+  {}
+
+  void operator()(apache::thrift::transport::TFramedTransport* t)
+  {
+    delete t;
+    if (boost::shared_ptr<pool_state> p = pool.lock())
+      p->checkin(key, connection, reusable);
+    connection.reset();
+  }
+
+  boost::weak_ptr<pool_state> pool;
+  std::string key;
+  pooled_transport_ptr connection;
+  bool reusable;
+};
+
+} // namespace detail
+
+inline connection_pool::connection_pool(pool_options const& options)
+  : state(boost::make_shared<detail::pool_state>(options))
+{
+  if (options.check_interval > boost::chrono::milliseconds::zero())
+    state->checker = boost::thread(boost::bind(&detail::pool_state::run, state.get()));
+}
+
+inline connection_pool::~connection_pool()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(state->mutex);
+    state->stopping = true;
+  }
+  state->wake.notify_all();
+  if (state->checker.joinable())
+    state->checker.join();
+
+  boost::lock_guard<boost::mutex> lock(state->mutex);
+  state->endpoints.clear();
+}
+
+inline void connection_pool::prewarm(std::string const& address, port_type port)
+{
+  boost::unique_lock<boost::mutex> lock(state->mutex);
+  detail::pool_endpoint& ep = state->endpoints[detail::pool_state::key(address, port)];
+  ep.address = address;
+  ep.port = port;
+  state->fill(lock, ep);
+}
+
+inline connection_pool::transport_ptr connection_pool::checkout(std::string const& address, port_type port)
+{
+  const std::string key = detail::pool_state::key(address, port);
+  const detail::pool_clock::time_point deadline = detail::pool_clock::now() + state->options.checkout_timeout;
+
+  boost::unique_lock<boost::mutex> lock(state->mutex);
+  detail::pool_endpoint& ep = state->endpoints[key];
+  ep.address = address;
+  ep.port = port;
+
+  detail::pooled_transport_ptr connection;
+  while (!connection)
+  {
+    if (!ep.idle.empty())
+    {
+      connection = ep.idle.back().first;
+      ep.idle.pop_back();
+      ++ep.checked_out;
+      lock.unlock();
+      const bool alive = detail::is_alive(*connection);
+      lock.lock();
+      if (!alive)
+      {
+        connection.reset();
+        --ep.checked_out;
+      }
+    }
+    else if (ep.open() < state->options.max_size)
+    {
+      ++ep.pending;
+      lock.unlock();
+      try
+      {
+        connection = state->connect(address, port);
+      }
+      catch (...)
+      {
+        lock.lock();
+        --ep.pending;
+        state->released.notify_one();
+        throw;
+      }
+      lock.lock();
+      --ep.pending;
+      ++ep.checked_out;
+    }
+    else if (state->released.wait_until(lock, deadline) == boost::cv_status::timeout)
+    {
+      BOOST_THROW_EXCEPTION(TTransportException(TTransportException::TIMED_OUT,
+        "No pooled connection to " + key + " available."));
+    }
+  }
+  lock.unlock();
+
+  return transport_ptr(new apache::thrift::transport::TFramedTransport(connection),
+    detail::checkin_deleter(state, key, connection));
+}
+
+inline void connection_pool::invalidate(transport_ptr const& transport)
+{
+  if (detail::checkin_deleter* d = boost::get_deleter<detail::checkin_deleter>(transport))
+    d->reusable = false;
+}
+
+inline std::size_t connection_pool::idle(std::string const& address, port_type port) const
+{
+  boost::lock_guard<boost::mutex> lock(state->mutex);
+  std::map<std::string, detail::pool_endpoint>::const_iterator it =
+    state->endpoints.find(detail::pool_state::key(address, port));
+  return it == state->endpoints.end() ? 0U : it->second.idle.size();
+}
+
+inline std::size_t connection_pool::checked_out(std::string const& address, port_type port) const
+{
+  boost::lock_guard<boost::mutex> lock(state->mutex);
+  std::map<std::string, detail::pool_endpoint>::const_iterator it =
+    state->endpoints.find(detail::pool_state::key(address, port));
+  return it == state->endpoints.end() ? 0U : it->second.checked_out;
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_TRANSPORT_TCP_CONNECTION_POOL_IPP_
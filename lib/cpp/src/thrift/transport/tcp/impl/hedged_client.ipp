@@ -0,0 +1,212 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_HEDGED_CLIENT_IPP_
+#define _THRIFT_TRANSPORT_TCP_HEDGED_CLIENT_IPP_
+
+#include <thrift/transport/tcp/hedged_client.hpp>
+#include <thrift/transport/TTransportException.h>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/locks.hpp>
+#include <algorithm>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+//  hedged_call   -----------------------------------------------//
+// State of a call, guarded by the mutex of its hedged_client.
+struct hedged_call : private boost::noncopyable
+{
+  hedged_call(boost::asio::io_service& io_service, std::string const& m, async_client::reply_handler const& h,
+    bool i)
+    : message(m), handler(h), timer(io_service), start(boost::chrono::steady_clock::now()), idempotent(i),
+      first(0U), sent(0U), failed(0U), done(false)
+  {}
+
+  std::string message;
+  async_client::reply_handler handler;
+  // sends the backup
+  boost::asio::deadline_timer timer;
+  boost::chrono::steady_clock::time_point start;
+  bool idempotent;
+  // client of the first attempt, the backup goes to the next one
+  std::size_t first;
+  std::size_t sent;
+  std::size_t failed;
+  bool done;
+};
+
+} // namespace detail
+
+inline hedged_client::pointer_type hedged_client::create(std::vector<async_client_ptr> const& clients,
+  hedge_options const& options)
+{
+  return pointer_type(new hedged_client(clients, options));
+}
+
+inline hedged_client::hedged_client(std::vector<async_client_ptr> const& c, hedge_options const& o)
+  : clients(c), options(o), next(0U), recorded(0U), current_delay(o.max_delay), tokens(o.burst), calls_(0U),
+    hedged_(0U), backup_wins_(0U)
+{
+  if (clients.empty())
+    BOOST_THROW_EXCEPTION(TTransportException(TTransportException::BAD_ARGS, "hedged_client needs a client."));
+  latencies.resize(std::max<std::size_t>(options.window, 1U));
+}
+
+inline void hedged_client::async_call(std::string const& message, bool idempotent, reply_handler handler)
+{
+  call_ptr c = boost::make_shared<detail::hedged_call>(boost::ref(clients.front()->get_io_service()),
+    message, handler, idempotent);
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    c->first = next;
+    next = (next + 1U) % clients.size();
+    c->sent = 1U;
+    ++calls_;
+    if (idempotent && clients.size() > 1U)
+    {
+      tokens = std::min(options.burst, tokens + options.budget);
+      c->timer.expires_from_now(boost::posix_time::microseconds(
+        boost::chrono::duration_cast<boost::chrono::microseconds>(current_delay).count()));
+      c->timer.async_wait(boost::bind(&hedged_client::handle_timer, shared_from_this(),
+        boost::asio::placeholders::error, c));
+    }
+  }
+  send(c, 0U);
+}
+
+inline hedged_client::reply_future hedged_client::call(std::string const& message, bool idempotent)
+{
+  detail::reply_promise promise;
+  async_call(message, idempotent, promise);
+  return promise.get_future();
+}
+
+inline void hedged_client::send(call_ptr const& c, std::size_t attempt)
+{
+  clients[(c->first + attempt) % clients.size()]->async_call(c->message, boost::bind(&hedged_client::handle_reply,
+    shared_from_this(), _1, _2, c, attempt));
+}
+
+inline void hedged_client::handle_reply(boost::system::error_code const& ec, std::string& reply, call_ptr c,
+  std::size_t attempt)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  if (c->done)
+    return;
+
+  if (ec)
+  {
+    // the other attempt may still succeed
+    if (++c->failed < c->sent)
+      return;
+    if (c->idempotent && c->sent == 1U && clients.size() > 1U && start_backup(c))
+    {
+      lock.unlock();
+      return send(c, 1U);
+    }
+  }
+  else
+  {
+    record(clock::now() - c->start);
+    if (attempt)
+      ++backup_wins_;
+  }
+
+  c->done = true;
+  boost::system::error_code ignored;
+  c->timer.cancel(ignored);
+  lock.unlock();
+  c->handler(ec, reply);
+}
+
+inline void hedged_client::handle_timer(boost::system::error_code const& ec, call_ptr c)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+  if (c->done || c->sent > 1U || !start_backup(c))
+    return;
+  lock.unlock();
+  send(c, 1U);
+}
+
+inline bool hedged_client::start_backup(call_ptr const& c)
+{
+  if (tokens < 1.0)
+    return false;
+  tokens -= 1.0;
+  ++c->sent;
+  ++hedged_;
+  return true;
+}
+
+inline void hedged_client::record(clock::duration latency)
+{
+  latencies[recorded % latencies.size()] = latency;
+  ++recorded;
+  // the percentile is recomputed after every 1/16 of the window
+  if (recorded < options.min_samples || recorded % std::max<std::size_t>(latencies.size() / 16U, 1U))
+    return;
+
+  std::vector<clock::duration> sorted(latencies.begin(),
+    latencies.begin() + static_cast<std::ptrdiff_t>(std::min(recorded, latencies.size())));
+  const std::size_t n = static_cast<std::size_t>(static_cast<double>(sorted.size() - 1U) * options.percentile);
+  std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(n), sorted.end());
+  current_delay = std::min<clock::duration>(std::max<clock::duration>(sorted[n], options.min_delay),
+    options.max_delay);
+}
+
+inline boost::chrono::microseconds hedged_client::delay() const
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return boost::chrono::duration_cast<boost::chrono::microseconds>(current_delay);
+}
+
+inline std::size_t hedged_client::calls() const
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return calls_;
+}
+
+inline std::size_t hedged_client::hedged() const
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return hedged_;
+}
+
+inline std::size_t hedged_client::backup_wins() const
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return backup_wins_;
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_TRANSPORT_TCP_HEDGED_CLIENT_IPP_
@@ -0,0 +1,161 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_MULTIPLEXED_TRANSPORT_IPP_
+#define _THRIFT_TRANSPORT_TCP_MULTIPLEXED_TRANSPORT_IPP_
+
+#include <thrift/transport/tcp/multiplexed_transport.hpp>
+#include <thrift/transport/TTransportException.h>
+#include <boost/assert.hpp>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+//  open_promise   -----------------------------------------------//
+// Handler of async_client::async_open() waited for by a blocking caller.
+class open_promise
+{
+public:
+  typedef void result_type;
+
+  open_promise() : promise(boost::make_shared<boost::promise<boost::system::error_code> >())
+  {}
+
+#ifdef BOOST_THREAD_PROVIDES_FUTURE
+  boost::future<boost::system::error_code> get_future()
+#else
+  boost::unique_future<boost::system::error_code> get_future()
+#endif
+  {
+    return promise->get_future();
+  }
+
+  void operator()(boost::system::error_code const& ec)
+  {
+    promise->set_value(ec);
+  }
+
+private:
+  boost::shared_ptr<boost::promise<boost::system::error_code> > promise;
+};
+
+} // namespace detail
+
+inline multiplexed_transport::multiplexed_transport(async_client_ptr c) : client(c), reply_offset(0U)
+{
+  BOOST_ASSERT(client->get_reply_matching() == async_client::by_seqid);
+}
+
+inline async_client_ptr multiplexed_transport::get_client() const
+{
+  return client;
+}
+
+inline bool multiplexed_transport::isOpen()
+{
+  return client->is_open();
+}
+
+inline bool multiplexed_transport::peek()
+{
+  return reply_offset < reply.size() || pending.valid();
+}
+
+inline void multiplexed_transport::open()
+{
+  if (client->is_open())
+    return;
+
+  detail::open_promise promise;
+  client->async_open(promise);
+  const boost::system::error_code ec = promise.get_future().get();
+  // opened by another thread meanwhile
+  if (ec && ec != boost::asio::error::already_connected)
+    BOOST_THROW_EXCEPTION(TTransportException(TTransportException::NOT_OPEN, ec.message()));
+}
+
+inline void multiplexed_transport::close()
+{
+  pending = async_client::reply_future();
+  reply.clear();
+  reply_offset = 0U;
+}
+
+inline uint32_t multiplexed_transport::read_virt(uint8_t* buf, uint32_t len)
+{
+  if (reply_offset == reply.size())
+  {
+    if (!pending.valid())
+      BOOST_THROW_EXCEPTION(TTransportException(TTransportException::NOT_OPEN, "No reply awaited."));
+
+    async_client::reply_future received;
+    received.swap(pending);
+    reply = received.get();
+    reply_offset = 0U;
+  }
+
+  const std::size_t n = std::min(static_cast<std::size_t>(len), reply.size() - reply_offset);
+  std::memcpy(buf, reply.data() + reply_offset, n);
+  reply_offset += n;
+  return static_cast<uint32_t>(n);
+}
+
+inline uint32_t multiplexed_transport::readEnd()
+{
+  const uint32_t bytes = static_cast<uint32_t>(reply_offset);
+  reply.clear();
+  reply_offset = 0U;
+  return bytes;
+}
+
+inline void multiplexed_transport::write_virt(const uint8_t* buf, uint32_t len)
+{
+  request.append(reinterpret_cast<const char*>(buf), len);
+}
+
+inline uint32_t multiplexed_transport::writeEnd()
+{
+  return static_cast<uint32_t>(request.size());
+}
+
+// Reply of a previous call which has not been read is dropped, oneway calls
+// are not waited for.
+inline void multiplexed_transport::flush()
+{
+  if (request.empty())
+    return;
+
+  reply.clear();
+  reply_offset = 0U;
+  pending = client->call(request);
+  request.clear();
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_TRANSPORT_TCP_MULTIPLEXED_TRANSPORT_IPP_
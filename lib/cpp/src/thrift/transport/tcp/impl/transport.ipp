@@ -27,19 +27,24 @@
 namespace apache { namespace thrift { namespace transport { namespace tcp {
 
 #if !defined(HAS_INHERITING_CONSTRUCTORS)
+template <class BindingMode>
 BOOST_FORCEINLINE
-transport<boost::asio::ip::tcp::socket>::transport(std::string const& address, port_type port)
-  : basic_transport(address, port), socket(*io_service)
+transport<boost::asio::ip::tcp::socket, BindingMode>::transport(std::string const& address, port_type port,
+  socket_options const& options)
+  : base_type(address, port, options), socket(*this->io_service)
 {}
 
-BOOST_FORCEINLINE 
-transport<boost::asio::ip::tcp::socket>::transport(std::string const& address, std::string const& port)
-  : basic_transport(address, port), socket(*io_service)
+template <class BindingMode>
+BOOST_FORCEINLINE
+transport<boost::asio::ip::tcp::socket, BindingMode>::transport(std::string const& address, std::string const& port,
+  socket_options const& options)
+  : base_type(address, port, options), socket(*this->io_service)
 {}
 #endif
 
-transport<boost::asio::ip::tcp::socket>::socket_reference
-  transport<boost::asio::ip::tcp::socket>::get_socket()
+template <class BindingMode>
+BOOST_FORCEINLINE typename transport<boost::asio::ip::tcp::socket, BindingMode>::socket_reference
+  transport<boost::asio::ip::tcp::socket, BindingMode>::get_socket()
 {
   return socket;
 }
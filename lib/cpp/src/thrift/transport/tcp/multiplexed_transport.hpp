@@ -0,0 +1,76 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_MULTIPLEXED_TRANSPORT_HPP_
+#define _THRIFT_TRANSPORT_TCP_MULTIPLEXED_TRANSPORT_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/tcp/async_client.hpp>
+#include <string>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+//  multiplexed_transport   -----------------------------------------------//
+// Blocking client transport over a connection shared by many threads. Each
+// thread uses its own multiplexed_transport (and generated client) over one
+// async_client matching replies by_seqid: flush() sends the buffered message
+// as a call and reading waits for its reply, so callers may use the same
+// sequence ids. Replies are taken in any order, but tcp::server replies in
+// the order of calls on a connection, so there a slow call still delays
+// the calls sent after it. Messages must be serialized by TBinaryProtocol.
+// io_service of the client has to be run by another thread, open() and
+// close() do not affect the shared connection once it is open.
+class multiplexed_transport : public apache::thrift::transport::TTransport
+{
+public:
+  explicit multiplexed_transport(async_client_ptr client);
+
+  bool isOpen();
+  bool peek();
+  // Opens the shared connection unless it is open already.
+  void open();
+  // Drops the reply awaited by this transport.
+  void close();
+  uint32_t read_virt(uint8_t* buf, uint32_t len);
+  uint32_t readEnd();
+  void write_virt(const uint8_t* buf, uint32_t len);
+  uint32_t writeEnd();
+  void flush();
+
+  async_client_ptr get_client() const;
+
+private:
+  async_client_ptr client;
+  std::string request;
+  async_client::reply_future pending;
+  std::string reply;
+  std::size_t reply_offset;
+};
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#include <thrift/transport/tcp/impl/multiplexed_transport.ipp>
+
+#endif // _THRIFT_TRANSPORT_TCP_MULTIPLEXED_TRANSPORT_HPP_
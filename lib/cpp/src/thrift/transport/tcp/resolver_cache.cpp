@@ -0,0 +1,164 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/config.hpp>
+#include <thrift/Thrift.h>
+#include <thrift/transport/tcp/resolver_cache.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace {
+
+std::string make_key(std::string const& host, std::string const& port)
+{
+  return host + ":" + port;
+}
+
+} // namespace
+
+resolver_cache::resolver_cache(boost::chrono::seconds t, boost::chrono::seconds s) : ttl(t), stale_ttl(s)
+{}
+
+resolver_cache::~resolver_cache()
+{
+  refresher_work.reset();
+  refresher.stop();
+  if (refresher_thread.joinable())
+    refresher_thread.join();
+}
+
+resolver_cache::endpoints_type resolver_cache::lookup(std::string const& host, std::string const& port)
+{
+  boost::asio::io_service io_service;
+  boost::asio::ip::tcp::resolver resolver(io_service);
+  boost::asio::ip::tcp::resolver::query query(host, port);
+  return endpoints_type(resolver.resolve(query), boost::asio::ip::tcp::resolver::iterator());
+}
+
+resolver_cache::endpoints_type resolver_cache::resolve(std::string const& host, std::string const& port)
+{
+  const std::string key = make_key(host, port);
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::map<std::string, entry>::iterator it = entries.find(key);
+    if (it != entries.end())
+    {
+      const clock::duration age = clock::now() - it->second.resolved;
+      if (age < ttl)
+        return it->second.endpoints;
+
+      if (age < ttl + stale_ttl)
+      {
+        if (!it->second.refreshing)
+        {
+          try
+          {
+            if (!refresher_thread.joinable())
+            {
+              refresher_work.reset(new boost::asio::io_service::work(refresher));
+              refresher_thread = boost::thread(boost::bind(&boost::asio::io_service::run, &refresher));
+            }
+            refresher.post(boost::bind(&resolver_cache::refresh, this, host, port));
+            it->second.refreshing = true;
+          }
+          catch (boost::thread_resource_error const& e)
+          {
+            apache::thrift::GlobalOutput.printf("Cannot refresh %s: %s", key.c_str(), e.what());
+          }
+        }
+        return it->second.endpoints;
+      }
+    }
+  }
+
+  const endpoints_type endpoints = lookup(host, port);
+  boost::lock_guard<boost::mutex> lock(mutex);
+  entry& e = entries[key];
+  e.endpoints = endpoints;
+  e.resolved = clock::now();
+  return endpoints;
+}
+
+void resolver_cache::refresh(std::string const& host, std::string const& port)
+{
+  endpoints_type endpoints;
+  try
+  {
+    endpoints = lookup(host, port);
+  }
+  catch (boost::system::system_error const& e)
+  {
+    // stale endpoints are used until they expire
+    apache::thrift::GlobalOutput.printf("Cannot refresh %s:%s: %s", host.c_str(), port.c_str(), e.what());
+  }
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  std::map<std::string, entry>::iterator it = entries.find(make_key(host, port));
+  if (it == entries.end())
+    return;
+
+  it->second.refreshing = false;
+  if (!endpoints.empty())
+  {
+    it->second.endpoints.swap(endpoints);
+    it->second.resolved = clock::now();
+  }
+}
+
+void resolver_cache::invalidate(std::string const& host, std::string const& port)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  entries.erase(make_key(host, port));
+}
+
+void resolver_cache::clear()
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  entries.clear();
+}
+
+void resolver_cache::set_ttl(boost::chrono::seconds t, boost::chrono::seconds s)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  ttl = t;
+  stale_ttl = s;
+}
+
+std::size_t resolver_cache::size() const
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return entries.size();
+}
+
+resolver_cache_ptr get_resolver_cache()
+{
+  static resolver_cache_ptr instance = boost::make_shared<resolver_cache>();
+  return instance;
+}
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
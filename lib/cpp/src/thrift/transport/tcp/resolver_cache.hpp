@@ -0,0 +1,106 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_RESOLVER_CACHE_HPP_
+#define _THRIFT_TRANSPORT_TCP_RESOLVER_CACHE_HPP_
+
+#include <thrift/config.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/chrono/duration.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+//  resolver_cache   -----------------------------------------------//
+// Endpoints of resolved host and port shared by client transports. An entry
+// is used for ttl, after that it is still returned for up to stale_ttl while
+// a background thread resolves it again, so only the first open of a host
+// waits for the resolver. Stale entries are refreshed one after another by
+// a single thread of the cache. basic_transport drops the entry when no
+// endpoint accepts a connection, the next open resolves the host again.
+class resolver_cache : private boost::noncopyable
+{
+public:
+  typedef std::vector<boost::asio::ip::tcp::endpoint> endpoints_type;
+
+  explicit resolver_cache(boost::chrono::seconds ttl = boost::chrono::seconds(60),
+    boost::chrono::seconds stale_ttl = boost::chrono::seconds(60));
+
+  // Drops pending refreshes and waits for the running one.
+  ~resolver_cache();
+
+  // Throws boost::system::system_error if host cannot be resolved.
+  endpoints_type resolve(std::string const& host, std::string const& port);
+
+  void invalidate(std::string const& host, std::string const& port);
+  void clear();
+
+  void set_ttl(boost::chrono::seconds ttl, boost::chrono::seconds stale_ttl);
+
+  // Number of cached entries.
+  std::size_t size() const;
+
+private:
+  typedef boost::chrono::steady_clock clock;
+
+  struct entry
+  {
+    entry() : refreshing(false)
+    {}
+
+    endpoints_type endpoints;
+    clock::time_point resolved;
+    bool refreshing;
+  };
+
+  static endpoints_type lookup(std::string const& host, std::string const& port);
+  void refresh(std::string const& host, std::string const& port);
+
+  mutable boost::mutex mutex;
+  std::map<std::string, entry> entries;
+  clock::duration ttl, stale_ttl;
+
+  // Refreshes of stale entries, the thread starts with the first one.
+  boost::asio::io_service refresher;
+  boost::scoped_ptr<boost::asio::io_service::work> refresher_work;
+  boost::thread refresher_thread;
+};
+
+typedef boost::shared_ptr<resolver_cache> resolver_cache_ptr;
+
+// Cache of the process, used by basic_transport::open().
+resolver_cache_ptr get_resolver_cache();
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_TRANSPORT_TCP_RESOLVER_CACHE_HPP_
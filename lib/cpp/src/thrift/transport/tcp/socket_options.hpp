@@ -0,0 +1,233 @@
+// Copyright (c) 2013 Lukasz Gwizdz.
+// Home at: https://github.com/gwizdz/thrift
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCP_SOCKET_OPTIONS_HPP_
+#define _THRIFT_TRANSPORT_TCP_SOCKET_OPTIONS_HPP_
+
+#include <thrift/config.hpp>
+#include <thrift/Thrift.h>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/optional.hpp>
+#include <boost/system/error_code.hpp>
+#if defined(__linux__) || defined(__APPLE__)
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+#endif
+
+namespace apache { namespace thrift { namespace transport { namespace tcp {
+
+namespace detail {
+
+//  integer_option   -----------------------------------------------//
+// SettableSocketOption for options that are not provided by boost::asio.
+template <int Level, int Name>
+class integer_option
+{
+public:
+  explicit integer_option(int v) : value(v)
+  {}
+
+  template <class Protocol>
+  int level(Protocol const&) const
+  {
+    return Level;
+  }
+
+  template <class Protocol>
+  int name(Protocol const&) const
+  {
+    return Name;
+  }
+
+  template <class Protocol>
+  const int* data(Protocol const&) const
+  {
+    return &value;
+  }
+
+  template <class Protocol>
+  std::size_t size(Protocol const&) const
+  {
+    return sizeof(value);
+  }
+
+private:
+  int value;
+};
+
+// Failure to set an option is reported and does not close the socket.
+template <class Socket, class Option>
+void set_socket_option(Socket& s, Option const& option, const char* name)
+{
+  boost::system::error_code ec;
+  s.set_option(option, ec);
+  if (ec)
+    apache::thrift::GlobalOutput.printf("Cannot set socket option %s: %s", name, ec.message().c_str());
+}
+
+} // namespace detail
+
+//  socket_options   -----------------------------------------------//
+// Profile of socket options shared by servers and client transports. Unset
+// options are left at system defaults, options not supported by the platform
+// are ignored. Listening socket options (backlog, defer_accept) are used by
+// servers only, buffer sizes are also set on the listening socket so accepted
+// sockets inherit them before the handshake.
+struct socket_options
+{
+  boost::optional<bool> no_delay;                   // TCP_NODELAY
+  boost::optional<bool> keep_alive;                 // SO_KEEPALIVE
+  boost::optional<int> keep_alive_idle;             // TCP_KEEPIDLE, seconds
+  boost::optional<int> keep_alive_interval;         // TCP_KEEPINTVL, seconds
+  boost::optional<int> keep_alive_count;            // TCP_KEEPCNT
+  boost::optional<int> linger;                      // SO_LINGER seconds, negative turns it off
+  boost::optional<int> receive_buffer_size;         // SO_RCVBUF
+  boost::optional<int> send_buffer_size;            // SO_SNDBUF
+  boost::optional<bool> quick_ack;                  // TCP_QUICKACK, Linux
+  boost::optional<int> user_timeout;                // TCP_USER_TIMEOUT, milliseconds, Linux
+  boost::optional<int> not_sent_low_watermark;      // TCP_NOTSENT_LOWAT, bytes
+  boost::optional<int> backlog;                     // listen() backlog
+  boost::optional<int> defer_accept;                // TCP_DEFER_ACCEPT, seconds, Linux
+
+  // Options the servers have always set: linger off, keep-alive, no delay.
+  static socket_options defaults()
+  {
+    socket_options o;
+    o.linger = -1;
+    o.keep_alive = true;
+    o.no_delay = true;
+    return o;
+  }
+
+  // Small request/reply traffic: acknowledgements are not delayed and only
+  // a little unsent data is queued in the kernel, dead peers are detected
+  // within a minute.
+  static socket_options low_latency()
+  {
+    socket_options o = defaults();
+    o.quick_ack = true;
+    o.not_sent_low_watermark = 16 * 1024;
+    o.keep_alive_idle = 30;
+    o.keep_alive_interval = 5;
+    o.keep_alive_count = 3;
+    o.user_timeout = 30000;
+    return o;
+  }
+
+  // Large payloads: big kernel buffers, accept is completed when the first
+  // request arrives.
+  static socket_options throughput()
+  {
+    socket_options o = defaults();
+    o.receive_buffer_size = 4 * 1024 * 1024;
+    o.send_buffer_size = 4 * 1024 * 1024;
+    o.defer_accept = 5;
+    o.backlog = 1024;
+    return o;
+  }
+
+  // Applies options to connected or accepted socket.
+  template <class Socket>
+  void apply(Socket& s) const
+  {
+    using detail::set_socket_option;
+    using detail::integer_option;
+
+    if (no_delay)
+      set_socket_option(s, boost::asio::ip::tcp::no_delay(*no_delay), "TCP_NODELAY");
+    if (keep_alive)
+      set_socket_option(s, boost::asio::socket_base::keep_alive(*keep_alive), "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE)
+    if (keep_alive_idle)
+      set_socket_option(s, integer_option<IPPROTO_TCP, TCP_KEEPIDLE>(*keep_alive_idle), "TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+    if (keep_alive_idle)
+      set_socket_option(s, integer_option<IPPROTO_TCP, TCP_KEEPALIVE>(*keep_alive_idle), "TCP_KEEPALIVE");
+#endif
+#if defined(TCP_KEEPINTVL)
+    if (keep_alive_interval)
+      set_socket_option(s, integer_option<IPPROTO_TCP, TCP_KEEPINTVL>(*keep_alive_interval), "TCP_KEEPINTVL");
+#endif
+#if defined(TCP_KEEPCNT)
+    if (keep_alive_count)
+      set_socket_option(s, integer_option<IPPROTO_TCP, TCP_KEEPCNT>(*keep_alive_count), "TCP_KEEPCNT");
+#endif
+    if (linger)
+      set_socket_option(s, boost::asio::socket_base::linger(*linger >= 0, *linger >= 0 ? *linger : 0), "SO_LINGER");
+    apply_buffer_sizes(s);
+    refresh(s);
+#if defined(TCP_USER_TIMEOUT)
+    if (user_timeout)
+      set_socket_option(s, integer_option<IPPROTO_TCP, TCP_USER_TIMEOUT>(*user_timeout), "TCP_USER_TIMEOUT");
+#endif
+#if defined(TCP_NOTSENT_LOWAT)
+    if (not_sent_low_watermark)
+      set_socket_option(s, integer_option<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(*not_sent_low_watermark), "TCP_NOTSENT_LOWAT");
+#endif
+  }
+
+  // Applies options to listening socket before listen() is called.
+  template <class Acceptor>
+  void apply_listener(Acceptor& a) const
+  {
+    apply_buffer_sizes(a);
+#if defined(TCP_DEFER_ACCEPT)
+    if (defer_accept)
+      detail::set_socket_option(a, detail::integer_option<IPPROTO_TCP, TCP_DEFER_ACCEPT>(*defer_accept), "TCP_DEFER_ACCEPT");
+#endif
+  }
+
+  int listen_backlog() const
+  {
+    return backlog ? *backlog : boost::asio::socket_base::max_connections;
+  }
+
+  // Linux clears TCP_QUICKACK after it has sent an acknowledgement, so it
+  // has to be set again after every read.
+  template <class Socket>
+  void refresh(Socket& s) const
+  {
+#if defined(TCP_QUICKACK)
+    if (quick_ack)
+      detail::set_socket_option(s, detail::integer_option<IPPROTO_TCP, TCP_QUICKACK>(*quick_ack), "TCP_QUICKACK");
+#else
+    (void)s;
+#endif
+  }
+
+private:
+  template <class Socket>
+  void apply_buffer_sizes(Socket& s) const
+  {
+    if (receive_buffer_size)
+      detail::set_socket_option(s, boost::asio::socket_base::receive_buffer_size(*receive_buffer_size), "SO_RCVBUF");
+    if (send_buffer_size)
+      detail::set_socket_option(s, boost::asio::socket_base::send_buffer_size(*send_buffer_size), "SO_SNDBUF");
+  }
+};
+
+} // namespace tcp
+} // namespace transport
+} // namespace thrift
+} // namespace apache
+
+#endif // _THRIFT_TRANSPORT_TCP_SOCKET_OPTIONS_HPP_
@@ -27,46 +27,200 @@
 namespace apache { namespace thrift { namespace transport {
 namespace tcp {
 
-BOOST_FORCEINLINE transport<tls::socket>::transport
+template <class BindingMode>
+BOOST_FORCEINLINE transport<tls::socket, BindingMode>::transport
 (
   std::string const& address,
   port_type port,
-  tls::context_ptr ctx
-) : basic_transport(address, port), socket(*io_service, *ctx),
+  tls::context_ptr ctx,
+  socket_options const& options
+) : base_type(address, port, options), socket_bio(false), socket(*this->io_service, *ctx->get_shared_handle()),
   context(ctx)
-{}
+{
+  this->setReadBufferSize(SSL3_RT_MAX_PLAIN_LENGTH);
+}
 
-BOOST_FORCEINLINE transport<tls::socket>::transport
+template <class BindingMode>
+BOOST_FORCEINLINE transport<tls::socket, BindingMode>::transport
 (
   std::string const& address,
   std::string const& port,
-  tls::context_ptr ctx
-) : basic_transport(address, port), socket(*io_service, *ctx),
+  tls::context_ptr ctx,
+  socket_options const& options
+) : base_type(address, port, options), socket_bio(false), socket(*this->io_service, *ctx->get_shared_handle()),
   context(ctx)
-{}
+{
+  this->setReadBufferSize(SSL3_RT_MAX_PLAIN_LENGTH);
+}
 
-BOOST_FORCEINLINE transport<tls::socket>::socket_reference
-transport<tls::socket>::get_socket()
+template <class BindingMode>
+BOOST_FORCEINLINE typename transport<tls::socket, BindingMode>::socket_reference
+transport<tls::socket, BindingMode>::get_socket()
 {
   return socket.next_layer();
 }
 
-void transport<tls::socket>::open()
+template <class BindingMode>
+void transport<tls::socket, BindingMode>::open()
 {
-  basic_transport::open();
+  base_type::open();
   try
   {
-    socket.handshake(boost::asio::ssl::stream_base::client);
+    SSL* ssl = socket.native_handle();
+    // reopened transport starts a new connection with the same ssl
+    if (socket_bio)
+      SSL_clear(ssl);
+    SSL_set_quiet_shutdown(ssl, 0);
+    // reconnect resumes the previous session instead of full handshake
+    peer = this->getHost() + ":" + boost::lexical_cast<std::string>(this->getPort());
+    records.set_policy(context->record_size());
+    context->resume_session(ssl, peer);
+
+    // OpenSSL does blocking I/O of the socket itself
+    get_socket().native_non_blocking(false);
+    context->attach_socket(ssl, static_cast<int>(get_socket().native_handle()));
+    socket_bio = true;
+    detail::sigpipe_guard guard;
+    ERR_clear_error();
+    const int result = SSL_connect(ssl);
+    if (result != 1)
+    {
+      const int error = SSL_get_error(ssl, result);
+      if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+        BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(
+          apache::thrift::transport::TTransportException::TIMED_OUT, "SSL_connect timed out."));
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(ERR_error_string(ERR_get_error(), 0)));
+    }
+    context->keep_session(ssl);
   }
   catch (boost::system::system_error const& e)
   {
+    close_failed();
     BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(e.what()));
   }
+  catch (...)
+  {
+    close_failed();
+    throw;
+  }
+}
+
+// Connection without TLS is not open, nothing is sent to it.
+template <class BindingMode>
+void transport<tls::socket, BindingMode>::close_failed()
+{
+  SSL_set_quiet_shutdown(socket.native_handle(), 1);
+  boost::system::error_code ignored_ec;
+  get_socket().close(ignored_ec);
+}
+
+template <class BindingMode>
+uint32_t transport<tls::socket, BindingMode>::read_socket(uint8_t* buf, uint32_t len, bool some)
+{
+  if (!socket_bio || !this->isOpen())
+    BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(
+      apache::thrift::transport::TTransportException::NOT_OPEN, "Cannot perform IO operation on not open socket."));
+
+  detail::sigpipe_guard guard;
+  uint32_t have = 0U;
+  do
+  {
+    ERR_clear_error();
+    errno = 0;
+    const int result = SSL_read(socket.native_handle(), buf + have, static_cast<int>(len - have));
+    if (result > 0)
+    {
+      have += static_cast<uint32_t>(result);
+      continue;
+    }
+
+    const int system_error = errno;
+    const int error = SSL_get_error(socket.native_handle(), result);
+    // receive timeout of the socket has expired
+    if (error == SSL_ERROR_WANT_READ)
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(
+        apache::thrift::transport::TTransportException::TIMED_OUT, "SSL_read timed out."));
+    // close() does not write to a connection which is gone
+    SSL_set_quiet_shutdown(socket.native_handle(), 1);
+    // connection closed by peer
+    if (error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && !ERR_peek_error() && !system_error))
+      break;
+    // socket error, e.g. connection reset by peer
+    if (error == SSL_ERROR_SYSCALL && !ERR_peek_error())
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(
+        boost::system::error_code(system_error, boost::system::system_category()).message()));
+    BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(ERR_error_string(ERR_get_error(), 0)));
+  }
+  while (!some && have < len);
+  return have;
 }
 
-namespace tls {
+template <class BindingMode>
+void transport<tls::socket, BindingMode>::write_virt(const uint8_t* buf, uint32_t len)
+{
+  if (!socket_bio || !this->isOpen())
+    BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(
+      apache::thrift::transport::TTransportException::NOT_OPEN, "Cannot perform IO operation on not open socket."));
+
+  detail::sigpipe_guard guard;
+  if (records.enabled())
+    records.begin_write();
+  for (std::size_t written = 0; len; )
+  {
+    const uint32_t chunk = records.enabled()
+      ? static_cast<uint32_t>(std::min<std::size_t>(len, records.next_write(socket.native_handle(), written)))
+      : len;
+    ERR_clear_error();
+    const int result = SSL_write(socket.native_handle(), buf, static_cast<int>(chunk));
+    // send timeout of the socket has expired
+    if (result <= 0 && SSL_get_error(socket.native_handle(), result) == SSL_ERROR_WANT_WRITE)
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(
+        apache::thrift::transport::TTransportException::TIMED_OUT, "SSL_write timed out."));
+    if (result <= 0)
+    {
+      SSL_set_quiet_shutdown(socket.native_handle(), 1);
+      BOOST_THROW_EXCEPTION(apache::thrift::transport::TTransportException(ERR_error_string(ERR_get_error(), 0)));
+    }
+    buf += result;
+    len -= static_cast<uint32_t>(result);
+    written += static_cast<std::size_t>(result);
+  }
+}
+
+template <class BindingMode>
+BOOST_FORCEINLINE bool transport<tls::socket, BindingMode>::kernel_tls()
+{
+  return socket_bio && tls::context::kernel_tls_send(socket.native_handle())
+    && tls::context::kernel_tls_receive(socket.native_handle());
+}
+
+template <class BindingMode>
+void transport<tls::socket, BindingMode>::close()
+{
+  SSL* ssl = socket.native_handle();
+  if (socket_bio && this->isOpen())
+  {
+    // Sends close_notify without waiting for the one of the peer, failure to
+    // send it does not matter to a connection being closed.
+    boost::system::error_code ignored_ec;
+    get_socket().native_non_blocking(true, ignored_ec);
+    detail::sigpipe_guard guard;
+    ERR_clear_error();
+    SSL_shutdown(ssl);
+    ERR_clear_error();
+  }
+  // OpenSSL drops sessions of connections freed without TLS shutdown,
+  // mark it done so the cached session stays resumable.
+  SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+  base_type::close();
+}
+
+template <class BindingMode>
+BOOST_FORCEINLINE bool transport<tls::socket, BindingMode>::session_reused()
+{
+  return SSL_session_reused(socket.native_handle()) == 1;
+}
 
-} // namespace tls
 } // namespace tcp
 } // namespace transport
 } // namespace thrift
@@ -23,14 +23,18 @@
 #define _THRIFT_TRANSPORT_TCP_TLS_TRANSPORT_HPP_
 
 #include <thrift/transport/tcp/transport.hpp>
+#include <thrift/transport/tcp/detail/socket_ops.hpp>
 #include <boost/asio/ssl.hpp>
 #include <thrift/server/tcp/tls/context.hpp>
+#include <thrift/server/tcp/tls/record_size.hpp>
 #include <boost/shared_ptr.hpp>
+#include <cerrno>
 
 namespace apache { namespace thrift { namespace transport {
 namespace tcp { namespace tls {
 
 using apache::thrift::server::tcp::tls::context;
+using apache::thrift::server::tcp::tls::record_sizer;
 typedef boost::shared_ptr<context> context_ptr;
 
 using apache::thrift::transport::tcp::transport;
@@ -39,19 +43,44 @@ typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket;
 
 } // namespace tls
 
-template <>
-struct transport<tls::socket> : basic_transport<tls::socket, transport>
+template <class BindingMode>
+struct transport<tls::socket, BindingMode> : basic_transport<tls::socket, transport, BindingMode>
 {
+  typedef basic_transport<tls::socket, tcp::transport, BindingMode> base_type;
   typedef tls::socket::next_layer_type& socket_reference;
 
-  transport(std::string const& address, port_type port, tls::context_ptr context);
-  transport(std::string const& address, std::string const& port, tls::context_ptr context);
+  transport(std::string const& address, port_type port, tls::context_ptr context, socket_options const& options = socket_options());
+  transport(std::string const& address, std::string const& port, tls::context_ptr context, socket_options const& options = socket_options());
 
   void open();
+  void close();
 
   socket_reference get_socket();
 
+  // Whether the last handshake resumed a session cached by the context.
+  bool session_reused();
+
+  // OpenSSL reads and writes the socket itself, so recv and send timeouts
+  // apply as kernel timeouts of the socket, and with context::kernel_tls()
+  // it hands encryption over to the kernel. Returns whether the kernel
+  // encrypts records in both directions.
+  bool kernel_tls();
+
+  void write_virt(const uint8_t* buf, uint32_t len);
+
 private:
+  friend class basic_transport<tls::socket, tcp::transport, BindingMode>;
+
+  // Decrypts into buf, the read buffer holds a whole record.
+  uint32_t read_socket(uint8_t* buf, uint32_t len, bool some);
+  void close_failed();
+
+  // ssl is attached to the socket, set by the first open().
+  bool socket_bio;
+  // Record sizes of requests, see context::record_size().
+  tls::record_sizer records;
+  // Key of sessions cached by the context, outlives socket.
+  std::string peer;
   tls::socket socket;
   tls::context_ptr context;
 };
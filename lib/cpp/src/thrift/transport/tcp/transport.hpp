@@ -28,19 +28,22 @@
 
 namespace apache { namespace thrift { namespace transport { namespace tcp {
 
-template <class Stream>
+// BindingMode is detail::dynamic_binding or detail::static_binding.
+template <class Stream, class BindingMode = detail::dynamic_binding>
 struct transport;
 
-template <>
-struct transport<boost::asio::ip::tcp::socket> : basic_transport<boost::asio::ip::tcp::socket, transport>
+template <class BindingMode>
+struct transport<boost::asio::ip::tcp::socket, BindingMode>
+  : basic_transport<boost::asio::ip::tcp::socket, transport, BindingMode>
 {
+  typedef basic_transport<boost::asio::ip::tcp::socket, tcp::transport, BindingMode> base_type;
   typedef boost::asio::ip::tcp::socket& socket_reference;
 
 #if defined(HAS_INHERITING_CONSTRUCTORS)
-  using basic_transport::basic_transport;
+  using base_type::base_type;
 #else
-  transport(std::string const& address, port_type port);
-  transport(std::string const& address, std::string const& port);
+  transport(std::string const& address, port_type port, socket_options const& options = socket_options());
+  transport(std::string const& address, std::string const& port, socket_options const& options = socket_options());
 #endif
 
   socket_reference get_socket();